@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "histogram.h"
+
+namespace topper {
+
+Histogram::Histogram()
+    : counts_(index(std::numeric_limits<uint64_t>::max()) + 1, 0) { }
+
+size_t Histogram::index(uint64_t value) {
+    if (value < kSubBuckets) {
+        return value;
+    }
+    // Values in [2^e, 2^(e+1)) are resolved to 2^(e+1-kSubBits)
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - kSubBits + 1;
+    return shift * kHalfSubBuckets + (value >> shift);
+}
+
+uint64_t Histogram::highestEquivalent(size_t index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+    int shift = index / kHalfSubBuckets - 1;
+    uint64_t sub = index - shift * kHalfSubBuckets;
+    return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    ++counts_[index(value)];
+    ++count_;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+}
+
+void Histogram::merge(Histogram const& other) {
+    for (size_t i = 0; i < counts_.size(); ++i) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+uint64_t Histogram::percentile(double percentile) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    percentile = std::min(std::max(percentile, 0.0), 100.0);
+    uint64_t rank = static_cast<uint64_t>(
+        std::ceil(percentile / 100.0 * count_));
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            return std::min(highestEquivalent(i), max_);
+        }
+    }
+    return max_;
+}
+
+} // topper namespace
@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BENCH_HISTOGRAM_H_
+#define BENCH_HISTOGRAM_H_
+
+#include <inttypes.h>
+
+#include <limits>
+#include <vector>
+
+namespace topper {
+
+/**
+ * A log-linear histogram in the style of HdrHistogram.
+ *
+ * Values are bucketed by magnitude, and each power of two is divided into
+ * linear sub-buckets, so that any recorded value is reported with a
+ * relative error below 1%. Recording is constant-time and allocation-free.
+ */
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t value);
+
+    // Adds the values recorded by another histogram
+    void merge(Histogram const& other);
+
+    /**
+     * @param[in] percentile in the range [0, 100]
+     * @return the largest value equivalent to the one at that percentile,
+     *         or zero if no values have been recorded
+     */
+    uint64_t percentile(double percentile) const;
+
+    uint64_t count() const { return count_; }
+    uint64_t min() const { return count_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const {
+        return count_ ? static_cast<double>(sum_) / count_ : 0.0;
+    }
+
+    // Visible for testing
+    static size_t index(uint64_t value);
+    static uint64_t highestEquivalent(size_t index);
+private:
+    // Each power of two above kSubBuckets is split in kSubBuckets / 2
+    static const int kSubBits = 8;
+    static const uint64_t kSubBuckets = 1 << kSubBits;
+    static const uint64_t kHalfSubBuckets = kSubBuckets / 2;
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = std::numeric_limits<uint64_t>::max();
+    uint64_t max_ = 0;
+};
+
+} // topper namespace
+
+#endif // BENCH_HISTOGRAM_H_
@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "detail/dispatcher.h"
+#include "detail/server-impl.h"
+#include "metrics_resource.h"
+#include "microbench.h"
+#include "parameter_internal.h"
+#include "resource.h"
+#include "response.h"
+
+namespace topper {
+namespace {
+
+class NoParamResource : public Resource {
+public:
+    NoParamResource() : Resource("/hello") { }
+    Response get() const {
+        return Response(HttpCode::OK);
+    }
+};
+
+class StringParamResource : public Resource {
+public:
+    StringParamResource() : Resource("/{a}/{b}") { }
+    Response get(StringParam const& a, StringParam const& b) const {
+        bench::doNotOptimize(a.value().size() + b.value().size());
+        return Response(HttpCode::OK);
+    }
+};
+
+class MixedParamResource : public Resource {
+public:
+    MixedParamResource() : Resource("/{id}/{name}/{ratio}") { }
+    Response get(IntParam<int64_t> const& id, StringParam const& name,
+            QueryParams const& query, DoubleParam const& ratio,
+            HeaderParams const& headers) const {
+        bench::doNotOptimize(id.value());
+        bench::doNotOptimize(ratio.value());
+        bench::doNotOptimize(&name);
+        bench::doNotOptimize(&query);
+        bench::doNotOptimize(&headers);
+        return Response(HttpCode::OK);
+    }
+};
+
+struct Invocation {
+    Invocation()
+        : uriInfo{queryParams, postParams, headerParams, entity, nullptr} { }
+    QueryParamsImpl queryParams;
+    PostParamsImpl postParams;
+    HeaderParamsImpl headerParams;
+    Entity entity;
+    UriInfo uriInfo;
+};
+
+template<typename R>
+void dispatch(bench::State& state, std::vector<std::string> const& params) {
+    R resource;
+    detail::Methods methods = detail::bindMethods(&resource);
+    Invocation request;
+    while (state.keepRunning()) {
+        bench::doNotOptimize(methods.get(params, request.uriInfo));
+    }
+}
+
+std::string body(int64_t size) {
+    return std::string(size, 'x');
+}
+
+} // anonymous namespace
+
+TOPPER_BENCHMARK(dispatch_no_params) {
+    dispatch<NoParamResource>(state, {});
+}
+
+TOPPER_BENCHMARK(dispatch_string_params) {
+    dispatch<StringParamResource>(state, {"first", "second"});
+}
+
+TOPPER_BENCHMARK(dispatch_mixed_params) {
+    dispatch<MixedParamResource>(state, {"1234", "visitor", "0.25"});
+}
+
+TOPPER_BENCHMARK(dispatch_malformed_params) {
+    dispatch<MixedParamResource>(state, {"12x4", "visitor", "0.25"});
+}
+
+TOPPER_BENCHMARK(response_to_string, {0, 1024, 65536}) {
+    Response response(HttpCode::OK, MediaType::TEXT_PLAIN, body(state.arg()));
+    while (state.keepRunning()) {
+        bench::doNotOptimize(response.to_string());
+    }
+}
+
+TOPPER_BENCHMARK(response_to_string_headers, {1, 8, 32}) {
+    Response response(HttpCode::OK, MediaType::TEXT_PLAIN, body(64));
+    for (int64_t i = 0; i < state.arg(); ++i) {
+        response.header("X-Header-" + std::to_string(i), "value");
+    }
+    while (state.keepRunning()) {
+        bench::doNotOptimize(response.to_string());
+    }
+}
+
+TOPPER_BENCHMARK(metrics_resource, {1, 10, 100, 1000}) {
+    MetricRegistry registry;
+    for (int64_t i = 0; i < state.arg(); ++i) {
+        registry.timer("bench.timer." + std::to_string(i))->update(
+            std::chrono::nanoseconds(1000 * i));
+        registry.counter("bench.counter." + std::to_string(i))->increment();
+    }
+    MetricsResource resource(&registry);
+    while (state.keepRunning()) {
+        bench::doNotOptimize(resource.get());
+    }
+}
+
+} // topper namespace
@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "microbench.h"
+#include "path_components.h"
+#include "resource.h"
+#include "resource_matcher.h"
+
+namespace topper {
+namespace {
+
+const std::vector<int64_t> kTableSizes = {10, 100, 1000, 10000, 100000};
+
+class RouteResource : public Resource {
+public:
+    explicit RouteResource(std::string const& path) : Resource(path) { }
+};
+
+class RouteTable {
+public:
+    explicit RouteTable(std::vector<std::string> const& paths) {
+        std::vector<ResourceMatcher::Registration> registrations;
+        for (auto const& path : paths) {
+            resources_.emplace_back(new RouteResource(path));
+            registrations.push_back({resources_.back().get(),
+                detail::Methods(), RouteOptions()});
+        }
+        matcher_.addResources(registrations);
+    }
+
+    ResourceMatcher const& matcher() const { return matcher_; }
+private:
+    // Outlive the matcher
+    std::vector<std::unique_ptr<RouteResource>> resources_;
+    ResourceMatcher matcher_;
+};
+
+// Tables are expensive to build at the larger sizes, so they are built
+// once and shared between runs
+template<typename Generator>
+RouteTable const& table(std::map<int64_t, std::unique_ptr<RouteTable>> *cache,
+        int64_t size, Generator generate) {
+    auto& entry = (*cache)[size];
+    if (!entry) {
+        std::vector<std::string> paths;
+        for (int64_t i = 0; i < size; ++i) {
+            paths.push_back(generate(i));
+        }
+        entry.reset(new RouteTable(paths));
+    }
+    return *entry;
+}
+
+// Mostly-literal routes, e.g. /service3/resource1234/{id}
+std::string literalRoute(int64_t i) {
+    return "/service" + std::to_string(i % 10) + "/resource" +
+        std::to_string(i) + "/{id}";
+}
+
+// Routes that share a run of variables before a literal leaf, e.g.
+// /{a}/{b}/{c}/{d}/leaf1234
+std::string variableRoute(int64_t i) {
+    return "/{a}/{b}/{c}/{d}/leaf" + std::to_string(i);
+}
+
+} // anonymous namespace
+
+TOPPER_BENCHMARK(matcher_literal, kTableSizes) {
+    static std::map<int64_t, std::unique_ptr<RouteTable>> cache;
+    RouteTable const& routes = table(&cache, state.arg(), literalRoute);
+    int64_t last = state.arg() - 1;
+    std::string path = "/service" + std::to_string(last % 10) + "/resource" +
+        std::to_string(last) + "/42";
+    while (state.keepRunning()) {
+        bench::doNotOptimize(routes.matcher().match(path));
+    }
+}
+
+TOPPER_BENCHMARK(matcher_variable_heavy, kTableSizes) {
+    static std::map<int64_t, std::unique_ptr<RouteTable>> cache;
+    RouteTable const& routes = table(&cache, state.arg(), variableRoute);
+    std::string path = "/1/2/3/4/leaf" + std::to_string(state.arg() - 1);
+    while (state.keepRunning()) {
+        bench::doNotOptimize(routes.matcher().match(path));
+    }
+}
+
+TOPPER_BENCHMARK(matcher_miss, kTableSizes) {
+    static std::map<int64_t, std::unique_ptr<RouteTable>> cache;
+    RouteTable const& routes = table(&cache, state.arg(), literalRoute);
+    std::string path = "/service1/missing/42";
+    while (state.keepRunning()) {
+        bench::doNotOptimize(routes.matcher().match(path));
+    }
+}
+
+// Worst case for the breadth-first search: every combination of literal and
+// variable components is registered for a path of the given depth, so each
+// component doubles the number of live search paths.
+TOPPER_BENCHMARK(matcher_branching, {2, 4, 6, 8}) {
+    static std::map<int64_t, std::unique_ptr<RouteTable>> cache;
+    int64_t depth = state.arg();
+    RouteTable const& routes = table(&cache, 1 << depth, [depth](int64_t i) {
+            std::string path;
+            for (int64_t bit = 0; bit < depth; ++bit) {
+                path += (i & (1 << bit)) ? "/{v" + std::to_string(bit) + "}"
+                                         : std::string("/x");
+            }
+            return path;
+        });
+    std::string path;
+    for (int64_t i = 0; i < depth; ++i) {
+        path += "/x";
+    }
+    while (state.keepRunning()) {
+        bench::doNotOptimize(routes.matcher().match(path));
+    }
+}
+
+TOPPER_BENCHMARK(path_components, {2, 8, 32}) {
+    std::string path;
+    for (int64_t i = 0; i < state.arg(); ++i) {
+        path += "/component" + std::to_string(i);
+    }
+    while (state.keepRunning()) {
+        size_t count = 0;
+        for (auto const& component : PathComponents(path)) {
+            count += component.size();
+        }
+        bench::doNotOptimize(count);
+    }
+}
+
+} // topper namespace
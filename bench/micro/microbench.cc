@@ -0,0 +1,163 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Runner for the microbenchmark suite. Each benchmark is run with an
+// increasing number of iterations until a run takes at least the minimum
+// time; that run's time and allocations are reported per iteration.
+//
+// Usage: topper-microbench [--min-time=MS] [filter]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "microbench.h"
+
+namespace {
+
+thread_local uint64_t allocationCount = 0;
+
+} // anonymous namespace
+
+// Count every allocation made by the process
+void* operator new(size_t size) {
+    ++allocationCount;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+namespace topper {
+namespace bench {
+
+uint64_t allocations() {
+    return allocationCount;
+}
+
+namespace {
+
+struct Benchmark {
+    std::string name;
+    Body body;
+    std::vector<int64_t> args;
+};
+
+std::vector<Benchmark>& registry() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+void run(std::string const& name, Body const& body, int64_t arg,
+        std::chrono::nanoseconds minTime) {
+    uint64_t iterations = 1;
+    for (;;) {
+        State state(iterations, arg);
+        body(state);
+        if (state.elapsed() >= minTime || iterations >= (1ULL << 40)) {
+            double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                state.elapsed()).count();
+            printf("%-40s %12" PRIu64 " %12.1f %12.2f\n", name.c_str(),
+                iterations, ns / iterations,
+                static_cast<double>(state.allocationCount()) / iterations);
+            fflush(stdout);
+            return;
+        }
+
+        // Aim just past the minimum time, growing at most 10x per round
+        double elapsed = std::max<double>(1,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                state.elapsed()).count());
+        double scale = std::min(10.0, 1.2 * minTime.count() / elapsed);
+        iterations = std::max<uint64_t>(iterations + 1,
+            static_cast<uint64_t>(iterations * scale));
+    }
+}
+
+} // anonymous namespace
+
+Registration::Registration(std::string const& name, Body const& body,
+        std::vector<int64_t> const& args) {
+    registry().push_back(Benchmark{name, body, args});
+}
+
+} // bench namespace
+} // topper namespace
+
+int main(int argc, char **argv) {
+    using namespace topper::bench;
+
+    std::chrono::nanoseconds minTime = std::chrono::milliseconds(200);
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--min-time=", 11) == 0) {
+            minTime = std::chrono::milliseconds(atoi(argv[i] + 11));
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--min-time=MS] [filter]\n", argv[0]);
+            return 1;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    printf("%-40s %12s %12s %12s\n", "Benchmark", "Iterations", "ns/op",
+        "allocs/op");
+    for (Benchmark const& benchmark : registry()) {
+        for (int64_t arg : benchmark.args) {
+            std::string name = benchmark.name;
+            if (benchmark.args.size() > 1 || arg != 0) {
+                name += "/" + std::to_string(arg);
+            }
+            if (name.find(filter) == std::string::npos) {
+                continue;
+            }
+            run(name, benchmark.body, arg, minTime);
+        }
+    }
+    return 0;
+}
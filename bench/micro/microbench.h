@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BENCH_MICRO_MICROBENCH_H_
+#define BENCH_MICRO_MICROBENCH_H_
+
+#include <inttypes.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace topper {
+namespace bench {
+
+// Allocations made by the calling thread so far
+uint64_t allocations();
+
+/**
+ * Timing state for one run of a benchmark. The body performs its setup,
+ * then loops on keepRunning(); only the loop is timed.
+ *
+ *     while (state.keepRunning()) {
+ *         doNotOptimize(matcher.match(path));
+ *     }
+ */
+class State {
+public:
+    State(uint64_t iterations, int64_t arg)
+        : iterations_(iterations), remaining_(iterations), arg_(arg) { }
+
+    bool keepRunning() {
+        if (remaining_ == iterations_) {
+            allocations_ = allocations();
+            start_ = std::chrono::steady_clock::now();
+        }
+        if (remaining_ == 0) {
+            elapsed_ = std::chrono::steady_clock::now() - start_;
+            allocations_ = allocations() - allocations_;
+            return false;
+        }
+        --remaining_;
+        return true;
+    }
+
+    // The benchmark parameter, e.g. the size of a route table
+    int64_t arg() const { return arg_; }
+
+    uint64_t iterations() const { return iterations_; }
+    std::chrono::steady_clock::duration elapsed() const { return elapsed_; }
+    uint64_t allocationCount() const { return allocations_; }
+private:
+    const uint64_t iterations_;
+    uint64_t remaining_;
+    const int64_t arg_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::duration elapsed_{0};
+    uint64_t allocations_ = 0;
+};
+
+typedef std::function<void(State&)> Body;
+
+// Adds a benchmark to the suite, run once for each argument
+struct Registration {
+    Registration(std::string const& name, Body const& body,
+        std::vector<int64_t> const& args = {0});
+};
+
+// Keeps the compiler from discarding a computed value
+template<typename T>
+inline void doNotOptimize(T const& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+} // bench namespace
+} // topper namespace
+
+#define TOPPER_BENCHMARK_CONCAT2(a, b) a ## b
+#define TOPPER_BENCHMARK_CONCAT(a, b) TOPPER_BENCHMARK_CONCAT2(a, b)
+
+/**
+ * Define a benchmark:
+ *
+ *     TOPPER_BENCHMARK(matcher_literal, {10, 1000}) { ... state.arg() ... }
+ */
+#define TOPPER_BENCHMARK(name, ...)                                         \
+    static void TOPPER_BENCHMARK_CONCAT(bench_, name)(                      \
+        ::topper::bench::State& state);                                     \
+    static ::topper::bench::Registration                                    \
+        TOPPER_BENCHMARK_CONCAT(registration_, name)(#name,                 \
+            TOPPER_BENCHMARK_CONCAT(bench_, name), ##__VA_ARGS__);          \
+    static void TOPPER_BENCHMARK_CONCAT(bench_, name)(                      \
+        ::topper::bench::State& state)
+
+#endif // BENCH_MICRO_MICROBENCH_H_
@@ -0,0 +1,140 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "wte/event_base.h"
+
+#include "http_parser.h"
+#include "microbench.h"
+#include "query_string.h"
+#include "request_builder.h"
+#include "server_instance.h"
+
+namespace topper {
+namespace {
+
+std::string mkQuery(int64_t params) {
+    std::string query;
+    for (int64_t i = 0; i < params; ++i) {
+        if (i) {
+            query += "&";
+        }
+        query += "key" + std::to_string(i) + "=value" + std::to_string(i);
+    }
+    return query;
+}
+
+std::string mkRequest(int64_t headers, int64_t params) {
+    std::string request = "GET /users/1234/details";
+    if (params) {
+        request += "?" + mkQuery(params);
+    }
+    request += " HTTP/1.1\r\nHost: 127.0.0.1:31337\r\n";
+    for (int64_t i = 0; i < headers; ++i) {
+        request += "X-Header-" + std::to_string(i) + ": value-" +
+            std::to_string(i) + "\r\n";
+    }
+    return request + "\r\n";
+}
+
+// A request context with parser callbacks that stop at building the
+// Request, so that neither matching nor dispatch is measured
+class BuilderHarness {
+public:
+    BuilderHarness()
+            : base_(wte::mkEventBase()), tracer_(1),
+              server_("127.0.0.1", 0, &metrics_, &tracer_) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds_) != 0) {
+            abort();
+        }
+        ctx_ = new ServerInstance::RequestContext(&server_, base_, fds_[0]);
+        ctx_->settings.on_message_complete = built;
+    }
+
+    ~BuilderHarness() {
+        delete ctx_;
+        close(fds_[1]);
+        delete base_;
+    }
+
+    size_t parse(std::string const& request) {
+        ctx_->builder = RequestBuilder();
+        http_parser_init(&ctx_->parser, HTTP_REQUEST);
+        ctx_->parser.data = ctx_;
+        return http_parser_execute(&ctx_->parser, &ctx_->settings,
+            request.data(), request.size());
+    }
+private:
+    static int built(http_parser *parser) {
+        auto *ctx = reinterpret_cast<ServerInstance::RequestContext*>(
+            parser->data);
+        if (ctx->builder.validate(parser) != HttpCode::OK) {
+            abort();
+        }
+        Request request = ctx->builder.build(ctx);
+        bench::doNotOptimize(request);
+        return 0;
+    }
+
+    wte::EventBase *base_;
+    MetricRegistry metrics_;
+    Tracer tracer_;
+    ServerInstance server_;
+    int fds_[2];
+    ServerInstance::RequestContext *ctx_;
+};
+
+} // anonymous namespace
+
+TOPPER_BENCHMARK(query_string, {1, 8, 64}) {
+    std::string query = mkQuery(state.arg());
+    while (state.keepRunning()) {
+        size_t count = 0;
+        for (auto const& param : QueryString(query)) {
+            count += param.second.size();
+        }
+        bench::doNotOptimize(count);
+    }
+}
+
+TOPPER_BENCHMARK(request_builder_headers, {0, 8, 32, 128}) {
+    BuilderHarness harness;
+    std::string request = mkRequest(state.arg(), 0);
+    while (state.keepRunning()) {
+        bench::doNotOptimize(harness.parse(request));
+    }
+}
+
+TOPPER_BENCHMARK(request_builder_query, {0, 8, 32, 128}) {
+    BuilderHarness harness;
+    std::string request = mkRequest(1, state.arg());
+    while (state.keepRunning()) {
+        bench::doNotOptimize(harness.parse(request));
+    }
+}
+
+} // topper namespace
@@ -0,0 +1,528 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// A load generator for Topper servers.
+//
+// In closed-loop mode each connection issues a new request as soon as the
+// previous one completes (or keeps `pipeline` requests outstanding). In
+// open-loop mode requests are issued on a fixed schedule regardless of
+// how quickly the server responds, and latency is measured from the time
+// each request was scheduled; a stalled server therefore shows up in the
+// tail instead of silently reducing the offered load.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wte/event_base.h"
+#include "wte/event_handler.h"
+
+#include "histogram.h"
+#include "http_client.h"
+
+namespace topper {
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// How long a closed-loop request waits after failing to reach the server
+const std::chrono::milliseconds kRetryDelay(10);
+
+struct Config {
+    std::string host = "127.0.0.1";
+    short port = 31337;
+    int threads = 1;
+    int connections = 8;
+    int pipeline = 1;
+    bool keepAlive = true;
+    double rate = 0;        // Requests per second; zero for closed loop
+    int duration = 10;      // Seconds, after warmup
+    int warmup = 1;         // Seconds excluded from the results
+    int timeout = 5000;     // Milliseconds
+    std::string mixFile;
+    bool histogram = false;
+};
+
+struct Target {
+    std::string method;
+    std::string path;
+    std::string body;
+};
+
+// A weighted selection of requests
+class Mix {
+public:
+    void add(unsigned weight, Target const& target) {
+        total_ += weight;
+        targets_.push_back(target);
+        cumulative_.push_back(total_);
+    }
+
+    Target const& choose(std::mt19937 *rng) const {
+        if (targets_.size() == 1) {
+            return targets_[0];
+        }
+        std::uniform_int_distribution<unsigned> dist(0, total_ - 1);
+        unsigned pick = dist(*rng);
+        size_t i = 0;
+        while (cumulative_[i] <= pick) {
+            ++i;
+        }
+        return targets_[i];
+    }
+
+    bool empty() const { return targets_.empty(); }
+private:
+    std::vector<Target> targets_;
+    std::vector<unsigned> cumulative_;
+    unsigned total_ = 0;
+};
+
+// Mix files hold one request per line as `<weight> <method> <path> [body]`;
+// blank lines and lines starting with '#' are ignored.
+Mix loadMix(std::string const& file) {
+    std::ifstream in(file);
+    if (!in) {
+        throw std::runtime_error("Unable to open " + file);
+    }
+    Mix mix;
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        ++lineno;
+        std::istringstream fields(line);
+        unsigned weight;
+        Target target;
+        if (!(fields >> std::ws) || fields.peek() == '#') {
+            continue;
+        }
+        if (!(fields >> weight >> target.method >> target.path) ||
+                weight == 0) {
+            throw std::runtime_error(file + ":" + std::to_string(lineno) +
+                ": expected <weight> <method> <path> [body]");
+        }
+        std::getline(fields >> std::ws, target.body);
+        mix.add(weight, target);
+    }
+    if (mix.empty()) {
+        throw std::runtime_error(file + ": no requests");
+    }
+    return mix;
+}
+
+struct Stats {
+    Histogram latency;      // Nanoseconds
+    uint64_t errors[5] = {0, 0, 0, 0, 0};
+    uint64_t non2xx = 0;
+
+    void merge(Stats const& other) {
+        latency.merge(other.latency);
+        for (int i = 0; i < 5; ++i) {
+            errors[i] += other.errors[i];
+        }
+        non2xx += other.non2xx;
+    }
+};
+
+// Drives a share of the load from its own event base and thread
+class Worker {
+public:
+    Worker(Config const& config, Mix const& mix, int connections,
+            double rate, Clock::time_point measure, Clock::time_point end,
+            unsigned seed)
+        : config_(config), mix_(mix), connections_(connections),
+          rate_(rate), measure_(measure), end_(end), rng_(seed),
+          ticker_(this), retrier_(this), stopper_(this) { }
+
+    void run();
+
+    Stats const& stats() const { return stats_; }
+private:
+    class Ticker final : public wte::TimeoutHandler {
+    public:
+        explicit Ticker(Worker *worker) : worker_(worker) { }
+        void expired() noexcept override { worker_->tick(); }
+    private:
+        Worker *worker_;
+    };
+
+    class Retrier final : public wte::TimeoutHandler {
+    public:
+        explicit Retrier(Worker *worker) : worker_(worker) { }
+        void expired() noexcept override { worker_->retry(); }
+    private:
+        Worker *worker_;
+    };
+
+    class Stopper final : public wte::TimeoutHandler {
+    public:
+        explicit Stopper(Worker *worker) : worker_(worker) { }
+        void expired() noexcept override {
+            worker_->stopped_ = true;
+            worker_->base_->stop();
+        }
+    private:
+        Worker *worker_;
+    };
+
+    void issue(Clock::time_point intended);
+    void complete(Clock::time_point intended, ClientError error,
+        ClientResponse const& response);
+
+    // Issue the requests that are due in open-loop mode
+    void tick();
+
+    // Reissue the closed-loop requests that failed to reach the server
+    void retry();
+
+    Config const& config_;
+    Mix const& mix_;
+    const int connections_;
+    const double rate_;
+    const Clock::time_point measure_;
+    const Clock::time_point end_;
+    std::mt19937 rng_;
+
+    wte::EventBase *base_ = nullptr;
+    HttpClient *client_ = nullptr;
+    bool stopped_ = false;
+
+    Clock::time_point next_;
+    Clock::duration period_;
+    int retries_ = 0;
+
+    Ticker ticker_;
+    Retrier retrier_;
+    Stopper stopper_;
+    Stats stats_;
+};
+
+struct timeval toTimeval(Clock::duration duration) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+        duration).count();
+    if (us < 0) {
+        us = 0;
+    }
+    struct timeval tv;
+    tv.tv_sec = us / 1000000;
+    tv.tv_usec = us % 1000000;
+    return tv;
+}
+
+void Worker::run() {
+    base_ = wte::mkEventBase();
+
+    HttpClientOptions options;
+    options.maxConnectionsPerHost = connections_;
+    options.pipelineDepth = config_.pipeline;
+    options.keepAlive = config_.keepAlive;
+    options.requestTimeout = std::chrono::milliseconds(config_.timeout);
+    client_ = new HttpClient(base_, options);
+
+    struct timeval tv = toTimeval(end_ - Clock::now());
+    base_->registerTimeout(&stopper_, &tv);
+
+    if (rate_ > 0) {
+        period_ = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / rate_));
+        next_ = Clock::now();
+        tick();
+    } else {
+        int outstanding = connections_ *
+            (config_.keepAlive ? config_.pipeline : 1);
+        for (int i = 0; i < outstanding; ++i) {
+            issue(Clock::now());
+        }
+    }
+
+    base_->loop(wte::EventBase::LoopMode::FOREVER);
+
+    // Requests still outstanding are abandoned
+    delete client_;
+    base_->unregisterTimeout(&ticker_);
+    base_->unregisterTimeout(&retrier_);
+    base_->unregisterTimeout(&stopper_);
+    delete base_;
+}
+
+void Worker::issue(Clock::time_point intended) {
+    Target const& target = mix_.choose(&rng_);
+    client_->request(target.method, config_.host, config_.port, target.path,
+        HttpClient::Headers(), target.body,
+        [this, intended](ClientError error, ClientResponse const& response) {
+            complete(intended, error, response);
+        });
+}
+
+void Worker::complete(Clock::time_point intended, ClientError error,
+        ClientResponse const& response) {
+    if (stopped_) {
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+    if (intended >= measure_) {
+        if (error != ClientError::NONE) {
+            ++stats_.errors[static_cast<int>(error)];
+        } else {
+            if (response.status < 200 || response.status > 299) {
+                ++stats_.non2xx;
+            }
+            stats_.latency.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - intended).count());
+        }
+    }
+
+    if (rate_ > 0 || now >= end_) {
+        return;
+    }
+    if (error == ClientError::CONNECT || error == ClientError::CLOSED) {
+        // Wait before trying again so a server that is down does not spin
+        // the worker
+        if (retries_++ == 0) {
+            struct timeval tv = toTimeval(kRetryDelay);
+            base_->registerTimeout(&retrier_, &tv);
+        }
+        return;
+    }
+    issue(now);
+}
+
+void Worker::retry() {
+    int retries = retries_;
+    retries_ = 0;
+    Clock::time_point now = Clock::now();
+    for (int i = 0; i < retries && now < end_; ++i) {
+        issue(now);
+    }
+}
+
+void Worker::tick() {
+    // Catch up on every request that should have been sent by now, each
+    // timed from its scheduled start
+    Clock::time_point now = Clock::now();
+    while (next_ <= now && next_ < end_) {
+        issue(next_);
+        next_ += period_;
+    }
+    if (next_ < end_) {
+        struct timeval tv = toTimeval(next_ - now);
+        base_->registerTimeout(&ticker_, &tv);
+    }
+}
+
+void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  -H, --host ADDR          server address (default 127.0.0.1)\n"
+        "  -p, --port PORT          server port (default 31337)\n"
+        "  -t, --threads N          client threads (default 1)\n"
+        "  -c, --connections N      connections, across all threads "
+            "(default 8)\n"
+        "  -P, --pipeline N         requests in flight per connection "
+            "(default 1)\n"
+        "  -k, --no-keepalive       open a connection per request\n"
+        "  -r, --rate N             open loop at N requests/s "
+            "(default: closed loop)\n"
+        "  -d, --duration S         measured seconds (default 10)\n"
+        "  -w, --warmup S           unmeasured seconds first (default 1)\n"
+        "  -T, --timeout MS         request timeout (default 5000)\n"
+        "  -m, --mix FILE           request mix, one `<weight> <method> "
+            "<path> [body]` per line\n"
+        "  -g, --histogram          print the full latency distribution\n",
+        argv0);
+}
+
+bool parseArgs(int argc, char **argv, Config *config) {
+    static const struct option kOptions[] = {
+        {"host", required_argument, nullptr, 'H'},
+        {"port", required_argument, nullptr, 'p'},
+        {"threads", required_argument, nullptr, 't'},
+        {"connections", required_argument, nullptr, 'c'},
+        {"pipeline", required_argument, nullptr, 'P'},
+        {"no-keepalive", no_argument, nullptr, 'k'},
+        {"rate", required_argument, nullptr, 'r'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"warmup", required_argument, nullptr, 'w'},
+        {"timeout", required_argument, nullptr, 'T'},
+        {"mix", required_argument, nullptr, 'm'},
+        {"histogram", no_argument, nullptr, 'g'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "H:p:t:c:P:kr:d:w:T:m:gh",
+            kOptions, nullptr)) != -1) {
+        switch (opt) {
+        case 'H': config->host = optarg; break;
+        case 'p': config->port = atoi(optarg); break;
+        case 't': config->threads = atoi(optarg); break;
+        case 'c': config->connections = atoi(optarg); break;
+        case 'P': config->pipeline = atoi(optarg); break;
+        case 'k': config->keepAlive = false; break;
+        case 'r': config->rate = atof(optarg); break;
+        case 'd': config->duration = atoi(optarg); break;
+        case 'w': config->warmup = atoi(optarg); break;
+        case 'T': config->timeout = atoi(optarg); break;
+        case 'm': config->mixFile = optarg; break;
+        case 'g': config->histogram = true; break;
+        default: return false;
+        }
+    }
+
+    if (config->threads < 1 || config->connections < config->threads ||
+            config->pipeline < 1 || config->duration < 1 ||
+            config->warmup < 0 || config->rate < 0 || config->timeout < 1) {
+        fprintf(stderr, "Invalid arguments\n");
+        return false;
+    }
+    return true;
+}
+
+double toMicros(uint64_t nanos) {
+    return nanos / 1000.0;
+}
+
+void report(Config const& config, Stats const& stats) {
+    double seconds = config.duration;
+    uint64_t errors = 0;
+    for (uint64_t count : stats.errors) {
+        errors += count;
+    }
+    Histogram const& latency = stats.latency;
+
+    printf("  Requests:   %" PRIu64 " (%.1f req/s)\n", latency.count(),
+        latency.count() / seconds);
+    printf("  Errors:     %" PRIu64 " (connect %" PRIu64 ", timeout %" PRIu64
+        ", closed %" PRIu64 ", protocol %" PRIu64 ")\n", errors,
+        stats.errors[static_cast<int>(ClientError::CONNECT)],
+        stats.errors[static_cast<int>(ClientError::TIMEOUT)],
+        stats.errors[static_cast<int>(ClientError::CLOSED)],
+        stats.errors[static_cast<int>(ClientError::PROTOCOL)]);
+    printf("  Non-2xx:    %" PRIu64 "\n\n", stats.non2xx);
+
+    printf("  Latency (us)\n");
+    printf("    %-8s %12.1f\n", "min", toMicros(latency.min()));
+    printf("    %-8s %12.1f\n", "mean", latency.mean() / 1000.0);
+    static const double kPercentiles[] = {50, 75, 90, 99, 99.9, 99.99};
+    for (double p : kPercentiles) {
+        char label[16];
+        snprintf(label, sizeof(label), "p%g", p);
+        printf("    %-8s %12.1f\n", label, toMicros(latency.percentile(p)));
+    }
+    printf("    %-8s %12.1f\n", "max", toMicros(latency.max()));
+
+    if (config.histogram && latency.count() > 0) {
+        // Percentile spectrum, halving the distance to 100% at each step
+        printf("\n  %12s %12s %12s %12s\n", "Value (us)", "Percentile",
+            "TotalCount", "1/(1-P)");
+        for (double remaining = 1.0; ; remaining /= 2) {
+            double p = 100.0 * (1.0 - remaining);
+            uint64_t value = latency.percentile(p);
+            uint64_t total = static_cast<uint64_t>(
+                latency.count() * (1.0 - remaining));
+            if (remaining * latency.count() < 1.0) {
+                printf("  %12.1f %12.6f %12" PRIu64 " %12s\n",
+                    toMicros(latency.max()), 1.0, latency.count(), "inf");
+                break;
+            }
+            printf("  %12.1f %12.6f %12" PRIu64 " %12.2f\n", toMicros(value),
+                p / 100.0, total, 1.0 / remaining);
+        }
+    }
+}
+
+} // anonymous namespace
+} // topper namespace
+
+int main(int argc, char **argv) {
+    using namespace topper;
+
+    Config config;
+    if (!parseArgs(argc, argv, &config)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Mix mix;
+    try {
+        if (config.mixFile.empty()) {
+            mix.add(1, Target{"GET", "/", ""});
+        } else {
+            mix = loadMix(config.mixFile);
+        }
+    } catch (std::exception const& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    printf("Running %ds test @ %s:%hd (%s)\n", config.duration,
+        config.host.c_str(), config.port,
+        config.rate > 0 ? "open loop" : "closed loop");
+    printf("  %d threads, %d connections, pipeline depth %d, keep-alive %s\n",
+        config.threads, config.connections, config.pipeline,
+        config.keepAlive ? "on" : "off");
+    if (config.rate > 0) {
+        printf("  Target rate %.1f req/s\n", config.rate);
+    }
+    printf("\n");
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point measure = start + std::chrono::seconds(config.warmup);
+    Clock::time_point end = measure + std::chrono::seconds(config.duration);
+
+    std::vector<Worker*> workers;
+    std::vector<std::thread> threads;
+    std::random_device seeds;
+    for (int i = 0; i < config.threads; ++i) {
+        int connections = config.connections / config.threads +
+            (i < config.connections % config.threads ? 1 : 0);
+        workers.push_back(new Worker(config, mix, connections,
+            config.rate / config.threads, measure, end, seeds()));
+    }
+    for (Worker *worker : workers) {
+        threads.emplace_back([worker]() { worker->run(); });
+    }
+
+    Stats total;
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+        total.merge(workers[i]->stats());
+        delete workers[i];
+    }
+
+    report(config, total);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCLUDE_ASYNC_RESPONSE_H_
+#define INCLUDE_ASYNC_RESPONSE_H_
+
+#include <memory>
+
+#include "parameter.h"
+#include "response.h"
+
+namespace topper {
+
+class AsyncResponse;
+
+namespace detail {
+
+// The server side of an asynchronous request. Implementations resume the
+// request on the connection's event base; only the first completion
+// takes effect.
+class AsyncState {
+public:
+    virtual ~AsyncState() { }
+    virtual void complete(Response const& response) = 0;
+};
+
+// Creates the completion handle for the request being dispatched. Repeated
+// calls during one dispatch return handles to the same state.
+class Responder {
+public:
+    virtual ~Responder() { }
+    virtual AsyncResponse defer() = 0;
+
+    // The deadline of the request being dispatched
+    virtual Deadline deadline() { return Deadline(); }
+};
+
+} // detail namespace
+
+/**
+ * A handle for completing a request asynchronously.
+ *
+ * A resource method that takes an AsyncResponse parameter returns void
+ * instead of a Response, e.g.
+ *
+ *     void get(StringParam const& id, AsyncResponse const& response) const
+ *
+ * The request remains open after the method returns, until complete() is
+ * invoked on the handle or a copy of it. Completion may happen on any
+ * thread; the response is written from the connection's own event base.
+ * If every copy of the handle is destroyed without completing the request,
+ * the server responds with a 500.
+ *
+ * Other handler parameters are only valid until the method returns; copy
+ * anything that is needed to complete the request.
+ */
+class AsyncResponse {
+public:
+    explicit AsyncResponse(std::shared_ptr<detail::AsyncState> const& state)
+        : state_(state) { }
+
+    /**
+     * Completes the request. Only the first completion takes effect.
+     *
+     * @param[in] response the response to send
+     */
+    void complete(Response const& response) const {
+        state_->complete(response);
+    }
+private:
+    std::shared_ptr<detail::AsyncState> state_;
+};
+
+} // topper namespace
+
+#endif // INCLUDE_ASYNC_RESPONSE_H_
@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCLUDE_DETAIL_CONVERT_H_
+#define INCLUDE_DETAIL_CONVERT_H_
+
+#include <limits>
+#include <type_traits>
+
+namespace topper {
+namespace detail {
+
+//
+// Non-throwing string conversion, in the style of std::from_chars. The
+// returned pointer is the first character not consumed by the conversion;
+// callers requiring that the entire input be a number must check it.
+//
+
+enum class ConvertError {
+    NONE,           // Conversion succeeded
+    INVALID,        // Input does not begin with a number
+    OUT_OF_RANGE,   // Number is not representable in the target type
+};
+
+struct ConvertResult {
+    const char *ptr;
+    ConvertError ec;
+};
+
+// Converts an optionally negative (signed types only) decimal integer.
+template<typename T>
+ConvertResult fromChars(const char *first, const char *last, T *value) {
+    static_assert(std::is_integral<T>::value, "Integral type required");
+    typedef typename std::make_unsigned<T>::type U;
+
+    const char *p = first;
+    bool negative = false;
+    if (std::is_signed<T>::value && p != last && *p == '-') {
+        negative = true;
+        ++p;
+    }
+
+    // The magnitude of the most negative value is one more than the max
+    const U limit = static_cast<U>(std::numeric_limits<T>::max())
+        + (negative ? 1 : 0);
+
+    const char *digits = p;
+    bool overflow = false;
+    U acc = 0;
+    for (; p != last && *p >= '0' && *p <= '9'; ++p) {
+        U digit = static_cast<U>(*p - '0');
+        if (acc > (limit - digit) / 10) {
+            // Keep consuming digits, as from_chars does
+            overflow = true;
+            continue;
+        }
+        acc = acc * 10 + digit;
+    }
+
+    if (p == digits) {
+        return ConvertResult{first, ConvertError::INVALID};
+    }
+    if (overflow) {
+        return ConvertResult{p, ConvertError::OUT_OF_RANGE};
+    }
+
+    if (negative && acc != 0) {
+        // Negate without overflowing for the most negative value
+        *value = static_cast<T>(-static_cast<T>(acc - 1) - 1);
+    } else {
+        *value = static_cast<T>(acc);
+    }
+    return ConvertResult{p, ConvertError::NONE};
+}
+
+// Converts a finite decimal floating point number.
+ConvertResult fromChars(const char *first, const char *last, double *value);
+
+} // detail namespace
+} // topper namespace
+
+#endif // INCLUDE_DETAIL_CONVERT_H_
@@ -25,6 +25,7 @@
 
 #include <string>
 
+#include "async_response.h"
 #include "detail/invoker.h"
 #include "detail/tuple_util.h"
 #include "parameter.h"
@@ -36,19 +37,56 @@ namespace detail {
 
 class ResourceDispatcher {
 public:
+    // Malformed path parameters are answered with a 400 response without
+    // invoking the resource.
+
     template<typename... Args>
     static Response dispatch(Response (*res)(Args...),
             std::vector<std::string> const& params, UriInfo const& uriInfo) {
-        return invoke(res, Extractor<sizeof...(Args),
-               typename MRR<Args>::type...>::extract(params, uriInfo));
+        bool ok = true;
+        auto args = Extractor<sizeof...(Args),
+             typename MRR<Args>::type...>::extract(params, uriInfo, &ok);
+        if (!ok) {
+            return Response::badRequest();
+        }
+        return invoke(res, args);
     }
 
     template<typename ResType, typename... Args>
     static Response dispatch(const Resource *res,
             Response (ResType::*method)(Args...) const,
             std::vector<std::string> const& params, UriInfo const& uriInfo) {
-        return invoke_member(res, method, Extractor<sizeof...(Args),
-            typename MRR<Args>::type...>::extract(params, uriInfo));
+        bool ok = true;
+        auto args = Extractor<sizeof...(Args),
+             typename MRR<Args>::type...>::extract(params, uriInfo, &ok);
+        if (!ok) {
+            return Response::badRequest();
+        }
+        return invoke_member(res, method, args);
+    }
+
+    // Asynchronous handlers complete through their AsyncResponse parameter,
+    // including when path parameters are malformed; dispatch returns the
+    // deferred placeholder. Outside the server there is no responder, and
+    // the request is refused.
+    template<typename ResType, typename... Args>
+    static Response dispatch(const Resource *res,
+            void (ResType::*method)(Args...) const,
+            std::vector<std::string> const& params, UriInfo const& uriInfo) {
+        if (!uriInfo.responder) {
+            // Not invoked by the server; there is no way to complete
+            return Response::badRequest();
+        }
+        AsyncResponse response = uriInfo.responder->defer();
+        bool ok = true;
+        auto args = Extractor<sizeof...(Args),
+             typename MRR<Args>::type...>::extract(params, uriInfo, &ok);
+        if (!ok) {
+            response.complete(Response::badRequest());
+        } else {
+            invoke_member(res, method, args);
+        }
+        return Response::deferredResponse();
     }
 
     // No instantiation
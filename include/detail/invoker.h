@@ -23,6 +23,7 @@
 #ifndef INCLUDE_DETAIL_INVOKER_H_
 #define INCLUDE_DETAIL_INVOKER_H_
 
+#include "async_response.h"
 #include "detail/tuple_util.h"
 
 namespace topper {
@@ -50,6 +51,32 @@ template<typename T>
 struct MRR<IntParam<T> const&> {
     typedef IntParam<T> type;
 };
+template<>
+struct MRR<DoubleParam const&> {
+    typedef DoubleParam type;
+};
+template<>
+struct MRR<BoolParam const&> {
+    typedef BoolParam type;
+};
+template<>
+struct MRR<UuidParam const&> {
+    typedef UuidParam type;
+};
+template<typename E>
+struct MRR<EnumParam<E> const&> {
+    typedef EnumParam<E> type;
+};
+
+// Completion handles and deadlines are created for each request
+template<>
+struct MRR<AsyncResponse const&> {
+    typedef AsyncResponse type;
+};
+template<>
+struct MRR<Deadline const&> {
+    typedef Deadline type;
+};
 
 //
 // Invoker helpers
@@ -41,39 +41,88 @@ struct Methods {
     Method put;
     Method post;
     Method del;
+    // The resource's head() if implemented, otherwise get
+    Method head;
+    // The Allow header value, listing the verbs bound above and OPTIONS
+    std::string allow;
 };
 
-void doRegister(ServerImpl *server, Resource *resource, Methods const& methods);
+// Computes the Allow header value for a set of bound methods
+inline std::string allowHeader(Methods const& methods) {
+    std::string allow;
+    auto add = [&allow](Method const& method, const char *verb) {
+            if (method) {
+                allow.append(verb);
+                allow.append(", ");
+            }
+        };
+    add(methods.get, "GET");
+    add(methods.head, "HEAD");
+    add(methods.put, "PUT");
+    add(methods.post, "POST");
+    add(methods.del, "DELETE");
+    allow.append("OPTIONS");
+    return allow;
+}
+
+void doRegister(ServerImpl *server, Resource *resource, Methods const& methods,
+    RouteOptions const& options);
+
+// Methods that a resource inherits from the Resource defaults are left
+// unbound; the server answers requests for them with a static 405.
+template<typename R>
+Method bindMethod(R*, Response (Resource::*)() const) {
+    return Method();
+}
+
+template<typename R, typename ResType, typename... Args>
+Method bindMethod(R *r, Response (ResType::*method)(Args...) const) {
+    return [=](std::vector<std::string> const& params,
+            UriInfo const& uriInfo) {
+        return detail::ResourceDispatcher::dispatch(r, method, params,
+            uriInfo);
+    };
+}
+
+template<typename R, typename ResType, typename... Args>
+Method bindMethod(R *r, void (ResType::*method)(Args...) const) {
+    return [=](std::vector<std::string> const& params,
+            UriInfo const& uriInfo) {
+        return detail::ResourceDispatcher::dispatch(r, method, params,
+            uriInfo);
+    };
+}
 
 template<typename R>
 detail::Methods bindMethods(R *r) {
     // Bind calls for each method
-    return {
-        [=](std::vector<std::string> const& params, UriInfo const& uriInfo) {
-            return detail::ResourceDispatcher::dispatch(r, &R::get, params,
-                uriInfo);
-        },
-        [=](std::vector<std::string> const& params, UriInfo const& uriInfo) {
-            return detail::ResourceDispatcher::dispatch(r, &R::put, params,
-                uriInfo);
-        },
-        [=](std::vector<std::string> const& params, UriInfo const& uriInfo) {
-            return detail::ResourceDispatcher::dispatch(r, &R::post, params,
-                uriInfo);
-        },
-        [=](std::vector<std::string> const& params, UriInfo const& uriInfo) {
-            return detail::ResourceDispatcher::dispatch(r, &R::del, params,
-                uriInfo);
-        },
+    Methods methods {
+        bindMethod(r, &R::get),
+        bindMethod(r, &R::put),
+        bindMethod(r, &R::post),
+        bindMethod(r, &R::del),
+        bindMethod(r, &R::head),
+        "",
     };
+    if (!methods.head) {
+        // HEAD reuses GET; the body is dropped when writing the response
+        methods.head = methods.get;
+    }
+    methods.allow = allowHeader(methods);
+    return methods;
 }
 
 } // detail namespace
 
 template<typename R>
 void Server::registerResource(R *r) {
+    registerResource(r, RouteOptions());
+}
+
+template<typename R>
+void Server::registerResource(R *r, RouteOptions const& options) {
     // Bind functions for each
-    doRegister(internal_, r, detail::bindMethods(r));
+    doRegister(internal_, r, detail::bindMethods(r), options);
 }
 
 } // topper namespace
@@ -24,67 +24,165 @@
 #define INCLUDE_DETAIL_TUPLE_UTIL_H_
 
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
+#include "async_response.h"
 #include "parameter.h"
 
 namespace topper {
 namespace detail {
 
+//
+// Compute the indices of a tuple. This implementation is
+// from this great StackOverflow post: http://bit.ly/tuple-expansion
+//
+
+template<unsigned...> struct index_tuple{};
+
+template<unsigned I, typename IndexTuple, typename... Types>
+struct make_indices_impl;
+
+template<unsigned I, unsigned... Indices, typename T, typename... Types>
+struct make_indices_impl<I, index_tuple<Indices...>, T, Types...>
+{
+  typedef typename
+    make_indices_impl<I + 1,
+                      index_tuple<Indices..., I>,
+                      Types...>::type type;
+};
+
+template<unsigned I, unsigned... Indices>
+struct make_indices_impl<I, index_tuple<Indices...> >
+{
+  typedef index_tuple<Indices...> type;
+};
+
+template<typename... Types>
+struct make_indices
+  : make_indices_impl<0, index_tuple<>, Types...>
+{};
+
 //
 // Vector + UriInfo to parameter utilities. The UriInfo-contained parameters
-// are extracted by const-referenced, while the path parameters (which must
-// undergo conversion) are extracted by value.
+// are extracted by const-referenced, while the path parameters are extracted
+// by value. Path parameter values are views of the matched path parameters,
+// so extracting one costs a pointer store.
 //
 
 template<typename ParamType>
 class GetParam {
 public:
     static ParamType const& get(std::vector<std::string> const& params,
-            int index, UriInfo const& uriInfo);
+            int index, UriInfo const& uriInfo, bool *ok);
 };
 
 template<>
 inline QueryParams const& GetParam<QueryParams>::get(std::vector<std::string> const&,
-        int, UriInfo const& uriInfo) {
+        int, UriInfo const& uriInfo, bool*) {
     return uriInfo.queryParams;
 }
 
 template<>
 inline PostParams const& GetParam<PostParams>::get(std::vector<std::string> const&,
-        int, UriInfo const& uriInfo) {
+        int, UriInfo const& uriInfo, bool*) {
     return uriInfo.postParams;
 }
 
 template<>
 inline HeaderParams const& GetParam<HeaderParams>::get(std::vector<std::string> const&,
-        int, UriInfo const& uriInfo) {
+        int, UriInfo const& uriInfo, bool*) {
     return uriInfo.headerParams;
 }
 
 template<>
 inline Entity const& GetParam<Entity>::get(std::vector<std::string> const&,
-        int, UriInfo const& uriInfo) {
+        int, UriInfo const& uriInfo, bool*) {
     return uriInfo.entity;
 }
 
-// This needn't be a copy, if we're willing to keep the original path
-// parameter vector alive for the duration of the request. Consider it.
+// Asynchronous handlers receive a completion handle by value. Without a
+// responder there is nothing to complete through, so extraction fails.
+template<>
+class GetParam<AsyncResponse> {
+public:
+    static AsyncResponse get(std::vector<std::string> const&, int,
+            UriInfo const& uriInfo, bool *ok) {
+        if (!uriInfo.responder) {
+            *ok = false;
+            return AsyncResponse(std::shared_ptr<AsyncState>());
+        }
+        return uriInfo.responder->defer();
+    }
+};
+
+// Deadlines are shared with the server, which cancels them
+template<>
+class GetParam<Deadline> {
+public:
+    static Deadline get(std::vector<std::string> const&, int,
+            UriInfo const& uriInfo, bool*) {
+        return uriInfo.responder ? uriInfo.responder->deadline()
+            : Deadline();
+    }
+};
+
+// Refers to the matched path parameter; the parameter vector outlives the
+// handler invocation.
 template<>
 class GetParam<StringParam> {
 public:
     static StringParam get(std::vector<std::string> const& params,
-            int index, UriInfo const&) {
+            int index, UriInfo const&, bool*) {
         return StringParam::parse(params[index]);
     }
 };
 
+// Converted path parameters clear the ok flag instead of throwing when the
+// parameter is malformed.
 template<typename T>
 class GetParam<IntParam<T>> {
 public:
     static IntParam<T> get(std::vector<std::string> const& params,
-            int index, UriInfo const&) {
-        return IntParam<T>::parse(params[index]);
+            int index, UriInfo const&, bool *ok) {
+        return IntParam<T>::parse(params[index], ok);
+    }
+};
+
+template<>
+class GetParam<DoubleParam> {
+public:
+    static DoubleParam get(std::vector<std::string> const& params,
+            int index, UriInfo const&, bool *ok) {
+        return DoubleParam::parse(params[index], ok);
+    }
+};
+
+template<>
+class GetParam<BoolParam> {
+public:
+    static BoolParam get(std::vector<std::string> const& params,
+            int index, UriInfo const&, bool *ok) {
+        return BoolParam::parse(params[index], ok);
+    }
+};
+
+template<>
+class GetParam<UuidParam> {
+public:
+    static UuidParam get(std::vector<std::string> const& params,
+            int index, UriInfo const&, bool *ok) {
+        return UuidParam::parse(params[index], ok);
+    }
+};
+
+template<typename E>
+class GetParam<EnumParam<E>> {
+public:
+    static EnumParam<E> get(std::vector<std::string> const& params,
+            int index, UriInfo const&, bool *ok) {
+        return EnumParam<E>::parse(params[index], ok);
     }
 };
 
@@ -110,6 +208,34 @@ constexpr int NextIndex<StringParam>::next(int index) {
 // IntParams advance
 template<typename T>
 class NextIndex<IntParam<T>> {
+public:
+    constexpr static int next(int index) {
+        return index + 1;
+    }
+};
+
+// DoubleParams advance
+template<>
+constexpr int NextIndex<DoubleParam>::next(int index) {
+    return index + 1;
+}
+
+// BoolParams advance
+template<>
+constexpr int NextIndex<BoolParam>::next(int index) {
+    return index + 1;
+}
+
+// UuidParams advance
+template<>
+constexpr int NextIndex<UuidParam>::next(int index) {
+    return index + 1;
+}
+
+// EnumParams advance
+template<typename E>
+class NextIndex<EnumParam<E>> {
+public:
     constexpr static int next(int index) {
         return index + 1;
     }
@@ -125,93 +251,56 @@ struct BaseType {
         typename std::remove_reference<T>::type>::type type;
 };
 
-// Recursive extraction
-template<int Length, int Index, typename R1, typename... R>
-class ExtractorHelper {
-public:
-    static std::tuple<R1, R...> extract(std::vector<std::string> const& params,
-            UriInfo const& uriInfo) {
-        // There are two compile-time methods applied here:
-        //
-        //  (1) an R1-specific method to select the appropriate input parameter
-        //  (either uri info field or a path param). This is "GetParam".
-        //
-        //  (2) an R1-specific method to determine whether to increment the
-        //  index into the path parameters vector. This is "NextIndex".
-
-        // The input types are already suitably converted to either reference
-        // or value types by the invoker for use in the return tuple, but
-        // will need remove-reference before template type deduction for
-        // the extraction & index methods. They also need to be de-constified.
-
-        return std::tuple_cat(std::tuple<R1>(
-            GetParam<typename BaseType<R1>::type>::get(params,
-                Index, uriInfo)),
-            ExtractorHelper<Length - 1, NextIndex<typename BaseType<R1>::type>
-                ::next(Index), R...>::extract(params, uriInfo));
-    }
+// The index into the path parameters vector of the argument at Position,
+// computed by applying NextIndex to each of the preceding arguments. The
+// input types are already suitably converted to either reference or value
+// types by the invoker for use in the return tuple, but need
+// remove-reference and de-constification before selecting the index method.
+template<int Index, unsigned Position, typename... R>
+struct PathIndex;
+
+template<int Index, typename R1, typename... R>
+struct PathIndex<Index, 0, R1, R...> {
+    static constexpr int value = Index;
 };
 
-// Base case for extraction
-template<int Index, typename R>
-class ExtractorHelper<1, Index, R> {
-public:
-    static std::tuple<R> extract(std::vector<std::string> const& params,
-            UriInfo const& uriInfo) {
-        return std::tuple<R>(GetParam<typename BaseType<R>::type>::get(params,
-            Index, uriInfo));
-    }
+template<int Index, unsigned Position, typename R1, typename... R>
+struct PathIndex<Index, Position, R1, R...> {
+    static constexpr int value = PathIndex<
+        NextIndex<typename BaseType<R1>::type>::next(Index),
+        Position - 1, R...>::value;
 };
 
 template<int Length, typename... R>
 class Extractor {
 public:
+    static_assert(Length == sizeof...(R), "Length must match argument count");
+
+    // Clears the ok flag if any path parameter fails conversion, in which
+    // case the corresponding arguments hold unspecified values.
     static std::tuple<R...> extract(std::vector<std::string> const& params,
-            UriInfo const& uriInfo) {
-        return ExtractorHelper<Length, 0, R...>::extract(params, uriInfo);
+            UriInfo const& uriInfo, bool *ok) {
+        return extract(params, uriInfo, ok,
+            typename make_indices<R...>::type());
     }
-};
-
-// Specialization for zero parameters
-template<>
-class Extractor<0> {
-public:
-    static std::tuple<> extract(std::vector<std::string> const&,
-            UriInfo const&) {
-        return std::tuple<>();
+private:
+    // Each argument is constructed once, directly in the returned tuple.
+    // There are two compile-time methods applied here:
+    //
+    //  (1) an R-specific method to select the appropriate input parameter
+    //  (either uri info field or a path param). This is "GetParam".
+    //
+    //  (2) the position-specific index into the path parameters vector,
+    //  derived from "NextIndex". This is "PathIndex".
+    template<unsigned... Positions>
+    static std::tuple<R...> extract(std::vector<std::string> const& params,
+            UriInfo const& uriInfo, bool *ok,
+            index_tuple<Positions...> /*unused*/) {
+        return std::tuple<R...>(GetParam<typename BaseType<R>::type>::get(
+            params, PathIndex<0, Positions, R...>::value, uriInfo, ok)...);
     }
 };
 
-//
-// Compute the indices of a tuple. This implementation is
-// from this great StackOverflow post: http://bit.ly/tuple-expansion
-//
-
-template<unsigned...> struct index_tuple{};
-
-template<unsigned I, typename IndexTuple, typename... Types>
-struct make_indices_impl;
-
-template<unsigned I, unsigned... Indices, typename T, typename... Types>
-struct make_indices_impl<I, index_tuple<Indices...>, T, Types...>
-{
-  typedef typename
-    make_indices_impl<I + 1,
-                      index_tuple<Indices..., I>,
-                      Types...>::type type;
-};
-
-template<unsigned I, unsigned... Indices>
-struct make_indices_impl<I, index_tuple<Indices...> >
-{
-  typedef index_tuple<Indices...> type;
-};
-
-template<typename... Types>
-struct make_indices
-  : make_indices_impl<0, index_tuple<>, Types...>
-{};
-
 } // detail namespace
 } // topper namespace
 
@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INCLUDE_HTTP_CLIENT_H_
+#define INCLUDE_HTTP_CLIENT_H_
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace wte {
+class EventBase;
+} // wte namespace
+
+namespace topper {
+
+class Server;
+class HttpClientImpl;
+
+struct HttpClientOptions {
+    // Connections opened to each host from each event base
+    int maxConnectionsPerHost = 4;
+
+    // Requests written to a connection before earlier ones are answered
+    int pipelineDepth = 1;
+
+    // Whether connections are reused between requests
+    bool keepAlive = true;
+
+    std::chrono::milliseconds connectTimeout{1000};
+
+    // Measured from when the request is issued until its response has
+    // been received
+    std::chrono::milliseconds requestTimeout{5000};
+};
+
+enum class ClientError {
+    NONE,           // A response was received
+    CONNECT,        // The connection could not be established
+    TIMEOUT,        // No response within the request timeout
+    CLOSED,         // The connection closed before the response was received
+    PROTOCOL,       // The response was malformed
+};
+
+struct ClientResponse {
+    int status = 0;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    /** @return the value of the named header, or the empty string. */
+    std::string const& header(std::string const& name) const;
+};
+
+/**
+ * An HTTP/1.1 client that runs on wte event bases.
+ *
+ * Connections are pooled per host on each base and, when keep-alive is
+ * enabled, reused and pipelined up to the configured depth. Callbacks
+ * are invoked on the event base that performed the request and must not
+ * block.
+ *
+ * Requests may be issued from any thread. A request issued from one of
+ * the client's bases, e.g. by a resource handler, is performed on that
+ * base; others are distributed among the bases.
+ */
+class HttpClient {
+public:
+    typedef std::vector<std::pair<std::string, std::string>> Headers;
+    typedef std::function<void(ClientError, ClientResponse const&)> Callback;
+
+    /**
+     * Create a client that shares the request handling bases of a running
+     * server. The client must be destroyed before the server is stopped.
+     *
+     * @param[in] server a started server
+     * @param[in] options client configuration
+     * @throws std::logic_error if the server is not running
+     */
+    explicit HttpClient(Server *server,
+        HttpClientOptions const& options = HttpClientOptions());
+
+    /**
+     * Create a client that runs on the given event base, whose loop is
+     * driven by the caller. The base must outlive the client.
+     */
+    explicit HttpClient(wte::EventBase *base,
+        HttpClientOptions const& options = HttpClientOptions());
+
+    /**
+     * Close all connections. Requests that are still outstanding complete
+     * with ClientError::CLOSED. Must not be invoked from a callback.
+     */
+    ~HttpClient();
+
+    HttpClient(HttpClient const&) = delete;
+    HttpClient& operator=(HttpClient const&) = delete;
+
+    /**
+     * Issue a request.
+     *
+     * @param[in] method the request method, e.g. "GET"
+     * @param[in] host a numeric IPv4 or IPv6 address
+     * @param[in] port the destination port
+     * @param[in] path the request target, including any query string
+     * @param[in] headers additional request headers
+     * @param[in] body the request body
+     * @param[in] callback invoked once with the outcome
+     * @throws std::invalid_argument if the host is not a numeric address
+     */
+    void request(std::string const& method, std::string const& host,
+        short port, std::string const& path, Headers const& headers,
+        std::string const& body, Callback const& callback);
+
+    /** Issue a GET request. */
+    void get(std::string const& host, short port, std::string const& path,
+            Callback const& callback) {
+        request("GET", host, port, path, Headers(), std::string(),
+            callback);
+    }
+private:
+    HttpClientImpl *impl_;
+};
+
+} // topper namespace
+
+#endif // INCLUDE_HTTP_CLIENT_H_
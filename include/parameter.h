@@ -23,30 +23,43 @@
 #ifndef INCLUDE_PARAMETER_H_
 #define INCLUDE_PARAMETER_H_
 
-#include <stdexcept>
+#include <inttypes.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <type_traits>
 #include <vector>
 
+#include "detail/convert.h"
 #include "entity.h"
 
 namespace topper {
 
+/**
+ * A string path parameter.
+ *
+ * The parameter is a view of the matched path parameter, which remains
+ * valid for the duration of the handler invocation. Handlers that need the
+ * value afterwards must copy it.
+ */
 class StringParam {
 public:
     /**
      * Parses a path parameter string into a string type.
      *
-     * @param[in] input the path parameter
-     * @return the input parameter
+     * @param[in] input the path parameter, which must outlive the result
+     * @return a view of the input parameter
      */
     static StringParam parse(std::string const& input);
 
     /** @return the string value. */
-    std::string const& value() const { return value_; }
+    std::string const& value() const { return *value_; }
 private:
-    explicit StringParam(std::string const& v) : value_(v) { }
-    std::string value_;
+    explicit StringParam(std::string const *v) : value_(v) { }
+    std::string const *value_;
 };
 
 template<typename T>
@@ -58,14 +71,17 @@ public:
      * Parses a path parameter string to an integral type.
      *
      * @param[in] input the path parameter
-     * @return the integral type
-     * @throws on invalid (non-integral) strings
+     * @param[out] ok set to false if the input is not an integer
+     *             representable as T
+     * @return the integral type, or zero if the input is invalid
      */
-    static IntParam parse(std::string const& input) {
-        size_t pos = 0;
-        T val = static_cast<T>(std::stoll(input, &pos));
-        if (pos != input.size()) {
-            throw std::invalid_argument("Invalid integral string");
+    static IntParam parse(std::string const& input, bool *ok) {
+        T val = 0;
+        const char *end = input.data() + input.size();
+        detail::ConvertResult res = detail::fromChars(input.data(), end, &val);
+        if (res.ec != detail::ConvertError::NONE || res.ptr != end) {
+            *ok = false;
+            return IntParam(0);
         }
         return IntParam(val);
     }
@@ -78,6 +94,133 @@ private:
     T value_;
 };
 
+class DoubleParam {
+public:
+    /**
+     * Parses a path parameter string to a finite double.
+     *
+     * @param[in] input the path parameter
+     * @param[out] ok set to false if the input is not a finite number
+     * @return the double type, or zero if the input is invalid
+     */
+    static DoubleParam parse(std::string const& input, bool *ok);
+
+    /** @return the double value. */
+    double value() const { return value_; }
+private:
+    explicit DoubleParam(double v) : value_(v) { }
+    double value_;
+};
+
+class BoolParam {
+public:
+    /**
+     * Parses a path parameter string to a boolean. Accepts "true", "false",
+     * "1" and "0".
+     *
+     * @param[in] input the path parameter
+     * @param[out] ok set to false if the input is not a boolean
+     * @return the boolean type, or false if the input is invalid
+     */
+    static BoolParam parse(std::string const& input, bool *ok);
+
+    /** @return the boolean value. */
+    bool value() const { return value_; }
+private:
+    explicit BoolParam(bool v) : value_(v) { }
+    bool value_;
+};
+
+class UuidParam {
+public:
+    typedef std::array<uint8_t, 16> Bytes;
+
+    /**
+     * Parses a path parameter string in the canonical 8-4-4-4-12 hex digit
+     * form to a UUID. Hex digits may be either case.
+     *
+     * @param[in] input the path parameter
+     * @param[out] ok set to false if the input is not a UUID
+     * @return the UUID type, or the nil UUID if the input is invalid
+     */
+    static UuidParam parse(std::string const& input, bool *ok);
+
+    /** @return the UUID bytes, in string order. */
+    Bytes const& value() const { return value_; }
+private:
+    explicit UuidParam(Bytes const& v) : value_(v) { }
+    Bytes value_;
+};
+
+/** A name to value mapping for EnumParam. */
+template<typename E>
+struct EnumEntry {
+    const char *name;
+    E value;
+};
+
+/** A view of a constant array of enum entries. */
+template<typename E>
+class EnumEntries {
+public:
+    template<size_t N>
+    constexpr EnumEntries(const EnumEntry<E> (&entries)[N])
+        : begin_(entries), end_(entries + N) { }
+
+    EnumEntry<E> const* begin() const { return begin_; }
+    EnumEntry<E> const* end() const { return end_; }
+private:
+    EnumEntry<E> const *begin_;
+    EnumEntry<E> const *end_;
+};
+
+/**
+ * The table of names for enum type E. Specialize this for each enum used
+ * as an EnumParam, e.g.
+ *
+ *     template<> struct EnumTable<Color> {
+ *         static EnumEntries<Color> entries() {
+ *             static constexpr EnumEntry<Color> kEntries[] = {
+ *                 { "red", Color::RED },
+ *                 { "blue", Color::BLUE },
+ *             };
+ *             return kEntries;
+ *         }
+ *     };
+ */
+template<typename E>
+struct EnumTable;
+
+template<typename E>
+class EnumParam {
+public:
+    static_assert(std::is_enum<E>::value, "Enum type required");
+
+    /**
+     * Parses a path parameter string to an enum value by exact match
+     * against the names in EnumTable<E>.
+     *
+     * @param[in] input the path parameter
+     * @param[out] ok set to false if the input is not a name in the table
+     * @return the enum type, or a value-initialized E if invalid
+     */
+    static EnumParam parse(std::string const& input, bool *ok) {
+        for (auto const& entry : EnumTable<E>::entries()) {
+            if (input.compare(entry.name) == 0) {
+                return EnumParam(entry.value);
+            }
+        }
+        *ok = false;
+        return EnumParam(E());
+    }
+
+    /** @return the enum value. */
+    E value() const { return value_; }
+private:
+    explicit EnumParam(E v) : value_(v) { }
+    E value_;
+};
+
 class PostParams {
 public:
     virtual ~PostParams() { }
@@ -129,11 +272,68 @@ protected:
     HeaderParams() { }
 };
 
+/**
+ * The time by which a request should be answered, for handlers that can
+ * give up early. Handlers receive it like the other injected parameters:
+ *
+ *     void get(StringParam const& id, Deadline const& deadline,
+ *         AsyncResponse const& response) const
+ *
+ * Deadlines are set per resource when it is registered, and may be
+ * shortened by a request header. Once an asynchronous request's deadline
+ * passes, the server answers it with a 504 and the request is cancelled;
+ * it is also cancelled if the client disconnects. The deadline may be
+ * copied and checked from any thread, so that work done on the request's
+ * behalf can stop once nobody is waiting for it.
+ */
+class Deadline {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /** An unbounded deadline, which is never cancelled. */
+    Deadline() { }
+
+    Deadline(Clock::time_point when,
+            std::shared_ptr<std::atomic<bool>> const& cancelled)
+        : when_(when), cancelled_(cancelled) { }
+
+    /** @return whether the request has a deadline. */
+    bool bounded() const { return when_ != Clock::time_point::max(); }
+
+    /** @return the deadline, or time_point::max() if unbounded. */
+    Clock::time_point when() const { return when_; }
+
+    /** @return the time left, zero once passed, or max() if unbounded. */
+    Clock::duration remaining() const {
+        if (!bounded()) {
+            return Clock::duration::max();
+        }
+        Clock::time_point now = Clock::now();
+        return now < when_ ? when_ - now : Clock::duration::zero();
+    }
+
+    /** @return whether the response is no longer wanted. */
+    bool cancelled() const {
+        return (cancelled_ && cancelled_->load(std::memory_order_relaxed)) ||
+            (bounded() && Clock::now() >= when_);
+    }
+private:
+    Clock::time_point when_ = Clock::time_point::max();
+    std::shared_ptr<std::atomic<bool>> cancelled_;
+};
+
+namespace detail {
+class Responder;
+} // detail namespace
+
 struct UriInfo {
     QueryParams const& queryParams;
     PostParams const& postParams;
     HeaderParams const& headerParams;
     Entity const& entity;
+    // Creates AsyncResponse handles; null where asynchronous handlers are
+    // not supported
+    detail::Responder *responder;
 };
 
 } // topper namespace
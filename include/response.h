@@ -24,6 +24,8 @@
 #define INCLUDE_RESPONSE_H_
 
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace topper {
 
@@ -31,10 +33,17 @@ namespace topper {
 enum class HttpCode {
     OK              = 200,
     CREATED         = 201,
+    BAD_REQUEST     = 400,
     FORBIDDEN       = 403,
     NOT_FOUND       = 404,
     NOT_ALLOWED     = 405,
+    REQUEST_TIMEOUT = 408,
+    TOO_MANY_REQUESTS = 429,
     INTERNAL_ERROR  = 500,
+    NOT_IMPLEMENTED = 501,
+    SERVICE_UNAVAILABLE = 503,
+    GATEWAY_TIMEOUT = 504,
+    VERSION_NOT_SUPPORTED = 505,
 };
 
 enum class MediaType {
@@ -47,17 +56,58 @@ class Response {
 public:
     explicit Response(HttpCode code);
     Response(HttpCode code, MediaType type, std::string const& content);
+    Response(HttpCode code, MediaType type, std::string&& content);
+
+    /**
+     * Adds a header to the response. The Content-Length, Content-Type and
+     * Connection headers are generated by the server and must not be added.
+     *
+     * @param[in] name the header name
+     * @param[in] value the header value
+     * @return this response
+     */
+    Response& header(std::string const& name, std::string const& value);
 
     /**
      * Constructs a full HTTP/1.1 response suitable for transmission.
      *
+     * @param[in] includeBody whether to append the body; responses to HEAD
+     *            requests omit it but retain its Content-Length
+     * @param[in] keepAlive whether the connection remains open after the
+     *            response
      * @return the response as a string
      */
-    std::string to_string() const;
+    std::string to_string(bool includeBody = true,
+        bool keepAlive = false) const;
 
     /** @return the response code. */
     HttpCode code() const { return code_; }
 
+    /**
+     * @return whether this is the placeholder returned when dispatching to
+     *         an asynchronous handler, rather than a real response.
+     */
+    bool deferred() const { return deferred_; }
+
+    /** @return a placeholder for a response that will complete later. */
+    static Response deferredResponse();
+
+    /**
+     * Returns the serialized form of a body-less response with the given
+     * code. The string is formatted once and shared; it is used to answer
+     * malformed or unroutable requests without constructing a Response.
+     *
+     * @param[in] code an error code
+     * @param[in] keepAlive whether the connection remains open after the
+     *            response
+     * @return the response as a string
+     */
+    static std::string const& preformatted(HttpCode code,
+        bool keepAlive = false);
+
+    /** @return a 400 response. */
+    static Response badRequest();
+
     /** @return a 405 response. */
     static Response notAllowed();
 
@@ -67,6 +117,8 @@ private:
     HttpCode code_;
     MediaType type_;
     std::string content_;
+    std::vector<std::pair<std::string, std::string>> headers_;
+    bool deferred_ = false;
 };
 
 } // topper namespace
@@ -23,13 +23,145 @@
 #ifndef INCLUDE_SERVER_H_
 #define INCLUDE_SERVER_H_
 
+#include <signal.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <chrono>
 #include <string>
 
 namespace topper {
 
+class HttpClient;
 class Resource;
 class ServerImpl;
 
+// A token bucket: requests are admitted at `rate` per second on average, in
+// bursts of up to `burst`. A zero rate is unlimited.
+struct RateLimit {
+    double rate = 0;
+    size_t burst = 1;
+};
+
+// TCP keepalive probing of idle connections. Probing starts once a
+// connection has been idle for `idle`; zero disables it. A zero interval or
+// probe count leaves the system default.
+struct TcpKeepAlive {
+    std::chrono::seconds idle{0};
+    std::chrono::seconds interval{0};
+    int probes = 0;
+};
+
+// Server-wide settings
+struct ServerOptions {
+    // Open connections beyond which new connections are refused with a
+    // 503 and closed; 0 for no limit
+    size_t maxConnections = 0;
+
+    // Requests being handled beyond which new requests are refused with a
+    // 503; 0 for no limit
+    size_t maxInFlight = 0;
+
+    // The Retry-After value sent when refusing work
+    std::chrono::seconds retryAfter{1};
+
+    // Limits each client across all resources; requests over the limit are
+    // refused with a 429
+    RateLimit clientRateLimit;
+
+    // Identifies clients by the value of this header, e.g. an API key,
+    // instead of by their address. Requests without it fall back to the
+    // address.
+    std::string clientHeader;
+
+    // Connection timeouts; zero disables each. Connections that sit idle
+    // between requests, or whose response can't be written in time, are
+    // closed. Requests whose headers or body take too long to arrive are
+    // answered with a 408 and the connection closed.
+    std::chrono::milliseconds idleTimeout{0};
+    std::chrono::milliseconds headerTimeout{0};
+    std::chrono::milliseconds bodyTimeout{0};
+    std::chrono::milliseconds writeTimeout{0};
+
+    // How long stopping waits for in-flight requests to be answered before
+    // closing their connections
+    std::chrono::milliseconds drainTimeout{10000};
+
+    // A Unix socket for hot upgrades. A starting server takes the listening
+    // sockets of the server serving this path, which drains and stops once
+    // the new server has started; the starting server then serves the path
+    // itself. Empty to disable.
+    std::string upgradeSocket;
+
+    // Permissions for Unix socket files, e.g. 0660, applied to the admin
+    // server's too; 0 leaves them to the umask
+    mode_t unixSocketMode = 0;
+
+    // Length of the queue of connections waiting to be accepted; the
+    // kernel caps it at net.core.somaxconn
+    int backlog = 1024;
+
+    // Send responses without waiting to coalesce small writes
+    bool noDelay = true;
+
+    // Only accept a connection once the client has sent data, waiting up
+    // to this long; 0 accepts on connect
+    std::chrono::seconds deferAccept{0};
+
+    // Pending TCP Fast Open requests, allowing clients to send their first
+    // request with the SYN; 0 disables Fast Open
+    int fastOpenQueue = 0;
+
+    // Socket buffer sizes in bytes; 0 leaves the system default
+    int sendBuffer = 0;
+    int receiveBuffer = 0;
+
+    TcpKeepAlive tcpKeepAlive;
+
+    // Bytes reserved up front for a request body of declared length, at
+    // most; larger bodies grow as they arrive
+    size_t readBufferSize = 65536;
+};
+
+// Per-resource settings, given when the resource is registered
+struct RouteOptions {
+    // Requests to this resource being handled beyond which new ones are
+    // refused with a 503, so that one slow resource can't occupy the whole
+    // server; 0 for no limit
+    size_t maxInFlight = 0;
+
+    // Limits requests to this resource from all clients together; requests
+    // over the limit are refused with a 429
+    RateLimit rateLimit;
+
+    // How long the resource has to answer a request once it has been
+    // received; zero for no limit. Asynchronous requests that run over are
+    // answered with a 504. Handlers see the deadline through a Deadline
+    // parameter.
+    std::chrono::milliseconds deadline{0};
+
+    // Takes a shorter deadline from this request header, e.g.
+    // "X-Request-Timeout", given in milliseconds
+    std::string deadlineHeader;
+
+    // Requests that take longer than this, from their first byte until the
+    // response has been written, go to the slow request log. Zero uses the
+    // log's default threshold.
+    std::chrono::milliseconds slowThreshold{0};
+};
+
+struct SlowLogOptions {
+    // The file to append to
+    std::string path;
+
+    // The threshold for resources that don't set their own
+    std::chrono::milliseconds threshold{1000};
+
+    // Entries written per second, on average; slow requests beyond this
+    // rate are counted but not logged
+    double maxPerSecond = 10;
+};
+
 class Server {
 public:
     ~Server();
@@ -41,11 +173,28 @@ public:
      * This method throws on egregious configuration errors like a malformed
      * ip address string.
      *
-     * @param[in]      ipaddr      the listen address, in dotted-quad notation
-     * @param[in]      port        the listen port
+     * The address is IPv4 in dotted-quad notation, IPv6 (`::` listens on
+     * IPv4 as well), or `unix:` followed by a socket path; a path starting
+     * with `@` is in the abstract namespace.
+     *
+     * @param[in]      ipaddr      the listen address
+     * @param[in]      port        the listen port; unused for Unix sockets
+     * @param[in]      options     server-wide settings
+     *
+     */
+    Server(std::string const& ipaddr, short port,
+        ServerOptions const& options = ServerOptions()); // throws
+
+    /**
+     * Listen on another address as well. Connections on every address are
+     * served by the same event bases and resources.
      *
+     * @param[in]      address     the listen address, as for the constructor
+     * @param[in]      port        the listen port; unused for Unix sockets
+     * @throws std::invalid_argument if the address is malformed
+     * @throws std::logic_error if the server has been started
      */
-    Server(std::string const& ipaddr, short port); // throws
+    void addListener(std::string const& address, short port);
 
     /** Register the resource endpoint.
      *
@@ -57,6 +206,39 @@ public:
     template<typename R>
     void registerResource(R *resource);
 
+    /** Register the resource endpoint with non-default settings.
+     *
+     * @param[in]      resource        a resource
+     * @param[in]      options         settings for the resource
+     */
+    template<typename R>
+    void registerResource(R *resource, RouteOptions const& options);
+
+    /**
+     * Stop serving a resource.
+     *
+     * Resources may be registered and unregistered while the server is
+     * running. Requests already dispatched to the resource are answered as
+     * usual, so the resource must outlive them.
+     *
+     * @param[in]      resource        a registered resource
+     * @return false if the resource was not registered
+     */
+    bool unregisterResource(Resource *resource);
+
+    /**
+     * Log requests that exceed a latency threshold to a file.
+     *
+     * Each entry records the request line, header and body sizes, the
+     * event base and thread that served it, and the time spent in each
+     * phase. Entries are written by a background thread.
+     *
+     * @param[in]      options         the log file, threshold and rate
+     * @throws std::logic_error if the server has been started
+     * @throws std::runtime_error if the file can't be opened
+     */
+    void enableSlowLog(SlowLogOptions const& options);
+
     /**
      * Start serving registered resources.
      *
@@ -71,11 +253,27 @@ public:
     /**
      * Stop the server and wait for ongoing requests to complete.
      *
+     * The server stops accepting connections and closes those that are
+     * idle. Requests in progress are answered with `Connection: close`,
+     * for up to ServerOptions::drainTimeout; connections still open after
+     * that are dropped. The admin server keeps running while the server
+     * drains.
+     *
      * When this method returns, the server is no longer listening for
      * incomming connections and all ongoing processing has completed.
      */
     void stopAndWait();
 
+    /**
+     * Stop the server, as by stopAndWait(), when the process receives a
+     * signal; wait() then returns. Only one server in a process may handle
+     * signals.
+     *
+     * @param[in]      signal          the signal to handle
+     * @throws std::logic_error if a server already handles signals
+     */
+    void stopOnSignal(int signal = SIGTERM);
+
     /**
      * Wait for the server to exit.
      *
@@ -90,13 +288,19 @@ public:
     *
     *      /ping           Responds 'pong' to indicate that the server is up
     *      /metrics        Returns server metrics in JSON format
+    *      /metrics/prometheus
+    *                      Returns server metrics in Prometheus text format
+    *      /tracez         Returns the slowest sampled requests per resource
     *
-    * @param ipaddr the interface to run on (typically the loopback ip)
+    * @param ipaddr the interface to run on (typically the loopback ip), in
+    *        any of the forms the constructor accepts
     * @param port the port to bind (or 0 to use any ephemeral port)
     * @throws an exception if invoked more than once
     */
    void startAdminServer(std::string const& ipaddr, short port);
 private:
+    friend class HttpClient;
+
     ServerImpl *internal_;
 };
 
@@ -0,0 +1,159 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "epoch.h"
+
+#include <vector>
+
+namespace topper {
+
+namespace {
+
+// The global epoch; starts at 1 so that 0 marks a quiescent slot
+std::atomic<uint64_t> current(1);
+
+} // anonymous namespace
+
+// A reader thread's state. Slots are never freed; a thread that exits
+// gives its slot up for the next thread to claim.
+struct Epoch::Slot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> used{true};
+    Slot *next = nullptr;
+    unsigned depth = 0;
+
+    // Keeps other threads' slots off this one's cache line
+    char padding[64];
+};
+
+namespace {
+
+std::atomic<Epoch::Slot*> slots(nullptr);
+
+Epoch::Slot* claim() {
+    for (Epoch::Slot *slot = slots.load(); slot; slot = slot->next) {
+        bool unused = false;
+        if (!slot->used.load(std::memory_order_relaxed) &&
+                slot->used.compare_exchange_strong(unused, true)) {
+            return slot;
+        }
+    }
+    Epoch::Slot *slot = new Epoch::Slot();
+    Epoch::Slot *head = slots.load();
+    do {
+        slot->next = head;
+    } while (!slots.compare_exchange_weak(head, slot));
+    return slot;
+}
+
+// Releases the calling thread's slot when the thread exits
+struct Owner {
+    Epoch::Slot *slot = nullptr;
+    ~Owner() {
+        if (slot) {
+            slot->used.store(false);
+        }
+    }
+};
+
+// Slots given up by pins on this thread, for its next pins to reuse; they
+// are released for anyone to claim when the thread exits
+struct Spare {
+    std::vector<Epoch::Slot*> slots;
+    ~Spare() {
+        for (Epoch::Slot *slot : slots) {
+            slot->used.store(false);
+        }
+    }
+};
+
+Spare& spare() {
+    static thread_local Spare spare;
+    return spare;
+}
+
+} // anonymous namespace
+
+Epoch::Slot* Epoch::local() {
+    static thread_local Owner owner;
+    if (!owner.slot) {
+        owner.slot = claim();
+    }
+    return owner.slot;
+}
+
+Epoch::Guard::Guard() : slot_(local()) {
+    if (slot_->depth++ == 0) {
+        // Publish the epoch before reading anything it protects
+        slot_->epoch.store(current.load());
+    }
+}
+
+Epoch::Guard::~Guard() {
+    if (--slot_->depth == 0) {
+        slot_->epoch.store(0, std::memory_order_release);
+    }
+}
+
+Epoch::Pin::~Pin() {
+    if (slot_) {
+        leave();
+        spare().slots.push_back(slot_);
+    }
+}
+
+void Epoch::Pin::enter() {
+    if (!slot_) {
+        std::vector<Slot*>& slots = spare().slots;
+        if (slots.empty()) {
+            slot_ = claim();
+        } else {
+            slot_ = slots.back();
+            slots.pop_back();
+        }
+    }
+    if (slot_->epoch.load(std::memory_order_relaxed) == 0) {
+        slot_->epoch.store(current.load());
+    }
+}
+
+void Epoch::Pin::leave() {
+    if (slot_) {
+        slot_->epoch.store(0, std::memory_order_release);
+    }
+}
+
+uint64_t Epoch::retire() {
+    return current.fetch_add(1) + 1;
+}
+
+bool Epoch::reclaimable(uint64_t retired) {
+    for (Slot *slot = slots.load(); slot; slot = slot->next) {
+        uint64_t epoch = slot->epoch.load();
+        if (epoch != 0 && epoch < retired) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // topper namespace
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_EPOCH_H_
+#define SRC_EPOCH_H_
+
+#include <inttypes.h>
+
+#include <atomic>
+
+namespace topper {
+
+/**
+ * Epoch-based reclamation for data read without locks.
+ *
+ * Readers enter a critical section with a Guard, which records the current
+ * epoch in a slot owned by the calling thread. A writer that unlinks an
+ * object retires it by advancing the epoch, and may free it once every
+ * reader has left the critical sections it entered before then. Entering
+ * and leaving cost a store and a fence on the reader's own cache line.
+ */
+class Epoch {
+public:
+    // A reader thread's state; defined in epoch.cc
+    struct Slot;
+
+    // A read-side critical section on the calling thread; may nest
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+        Guard(Guard const&) = delete;
+        Guard& operator=(Guard const&) = delete;
+    private:
+        Slot *slot_;
+    };
+
+    // A read-side critical section that outlives a scope, e.g. one held
+    // by a request across several turns of an event loop. A pin may be
+    // entered and left on any thread, but not concurrently, and takes a
+    // slot of its own while entered.
+    class Pin {
+    public:
+        Pin() { }
+        ~Pin();
+        Pin(Pin const&) = delete;
+        Pin& operator=(Pin const&) = delete;
+
+        // Entering a pin that is already entered does nothing
+        void enter();
+        void leave();
+    private:
+        Slot *slot_ = nullptr;
+    };
+
+    // Advance the epoch after unlinking an object; returns the epoch that
+    // the object was retired in
+    static uint64_t retire();
+
+    // Whether no reader can still hold an object retired in the given epoch
+    static bool reclaimable(uint64_t retired);
+private:
+    // The calling thread's slot
+    static Slot* local();
+};
+
+} // topper namespace
+
+#endif // SRC_EPOCH_H_
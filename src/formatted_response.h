@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_FORMATTED_RESPONSE_H_
+#define SRC_FORMATTED_RESPONSE_H_
+
+#include <string>
+
+#include "response.h"
+
+namespace topper {
+
+// A response serialized once for each connection disposition, for
+// responses that are sent often and never change.
+class FormattedResponse {
+public:
+    FormattedResponse() { }
+    explicit FormattedResponse(Response const& response)
+        : close_(response.to_string(/*includeBody=*/ true,
+              /*keepAlive=*/ false)),
+          keepAlive_(response.to_string(/*includeBody=*/ true,
+              /*keepAlive=*/ true)) { }
+
+    std::string const& get(bool keepAlive) const {
+        return keepAlive ? keepAlive_ : close_;
+    }
+private:
+    std::string close_;
+    std::string keepAlive_;
+};
+
+} // topper namespace
+
+#endif // SRC_FORMATTED_RESPONSE_H_
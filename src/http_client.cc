@@ -0,0 +1,817 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "wte/event_base.h"
+#include "wte/event_handler.h"
+#include "wte/stream.h"
+
+#include "current_base.h"
+#include "http_client.h"
+#include "http_parser.h"
+#include "logging.h"
+#include "server.h"
+#include "server_impl.h"
+
+namespace topper {
+
+std::string const& ClientResponse::header(std::string const& name) const {
+    static const std::string kEmpty;
+    for (auto const& header : headers) {
+        if (strcasecmp(header.first.c_str(), name.c_str()) == 0) {
+            return header.second;
+        }
+    }
+    return kEmpty;
+}
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Address {
+    struct sockaddr_storage storage;
+    socklen_t length = 0;
+};
+
+// Parse a numeric IPv4 or IPv6 address
+bool resolve(std::string const& host, short port, Address *out) {
+    memset(&out->storage, 0, sizeof(out->storage));
+    auto *in = reinterpret_cast<struct sockaddr_in*>(&out->storage);
+    if (inet_pton(AF_INET, host.c_str(), &in->sin_addr) == 1) {
+        in->sin_family = AF_INET;
+        in->sin_port = htons(static_cast<uint16_t>(port));
+        out->length = sizeof(struct sockaddr_in);
+        return true;
+    }
+    auto *in6 = reinterpret_cast<struct sockaddr_in6*>(&out->storage);
+    if (inet_pton(AF_INET6, host.c_str(), &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(static_cast<uint16_t>(port));
+        out->length = sizeof(struct sockaddr_in6);
+        return true;
+    }
+    return false;
+}
+
+// A request and the means of completing it
+struct Exchange {
+    std::string request;        // Serialized request
+    bool head = false;          // Response has no body
+    bool idempotent = false;    // May be sent again
+    bool retried = false;
+    Clock::time_point deadline;
+    HttpClient::Callback callback;
+};
+
+struct timeval toTimeval(Clock::time_point deadline) {
+    auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+        deadline - Clock::now());
+    if (remaining.count() < 0) {
+        remaining = std::chrono::microseconds(0);
+    }
+    struct timeval tv;
+    tv.tv_sec = remaining.count() / 1000000;
+    tv.tv_usec = remaining.count() % 1000000;
+    return tv;
+}
+
+class HostPool;
+
+// Client state owned by a single event base
+class BasePool {
+public:
+    BasePool(wte::EventBase *base, HttpClientOptions const& options)
+        : base_(base), options_(options) { }
+
+    // Fails outstanding requests
+    ~BasePool() {
+        closed_ = true;
+        hosts_.clear();
+        flush();
+    }
+
+    void submit(std::string const& key, Address const& address,
+        std::unique_ptr<Exchange> exchange);
+
+    // Queue a callback; callbacks are invoked by flush() so that they may
+    // issue further requests without reentering connection state
+    void complete(HttpClient::Callback const& callback, ClientError error,
+            ClientResponse const& response = ClientResponse()) {
+        completions_.push_back(std::bind(callback, error, response));
+    }
+
+    void flush() {
+        if (flushing_) {
+            return;
+        }
+        flushing_ = true;
+        while (!completions_.empty()) {
+            std::vector<std::function<void()>> completions;
+            completions.swap(completions_);
+            for (auto const& completion : completions) {
+                completion();
+            }
+        }
+        flushing_ = false;
+    }
+
+    wte::EventBase* base() const { return base_; }
+    HttpClientOptions const& options() const { return options_; }
+private:
+    wte::EventBase *base_;
+    const HttpClientOptions options_;
+    std::unordered_map<std::string, std::unique_ptr<HostPool>> hosts_;
+    std::vector<std::function<void()>> completions_;
+    bool flushing_ = false;
+    bool closed_ = false;
+};
+
+class Connection;
+
+// Connections to one host from one base, and the requests waiting for them
+class HostPool {
+public:
+    HostPool(BasePool *base, Address const& address)
+        : base_(base), address_(address) { }
+
+    ~HostPool();
+
+    void submit(std::unique_ptr<Exchange> exchange) {
+        waiting_.push_back(std::move(exchange));
+        schedule();
+    }
+
+    // Assign waiting requests to connections
+    void schedule();
+
+    // Close a connection, retrying or failing its outstanding requests
+    void release(Connection *conn, ClientError error);
+
+    BasePool* base() const { return base_; }
+private:
+    // Returns the connection for the next request, or null if it must
+    // wait. Sets failed if a new connection could not be opened.
+    Connection* choose(bool *failed);
+
+    BasePool *base_;
+    const Address address_;
+    std::vector<Connection*> connections_;
+    std::deque<std::unique_ptr<Exchange>> waiting_;
+};
+
+class Connection {
+public:
+    Connection(HostPool *pool, Address const& address);
+    ~Connection();
+
+    // Begin connecting; returns false on immediate failure
+    bool connect();
+
+    void send(std::unique_ptr<Exchange> exchange);
+
+    std::deque<std::unique_ptr<Exchange>> take() {
+        return std::move(exchanges_);
+    }
+
+    size_t outstanding() const { return exchanges_.size(); }
+
+    // Whether further requests may be assigned to this connection
+    bool usable() const { return !closing_; }
+
+    // Whether part of the current response has been received
+    bool receiving() const { return receiving_; }
+
+    // Whether a response has been received on this connection
+    bool reused() const { return served_ > 0; }
+private:
+    class Connector final : public wte::EventHandler {
+    public:
+        Connector(Connection *conn, int fd)
+            : wte::EventHandler(fd), conn_(conn) { }
+        void ready(wte::What event) noexcept override;
+    private:
+        Connection *conn_;
+    };
+
+    class Timer final : public wte::TimeoutHandler {
+    public:
+        explicit Timer(Connection *conn) : conn_(conn) { }
+        void expired() noexcept override;
+    private:
+        Connection *conn_;
+    };
+
+    class ReadCallback final : public wte::Stream::ReadCallback {
+    public:
+        explicit ReadCallback(Connection *conn) : conn_(conn) { }
+        void available(wte::Buffer *buffer) override;
+        void eof() override;
+        void error(std::runtime_error const& e) override;
+    private:
+        Connection *conn_;
+    };
+
+    class WriteCallback final : public wte::Stream::WriteCallback {
+    public:
+        explicit WriteCallback(Connection *conn) : conn_(conn) { }
+        void complete(wte::Stream *) override { }
+        void error(std::runtime_error const& e) override;
+    private:
+        Connection *conn_;
+    };
+
+    static int on_message_begin(http_parser *parser);
+    static int on_header_field(http_parser *parser, const char *at,
+        size_t length);
+    static int on_header_value(http_parser *parser, const char *at,
+        size_t length);
+    static int on_headers_complete(http_parser *parser);
+    static int on_body(http_parser *parser, const char *at, size_t length);
+    static int on_message_complete(http_parser *parser);
+
+    void connected();
+    void write(Exchange const& exchange) {
+        stream_->write(exchange.request.data(), exchange.request.size(),
+            &wcb_);
+    }
+
+    // (Re)arm the timer for the connect or the oldest request
+    void arm();
+    void disarm();
+
+    HostPool *pool_;
+    const Address address_;
+    int fd_ = -1;
+    std::unique_ptr<Connector> connector_;
+    wte::Stream *stream_ = nullptr;
+
+    http_parser parser_;
+    http_parser_settings settings_;
+
+    // Requests in the order they were written
+    std::deque<std::unique_ptr<Exchange>> exchanges_;
+
+    // The response being received
+    ClientResponse response_;
+    bool receiving_ = false;
+    bool headerValue_ = false;
+
+    Clock::time_point connectDeadline_;
+    bool armed_ = false;
+    bool closing_ = false;  // No further requests are assigned
+    bool done_ = false;     // The server is closing the connection
+    unsigned served_ = 0;
+
+    Timer timer_;
+    ReadCallback rcb_;
+    WriteCallback wcb_;
+};
+
+Connection::Connection(HostPool *pool, Address const& address)
+        : pool_(pool), address_(address), timer_(this), rcb_(this),
+          wcb_(this) {
+    memset(&settings_, 0, sizeof(http_parser_settings));
+    settings_.on_message_begin = on_message_begin;
+    settings_.on_header_field = on_header_field;
+    settings_.on_header_value = on_header_value;
+    settings_.on_headers_complete = on_headers_complete;
+    settings_.on_body = on_body;
+    settings_.on_message_complete = on_message_complete;
+    http_parser_init(&parser_, HTTP_RESPONSE);
+    parser_.data = this;
+}
+
+Connection::~Connection() {
+    disarm();
+    if (connector_) {
+        pool_->base()->base()->unregisterHandler(connector_.get());
+    }
+    if (stream_) {
+        stream_->stopRead();
+        stream_->close();
+        delete stream_;
+    } else if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+bool Connection::connect() {
+    auto const *addr = reinterpret_cast<struct sockaddr const*>(
+        &address_.storage);
+    fd_ = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+        0);
+    if (fd_ < 0) {
+        PLOG(INFO) << "socket";
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    connectDeadline_ = Clock::now() + pool_->base()->options().connectTimeout;
+    if (::connect(fd_, addr, address_.length) == 0) {
+        connected();
+        return true;
+    }
+    if (errno != EINPROGRESS) {
+        PLOG(INFO) << "connect";
+        return false;
+    }
+
+    connector_.reset(new Connector(this, fd_));
+    pool_->base()->base()->registerHandler(connector_.get(),
+        wte::What::WRITE);
+    arm();
+    return true;
+}
+
+void Connection::connected() {
+    stream_ = wte::wrapFd(pool_->base()->base(), fd_);
+    fd_ = -1;
+    stream_->startRead(&rcb_);
+    for (auto const& exchange : exchanges_) {
+        write(*exchange);
+    }
+    arm();
+}
+
+void Connection::send(std::unique_ptr<Exchange> exchange) {
+    if (!pool_->base()->options().keepAlive) {
+        // One request per connection
+        closing_ = true;
+    }
+    if (stream_) {
+        write(*exchange);
+    }
+    exchanges_.push_back(std::move(exchange));
+    if (exchanges_.size() == 1) {
+        arm();
+    }
+}
+
+void Connection::arm() {
+    disarm();
+    struct timeval tv;
+    if (!stream_) {
+        tv = toTimeval(connectDeadline_);
+    } else if (!exchanges_.empty()) {
+        tv = toTimeval(exchanges_.front()->deadline);
+    } else {
+        return;
+    }
+    pool_->base()->base()->registerTimeout(&timer_, &tv);
+    armed_ = true;
+}
+
+void Connection::disarm() {
+    if (armed_) {
+        pool_->base()->base()->unregisterTimeout(&timer_);
+        armed_ = false;
+    }
+}
+
+void Connection::Connector::ready(wte::What) noexcept {
+    BasePool *base = conn_->pool_->base();
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd(), SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+        err = errno;
+    }
+    if (err == EINPROGRESS) {
+        return;
+    }
+
+    base->base()->unregisterHandler(this);
+    std::unique_ptr<Connector> self(std::move(conn_->connector_));
+    if (err != 0) {
+        VLOG(1) << "connect: " << strerror(err);
+        conn_->pool_->release(conn_, ClientError::CONNECT);
+    } else {
+        conn_->connected();
+    }
+    base->flush();
+}
+
+void Connection::Timer::expired() noexcept {
+    BasePool *base = conn_->pool_->base();
+    conn_->armed_ = false;
+    conn_->pool_->release(conn_, conn_->stream_ ? ClientError::TIMEOUT
+        : ClientError::CONNECT);
+    base->flush();
+}
+
+void Connection::ReadCallback::available(wte::Buffer *buffer) {
+    BasePool *base = conn_->pool_->base();
+    std::vector<wte::Extent> extents;
+    size_t drain = 0;
+    bool failed = false;
+    buffer->peek(-1, &extents);
+    for (auto& extent : extents) {
+        drain += extent.size;
+        if (conn_->done_) {
+            // Nothing follows a response that closes the connection
+            continue;
+        }
+        size_t parsed = http_parser_execute(&conn_->parser_,
+            &conn_->settings_, extent.data, extent.size);
+        if (parsed != extent.size && !conn_->done_) {
+            VLOG(1) << "Parsed " << parsed << " bytes of " << extent.size
+                << ": " << http_errno_name(HTTP_PARSER_ERRNO(&conn_->parser_));
+            failed = true;
+            break;
+        }
+    }
+    buffer->drain(drain);
+
+    if (failed) {
+        conn_->pool_->release(conn_, ClientError::PROTOCOL);
+    } else if (conn_->done_) {
+        conn_->pool_->release(conn_, ClientError::CLOSED);
+    } else {
+        conn_->arm();
+        conn_->pool_->schedule();
+    }
+    base->flush();
+}
+
+void Connection::ReadCallback::eof() {
+    BasePool *base = conn_->pool_->base();
+    if (!conn_->done_) {
+        // Completes a response delimited by the end of the connection
+        http_parser_execute(&conn_->parser_, &conn_->settings_, nullptr, 0);
+    }
+    conn_->pool_->release(conn_, ClientError::CLOSED);
+    base->flush();
+}
+
+void Connection::ReadCallback::error(std::runtime_error const& e) {
+    BasePool *base = conn_->pool_->base();
+    VLOG(1) << "While reading: " << e.what();
+    conn_->pool_->release(conn_, ClientError::CLOSED);
+    base->flush();
+}
+
+void Connection::WriteCallback::error(std::runtime_error const& e) {
+    BasePool *base = conn_->pool_->base();
+    VLOG(1) << "While writing: " << e.what();
+    conn_->pool_->release(conn_, ClientError::CLOSED);
+    base->flush();
+}
+
+int Connection::on_message_begin(http_parser *parser) {
+    auto *conn = reinterpret_cast<Connection*>(parser->data);
+    conn->receiving_ = true;
+    return 0;
+}
+
+int Connection::on_header_field(http_parser *parser, const char *at,
+        size_t length) {
+    auto *conn = reinterpret_cast<Connection*>(parser->data);
+    auto& headers = conn->response_.headers;
+    if (headers.empty() || conn->headerValue_) {
+        headers.emplace_back();
+    }
+    headers.back().first.append(at, length);
+    conn->headerValue_ = false;
+    return 0;
+}
+
+int Connection::on_header_value(http_parser *parser, const char *at,
+        size_t length) {
+    auto *conn = reinterpret_cast<Connection*>(parser->data);
+    if (conn->response_.headers.empty()) {
+        return 1;
+    }
+    conn->response_.headers.back().second.append(at, length);
+    conn->headerValue_ = true;
+    return 0;
+}
+
+int Connection::on_headers_complete(http_parser *parser) {
+    auto *conn = reinterpret_cast<Connection*>(parser->data);
+    if (conn->exchanges_.empty()) {
+        // Unsolicited response
+        return -1;
+    }
+    conn->response_.status = parser->status_code;
+    // Instructs the parser to skip the body of responses to HEAD
+    return conn->exchanges_.front()->head ? 1 : 0;
+}
+
+int Connection::on_body(http_parser *parser, const char *at, size_t length) {
+    auto *conn = reinterpret_cast<Connection*>(parser->data);
+    conn->response_.body.append(at, length);
+    return 0;
+}
+
+int Connection::on_message_complete(http_parser *parser) {
+    auto *conn = reinterpret_cast<Connection*>(parser->data);
+    std::unique_ptr<Exchange> exchange = std::move(conn->exchanges_.front());
+    conn->exchanges_.pop_front();
+    conn->pool_->base()->complete(exchange->callback, ClientError::NONE,
+        conn->response_);
+
+    conn->response_ = ClientResponse();
+    conn->receiving_ = false;
+    conn->headerValue_ = false;
+    ++conn->served_;
+
+    if (!http_should_keep_alive(parser)) {
+        conn->closing_ = true;
+        conn->done_ = true;
+        http_parser_pause(parser, 1);
+    }
+    return 0;
+}
+
+HostPool::~HostPool() {
+    for (Connection *conn : connections_) {
+        for (auto& exchange : conn->take()) {
+            base_->complete(exchange->callback, ClientError::CLOSED);
+        }
+        delete conn;
+    }
+    for (auto& exchange : waiting_) {
+        base_->complete(exchange->callback, ClientError::CLOSED);
+    }
+}
+
+Connection* HostPool::choose(bool *failed) {
+    HttpClientOptions const& options = base_->options();
+    size_t depth = options.keepAlive ? std::max(options.pipelineDepth, 1) : 1;
+
+    // Prefer an idle connection, then a new one, then pipelining
+    Connection *best = nullptr;
+    for (Connection *conn : connections_) {
+        if (conn->usable() &&
+                (!best || conn->outstanding() < best->outstanding())) {
+            best = conn;
+        }
+    }
+    if (best && best->outstanding() == 0) {
+        return best;
+    }
+
+    if (connections_.size() <
+            static_cast<size_t>(std::max(options.maxConnectionsPerHost, 1))) {
+        std::unique_ptr<Connection> conn(new Connection(this, address_));
+        if (!conn->connect()) {
+            *failed = true;
+            return nullptr;
+        }
+        connections_.push_back(conn.get());
+        return conn.release();
+    }
+
+    if (best && best->outstanding() < depth) {
+        return best;
+    }
+    return nullptr;
+}
+
+void HostPool::schedule() {
+    while (!waiting_.empty()) {
+        if (Clock::now() >= waiting_.front()->deadline) {
+            base_->complete(waiting_.front()->callback, ClientError::TIMEOUT);
+            waiting_.pop_front();
+            continue;
+        }
+
+        bool failed = false;
+        Connection *conn = choose(&failed);
+        if (failed) {
+            base_->complete(waiting_.front()->callback, ClientError::CONNECT);
+            waiting_.pop_front();
+            continue;
+        }
+        if (!conn) {
+            break;
+        }
+
+        std::unique_ptr<Exchange> exchange = std::move(waiting_.front());
+        waiting_.pop_front();
+        conn->send(std::move(exchange));
+    }
+}
+
+void HostPool::release(Connection *conn, ClientError error) {
+    bool receiving = conn->receiving();
+    bool reused = conn->reused();
+    std::deque<std::unique_ptr<Exchange>> exchanges = conn->take();
+    for (auto it = connections_.begin(); it != connections_.end(); ++it) {
+        if (*it == conn) {
+            connections_.erase(it);
+            break;
+        }
+    }
+    delete conn;
+
+    // The oldest request bears the error. Those pipelined behind it saw no
+    // response and are retried once if it is safe to send them again, as
+    // is the oldest if a reused connection closed before answering it.
+    std::deque<std::unique_ptr<Exchange>> retry;
+    for (size_t i = 0; i < exchanges.size(); ++i) {
+        std::unique_ptr<Exchange>& exchange = exchanges[i];
+        ClientError result =
+            (i == 0 || error == ClientError::CONNECT) ? error
+                                                       : ClientError::CLOSED;
+        bool retriable = result == ClientError::CLOSED &&
+            exchange->idempotent && !exchange->retried &&
+            (i > 0 || (reused && !receiving));
+        if (retriable) {
+            exchange->retried = true;
+            retry.push_back(std::move(exchange));
+        } else {
+            base_->complete(exchange->callback, result);
+        }
+    }
+    while (!retry.empty()) {
+        waiting_.push_front(std::move(retry.back()));
+        retry.pop_back();
+    }
+
+    schedule();
+}
+
+void BasePool::submit(std::string const& key, Address const& address,
+        std::unique_ptr<Exchange> exchange) {
+    if (closed_) {
+        complete(exchange->callback, ClientError::CLOSED);
+        flush();
+        return;
+    }
+    auto it = hosts_.find(key);
+    if (it == hosts_.end()) {
+        it = hosts_.emplace(key,
+            std::unique_ptr<HostPool>(new HostPool(this, address))).first;
+    }
+    it->second->submit(std::move(exchange));
+    flush();
+}
+
+} // anonymous namespace
+
+class HttpClientImpl {
+public:
+    HttpClientImpl(std::vector<wte::EventBase*> const& bases,
+            HttpClientOptions const& options, bool driven)
+            : options_(options), driven_(driven) {
+        for (wte::EventBase *base : bases) {
+            pools_.push_back(new BasePool(base, options));
+        }
+    }
+
+    ~HttpClientImpl() {
+        for (BasePool *pool : pools_) {
+            if (driven_ || currentEventBase() == pool->base()) {
+                delete pool;
+            } else {
+                pool->base()->runOnEventLoopAndWait([pool]() {
+                        delete pool;
+                    });
+            }
+        }
+    }
+
+    void request(std::string const& method, std::string const& host,
+        short port, std::string const& path, HttpClient::Headers const& headers,
+        std::string const& body, HttpClient::Callback const& callback);
+private:
+    // The pool of the calling thread's base, if it is one of ours
+    BasePool* choosePool();
+
+    const HttpClientOptions options_;
+    const bool driven_;
+    std::vector<BasePool*> pools_;
+    std::atomic<unsigned> next_{0};
+};
+
+BasePool* HttpClientImpl::choosePool() {
+    wte::EventBase *current = currentEventBase();
+    for (BasePool *pool : pools_) {
+        if (pool->base() == current) {
+            return pool;
+        }
+    }
+    return nullptr;
+}
+
+void HttpClientImpl::request(std::string const& method,
+        std::string const& host, short port, std::string const& path,
+        HttpClient::Headers const& headers, std::string const& body,
+        HttpClient::Callback const& callback) {
+    Address address;
+    if (!resolve(host, port, &address)) {
+        throw std::invalid_argument("Invalid address " + host);
+    }
+    std::string key = host + ":" + std::to_string(port);
+
+    std::unique_ptr<Exchange> exchange(new Exchange());
+    exchange->head = method == "HEAD";
+    exchange->idempotent = method != "POST" && method != "PATCH";
+    exchange->deadline = Clock::now() + options_.requestTimeout;
+    exchange->callback = callback;
+
+    std::string& out = exchange->request;
+    out.reserve(method.size() + path.size() + key.size() + body.size() + 64);
+    out.append(method).append(" ").append(path).append(" HTTP/1.1\r\n");
+    if (address.storage.ss_family == AF_INET6) {
+        out.append("Host: [").append(host).append("]:");
+    } else {
+        out.append("Host: ").append(host).append(":");
+    }
+    out.append(std::to_string(port)).append("\r\n");
+    if (!body.empty() || method == "POST" || method == "PUT") {
+        out.append("Content-Length: ").append(std::to_string(body.size()))
+           .append("\r\n");
+    }
+    if (!options_.keepAlive) {
+        out.append("Connection: close\r\n");
+    }
+    for (auto const& header : headers) {
+        out.append(header.first).append(": ").append(header.second)
+           .append("\r\n");
+    }
+    out.append("\r\n").append(body);
+
+    BasePool *pool = choosePool();
+    if (pool) {
+        // Already on one of our bases
+        pool->submit(key, address, std::move(exchange));
+        return;
+    }
+
+    pool = pools_[next_++ % pools_.size()];
+    Exchange *raw = exchange.release();
+    pool->base()->runOnEventLoop([pool, key, address, raw]() {
+            pool->submit(key, address, std::unique_ptr<Exchange>(raw));
+        });
+}
+
+namespace {
+
+std::vector<wte::EventBase*> const& serverBases(ServerImpl *server) {
+    std::vector<wte::EventBase*> const& bases = server->bases();
+    if (bases.empty()) {
+        throw std::logic_error("Server is not running");
+    }
+    return bases;
+}
+
+} // anonymous namespace
+
+HttpClient::HttpClient(Server *server, HttpClientOptions const& options)
+    : impl_(new HttpClientImpl(serverBases(server->internal_), options,
+        /*driven=*/ false)) { }
+
+HttpClient::HttpClient(wte::EventBase *base, HttpClientOptions const& options)
+    : impl_(new HttpClientImpl({base}, options, /*driven=*/ true)) { }
+
+HttpClient::~HttpClient() {
+    delete impl_;
+}
+
+void HttpClient::request(std::string const& method, std::string const& host,
+        short port, std::string const& path, Headers const& headers,
+        std::string const& body, Callback const& callback) {
+    impl_->request(method, host, port, path, headers, body, callback);
+}
+
+} // topper namespace
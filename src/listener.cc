@@ -0,0 +1,404 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "listener.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "logging.h"
+
+namespace topper {
+
+namespace {
+
+const char kUnixPrefix[] = "unix:";
+
+// Connections accepted per readiness event; the rest wait for the next turn
+// of the loop
+const size_t kMaxBatch = 64;
+
+// How long to stop accepting when out of descriptors or memory
+const int kBackoffMillis = 100;
+
+std::runtime_error socketError(const char *what) {
+    return std::runtime_error(std::string(what) + ": " + strerror(errno));
+}
+
+// Whether nothing is listening on a Unix socket path any more, i.e. the
+// socket was left behind by a process that has gone
+bool stale(struct sockaddr_storage const& addr, socklen_t len) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    bool refused = connect(fd, reinterpret_cast<struct sockaddr const*>(
+        &addr), len) != 0 && errno == ECONNREFUSED;
+    close(fd);
+    return refused;
+}
+
+} // anonymous namespace
+
+Listener::Listener(wte::EventBase *base, int fd,
+        AcceptCallback const& acceptCb, BatchCallback const& batchCb)
+    : wte::EventHandler(fd), base_(base), acceptCb_(acceptCb),
+      batchCb_(batchCb), backoff_(this) { }
+
+Listener::~Listener() {
+    stopAccepting();
+    if (fd() >= 0) {
+        close(fd());
+    }
+}
+
+bool Listener::parse(std::string const& address, short port,
+        struct sockaddr_storage *addr, socklen_t *len) {
+    memset(addr, 0, sizeof(*addr));
+    if (address.compare(0, sizeof(kUnixPrefix) - 1, kUnixPrefix) == 0) {
+        std::string path = address.substr(sizeof(kUnixPrefix) - 1);
+        auto *un = reinterpret_cast<struct sockaddr_un*>(addr);
+        if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path.data(), path.size());
+        if (path[0] == '@') {
+            // Abstract namespace: a leading NUL, and no terminator
+            un->sun_path[0] = '\0';
+            *len = offsetof(struct sockaddr_un, sun_path) + path.size();
+        } else {
+            *len = sizeof(*un);
+        }
+        return true;
+    }
+
+    std::string host = address;
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    auto *in6 = reinterpret_cast<struct sockaddr_in6*>(addr);
+    if (inet_pton(AF_INET6, host.c_str(), &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        *len = sizeof(*in6);
+        return true;
+    }
+    auto *in = reinterpret_cast<struct sockaddr_in*>(addr);
+    if (inet_pton(AF_INET, address.c_str(), &in->sin_addr) == 1) {
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        *len = sizeof(*in);
+        return true;
+    }
+    return false;
+}
+
+bool Listener::valid(std::string const& address) {
+    struct sockaddr_storage addr;
+    socklen_t len;
+    return parse(address, 0, &addr, &len);
+}
+
+int Listener::bind(std::string const& address, short port,
+        ServerOptions const& options) {
+    struct sockaddr_storage addr;
+    socklen_t len;
+    if (!parse(address, port, &addr, &len)) {
+        throw std::runtime_error("Invalid address " + address);
+    }
+
+    int fd = socket(addr.ss_family,
+        SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw socketError("socket");
+    }
+    int one = 1;
+    int zero = 0;
+    auto *un = reinterpret_cast<struct sockaddr_un*>(&addr);
+    auto *in6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+    switch (addr.ss_family) {
+    case AF_UNIX:
+        if (un->sun_path[0] != '\0') {
+            // Replace a socket left behind by an earlier process, but
+            // nothing else; binding fails if a live server has the path
+            struct stat st;
+            if (lstat(un->sun_path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+                    stale(addr, len)) {
+                unlink(un->sun_path);
+            }
+        }
+        break;
+    case AF_INET6:
+        // The wildcard address accepts IPv4 as well, whatever the system
+        // default
+        if (IN6_IS_ADDR_UNSPECIFIED(&in6->sin6_addr)) {
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        }
+        // Fall through
+    default:
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        break;
+    }
+
+    if (::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len) != 0) {
+        std::runtime_error error = socketError(("bind " + address).c_str());
+        close(fd);
+        throw error;
+    }
+    if (options.unixSocketMode && addr.ss_family == AF_UNIX &&
+            un->sun_path[0] != '\0' &&
+            chmod(un->sun_path, options.unixSocketMode) != 0) {
+        std::runtime_error error = socketError("chmod");
+        close(fd);
+        throw error;
+    }
+    try {
+        listen(fd, options);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    return fd;
+}
+
+void Listener::listen(int fd, ServerOptions const& options) {
+    auto set = [fd](int level, int name, int value, const char *what) {
+        if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+            PLOG(WARNING) << "Setting " << what;
+        }
+    };
+
+    int domain = 0;
+    socklen_t len = sizeof(domain);
+    getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len);
+
+    // Buffer sizes must be set before listening, so that the window scale
+    // offered to clients reflects the receive buffer
+    if (options.sendBuffer > 0) {
+        set(SOL_SOCKET, SO_SNDBUF, options.sendBuffer, "SO_SNDBUF");
+    }
+    if (options.receiveBuffer > 0) {
+        set(SOL_SOCKET, SO_RCVBUF, options.receiveBuffer, "SO_RCVBUF");
+    }
+
+    if (domain == AF_INET || domain == AF_INET6) {
+        // Accepted connections inherit these
+        if (options.noDelay) {
+            set(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+        }
+        TcpKeepAlive const& keepAlive = options.tcpKeepAlive;
+        if (keepAlive.idle.count() > 0) {
+            set(SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+            set(IPPROTO_TCP, TCP_KEEPIDLE, keepAlive.idle.count(),
+                "TCP_KEEPIDLE");
+            if (keepAlive.interval.count() > 0) {
+                set(IPPROTO_TCP, TCP_KEEPINTVL, keepAlive.interval.count(),
+                    "TCP_KEEPINTVL");
+            }
+            if (keepAlive.probes > 0) {
+                set(IPPROTO_TCP, TCP_KEEPCNT, keepAlive.probes,
+                    "TCP_KEEPCNT");
+            }
+        }
+
+        // These only affect the listening socket
+        if (options.deferAccept.count() > 0) {
+            set(IPPROTO_TCP, TCP_DEFER_ACCEPT, options.deferAccept.count(),
+                "TCP_DEFER_ACCEPT");
+        }
+        if (options.fastOpenQueue > 0) {
+            set(IPPROTO_TCP, TCP_FASTOPEN, options.fastOpenQueue,
+                "TCP_FASTOPEN");
+        }
+    }
+
+    // Listening again on a listening socket just resizes its queue
+    if (::listen(fd, options.backlog) != 0) {
+        throw socketError("listen");
+    }
+}
+
+void Listener::startAccepting() {
+    if (!accepting_) {
+        if (!paused_) {
+            base_->registerHandler(this, wte::What::READ);
+        }
+        accepting_ = true;
+    }
+}
+
+void Listener::stopAccepting() {
+    if (!accepting_) {
+        return;
+    }
+    if (paused_) {
+        base_->unregisterTimeout(&backoff_);
+        paused_ = false;
+    } else {
+        base_->unregisterHandler(this);
+    }
+    accepting_ = false;
+}
+
+void Listener::pause() {
+    base_->unregisterHandler(this);
+    paused_ = true;
+    struct timeval tv;
+    tv.tv_sec = kBackoffMillis / 1000;
+    tv.tv_usec = (kBackoffMillis % 1000) * 1000;
+    base_->registerTimeout(&backoff_, &tv);
+}
+
+void Listener::Backoff::expired() noexcept {
+    listener_->paused_ = false;
+    if (listener_->accepting_) {
+        listener_->base_->registerHandler(listener_, wte::What::READ);
+    }
+}
+
+short Listener::port() const {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd(), reinterpret_cast<struct sockaddr*>(&addr),
+            &len) != 0) {
+        return 0;
+    }
+    switch (addr.ss_family) {
+    case AF_INET:
+        return ntohs(reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+    case AF_INET6:
+        return ntohs(
+            reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port);
+    default:
+        return 0;
+    }
+}
+
+std::string Listener::address() const {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd(), reinterpret_cast<struct sockaddr*>(&addr),
+            &len) != 0) {
+        return "";
+    }
+    char host[INET6_ADDRSTRLEN] = {};
+    switch (addr.ss_family) {
+    case AF_INET: {
+        auto *in = reinterpret_cast<struct sockaddr_in*>(&addr);
+        inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+        return std::string(host) + ":" + std::to_string(ntohs(in->sin_port));
+    }
+    case AF_INET6: {
+        auto *in6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+        inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+        return "[" + std::string(host) + "]:" +
+            std::to_string(ntohs(in6->sin6_port));
+    }
+    case AF_UNIX: {
+        auto *un = reinterpret_cast<struct sockaddr_un*>(&addr);
+        size_t n = len - offsetof(struct sockaddr_un, sun_path);
+        if (n > 0 && un->sun_path[0] == '\0') {
+            return kUnixPrefix + ("@" + std::string(un->sun_path + 1, n - 1));
+        }
+        return kUnixPrefix + std::string(un->sun_path,
+            strnlen(un->sun_path, n));
+    }
+    default:
+        return "";
+    }
+}
+
+void Listener::removePath() {
+    struct sockaddr_un addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd(), reinterpret_cast<struct sockaddr*>(&addr),
+            &len) != 0 || addr.sun_family != AF_UNIX) {
+        return;
+    }
+    size_t n = len - offsetof(struct sockaddr_un, sun_path);
+    if (n > 0 && addr.sun_path[0] != '\0') {
+        unlink(std::string(addr.sun_path, strnlen(addr.sun_path, n)).c_str());
+    }
+}
+
+int Listener::release() {
+    stopAccepting();
+    int fd = this->fd();
+    setFd(-1);
+    return fd;
+}
+
+void Listener::ready(wte::What) noexcept {
+    // Drain the accept queue, up to a batch, then let the owner hand the
+    // batch off
+    size_t accepted = 0;
+    while (accepting_ && !paused_ && accepted < kMaxBatch) {
+        int fd = accept4(this->fd(), nullptr, nullptr,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0) {
+            acceptCb_(fd);
+            ++accepted;
+            continue;
+        }
+        switch (errno) {
+        case EINTR:
+        case ECONNABORTED:
+            continue;
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            break;
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:
+            // The connection stays queued, and the socket readable; wait
+            // for descriptors to be freed rather than spin on it
+            PLOG(WARNING) << "accept; pausing for " << kBackoffMillis << "ms";
+            pause();
+            break;
+        default:
+            PLOG(WARNING) << "accept";
+            break;
+        }
+        break;
+    }
+    if (accepted > 0 && batchCb_) {
+        batchCb_();
+    }
+}
+
+} // topper namespace
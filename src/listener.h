@@ -0,0 +1,141 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_LISTENER_H_
+#define SRC_LISTENER_H_
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <functional>
+#include <string>
+
+#include "wte/event_base.h"
+#include "wte/event_handler.h"
+
+#include "server.h"
+
+namespace topper {
+
+/**
+ * Accepts connections on a listening socket from an event base.
+ *
+ * The socket is either bound by the listener or adopted from elsewhere,
+ * e.g. inherited from the process being replaced in a hot upgrade. Accepted
+ * sockets are non-blocking and close-on-exec.
+ */
+class Listener final : public wte::EventHandler {
+public:
+    typedef std::function<void(int)> AcceptCallback;
+    typedef std::function<void()> BatchCallback;
+
+    // Takes ownership of a listening socket. Each readiness event accepts
+    // pending connections, up to a batch at a time so that other events on
+    // the base get a turn, calling acceptCb for each and then batchCb once
+    // for the lot. When the process runs out of descriptors, accepting
+    // pauses for a moment rather than spinning on the pending connection.
+    Listener(wte::EventBase *base, int fd, AcceptCallback const& acceptCb,
+        BatchCallback const& batchCb = BatchCallback());
+
+    // Closes the socket, unless it has been released
+    ~Listener();
+
+    /**
+     * Creates a listening socket.
+     *
+     * Addresses are IPv4 in dotted-quad notation, IPv6, optionally in
+     * brackets, or `unix:` followed by a path. A path starting with `@`
+     * names a socket in the abstract namespace. The IPv6 wildcard address
+     * `::` accepts IPv4 connections too. A socket file at a Unix path is
+     * replaced if nothing is listening on it any more, and given the
+     * configured permissions.
+     *
+     * @param[in] address the address
+     * @param[in] port the port, or 0 for an ephemeral port; unused for
+     *            Unix sockets
+     * @param[in] options the socket settings, as for listen()
+     * @return the socket
+     * @throws std::runtime_error if the socket can't be bound
+     */
+    static int bind(std::string const& address, short port,
+        ServerOptions const& options);
+
+    /**
+     * Applies socket settings and starts listening, or resizes the accept
+     * queue of a socket that is listening already, e.g. one inherited from
+     * another process.
+     *
+     * Options for accepted connections, such as TCP_NODELAY and keepalive,
+     * are set once on the listening socket, which accepted sockets inherit.
+     * Settings that the system rejects are logged and skipped.
+     *
+     * @throws std::runtime_error if the socket can't listen
+     */
+    static void listen(int fd, ServerOptions const& options);
+
+    // Whether bind() accepts an address
+    static bool valid(std::string const& address);
+
+    // Start and stop accepting; run on the base
+    void startAccepting();
+    void stopAccepting();
+
+    // The bound port; 0 for Unix sockets
+    short port() const;
+
+    // The bound address, in the form given to bind(), with the port
+    std::string address() const;
+
+    // Give up ownership of the socket, which stays open
+    int release();
+
+    // Remove the socket's file, if it is bound to a Unix path
+    void removePath();
+
+    void ready(wte::What event) noexcept override;
+private:
+    // Resumes accepting after a pause
+    class Backoff final : public wte::TimeoutHandler {
+    public:
+        explicit Backoff(Listener *listener) : listener_(listener) { }
+        void expired() noexcept override;
+    private:
+        Listener *listener_;
+    };
+
+    static bool parse(std::string const& address, short port,
+        struct sockaddr_storage *addr, socklen_t *len);
+
+    // Stop watching the socket until the backoff expires
+    void pause();
+
+    wte::EventBase *base_;
+    AcceptCallback acceptCb_;
+    BatchCallback batchCb_;
+    Backoff backoff_;
+    bool accepting_ = false;
+    bool paused_ = false;
+};
+
+} // topper namespace
+
+#endif // SRC_LISTENER_H_
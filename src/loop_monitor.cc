@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "loop_monitor.h"
+
+#include <sys/time.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "wte/event_handler.h"
+
+namespace topper {
+
+namespace {
+
+// CPU time consumed by the calling thread
+std::chrono::nanoseconds threadCpuTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) +
+        std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+} // anonymous namespace
+
+class LoopMonitor::Probe final : public wte::TimeoutHandler {
+public:
+    Probe(wte::EventBase *base, MetricRegistry *metrics,
+            std::string const& name, std::chrono::milliseconds interval)
+        : base_(base), interval_(interval),
+          lag_(metrics->timer("topper.base.lag", {{"base", name}})),
+          lastLag_(metrics->gauge("topper.base.lag_us", {{"base", name}})),
+          utilization_(metrics->gauge("topper.base.utilization",
+              {{"base", name}})),
+          busy_(metrics->counter("topper.base.busy_ns", {{"base", name}})),
+          idle_(metrics->counter("topper.base.idle_ns", {{"base", name}}))
+        { }
+
+    wte::EventBase* base() const { return base_; }
+
+    // Arm the first probe; runs on the base
+    void start() {
+        last_ = std::chrono::steady_clock::now();
+        cpu_ = threadCpuTime();
+        schedule();
+    }
+
+    // Runs on the base
+    void cancel() {
+        if (armed_) {
+            base_->unregisterTimeout(this);
+            armed_ = false;
+        }
+    }
+
+    void expired() noexcept override {
+        armed_ = false;
+        auto now = std::chrono::steady_clock::now();
+        auto cpu = threadCpuTime();
+
+        auto wall = now - last_;
+        auto lag = std::max(wall - interval_,
+            std::chrono::steady_clock::duration::zero());
+        auto busy = std::min<std::chrono::steady_clock::duration>(cpu - cpu_,
+            wall);
+        lag_->update(lag);
+        busy_->increment(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(busy)
+                .count());
+        idle_->increment(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(wall - busy)
+                .count());
+
+        // Gauges are adjusted by the change since the last probe
+        int64_t lagUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            lag).count();
+        lastLag_->increment(lagUs - lagUs_);
+        lagUs_ = lagUs;
+        int64_t percent = wall.count() > 0 ? 100 * busy.count() / wall.count()
+            : 0;
+        utilization_->increment(percent - percent_);
+        percent_ = percent;
+
+        last_ = now;
+        cpu_ = cpu;
+        schedule();
+    }
+private:
+    void schedule() {
+        struct timeval tv;
+        tv.tv_sec = interval_.count() / 1000;
+        tv.tv_usec = (interval_.count() % 1000) * 1000;
+        base_->registerTimeout(this, &tv);
+        armed_ = true;
+    }
+
+    wte::EventBase *base_;
+    const std::chrono::milliseconds interval_;
+
+    Timer *lag_;
+    Gauge *lastLag_;
+    Gauge *utilization_;
+    Counter *busy_;
+    Counter *idle_;
+
+    // State as of the last probe
+    bool armed_ = false;
+    std::chrono::steady_clock::time_point last_;
+    std::chrono::nanoseconds cpu_{0};
+    int64_t lagUs_ = 0;
+    int64_t percent_ = 0;
+};
+
+LoopMonitor::LoopMonitor(MetricRegistry *metrics,
+        std::chrono::milliseconds interval)
+    : metrics_(metrics), interval_(interval) { }
+
+LoopMonitor::~LoopMonitor() { }
+
+void LoopMonitor::monitor(wte::EventBase *base, std::string const& name) {
+    probes_.emplace_back(new Probe(base, metrics_, name, interval_));
+    Probe *probe = probes_.back().get();
+    base->runOnEventLoop([probe]() { probe->start(); });
+}
+
+void LoopMonitor::stop() {
+    for (auto& probe : probes_) {
+        Probe *p = probe.get();
+        p->base()->runOnEventLoopAndWait([p]() { p->cancel(); });
+    }
+    probes_.clear();
+}
+
+} // topper namespace
@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_LOOP_MONITOR_H_
+#define SRC_LOOP_MONITOR_H_
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "wte/event_base.h"
+
+#include "metric_registry.h"
+
+namespace topper {
+
+/**
+ * Probes event bases for saturation.
+ *
+ * Each monitored base runs a timer every interval. The delay between when
+ * the timer was due and when it ran is the base's scheduling lag: how long
+ * a newly ready connection would have waited. The thread CPU time consumed
+ * between probes gives the fraction of the interval the base was busy.
+ *
+ * Metrics, labeled with the base's name:
+ *
+ *     topper.base.lag             timer of the scheduling lag
+ *     topper.base.lag_us          gauge of the latest lag, in microseconds
+ *     topper.base.utilization     gauge of the latest busy fraction, in %
+ *     topper.base.busy_ns         counter of busy time
+ *     topper.base.idle_ns         counter of idle time
+ */
+class LoopMonitor {
+public:
+    explicit LoopMonitor(MetricRegistry *metrics,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+    ~LoopMonitor();
+
+    // Start probing a running base
+    void monitor(wte::EventBase *base, std::string const& name);
+
+    // Stop every probe. The bases must still be running.
+    void stop();
+private:
+    class Probe;
+
+    MetricRegistry *metrics_;
+    const std::chrono::milliseconds interval_;
+    std::vector<std::unique_ptr<Probe>> probes_;
+};
+
+} // topper namespace
+
+#endif // SRC_LOOP_MONITOR_H_
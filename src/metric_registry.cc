@@ -0,0 +1,382 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "metric_registry.h"
+
+namespace topper {
+
+namespace detail {
+
+const size_t Shard::kChunkCells;
+const size_t Shard::kDirectoryChunks;
+const size_t Shard::kMaxChunks;
+const size_t Shard::kDirectories;
+
+namespace {
+
+// Live shards, and the totals of exited threads
+std::mutex shardsMutex;
+std::vector<Shard*> shards;
+Shard *retired = nullptr;
+
+// Slots are shared by every registry. Released slots are reused by metrics
+// of the same size. Cells that hold a maximum rather than a sum are marked,
+// for folding shards together.
+std::mutex slotsMutex;
+size_t nextSlot = 0;
+std::map<size_t, std::vector<size_t>> freeSlots;
+std::vector<bool> maxCells;
+
+// Reserve contiguous cells that do not straddle a chunk; maxCell is the
+// offset of a cell holding a maximum, if any
+size_t allocateSlots(size_t cells, size_t maxCell) {
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    size_t slot;
+    std::vector<size_t>& free = freeSlots[cells];
+    if (!free.empty()) {
+        slot = free.back();
+        free.pop_back();
+    } else {
+        size_t offset = nextSlot % Shard::kChunkCells;
+        if (offset + cells > Shard::kChunkCells) {
+            nextSlot += Shard::kChunkCells - offset;
+        }
+        if (nextSlot + cells > Shard::kChunkCells * Shard::kMaxChunks) {
+            throw std::runtime_error("Metric storage exhausted");
+        }
+        slot = nextSlot;
+        nextSlot += cells;
+        maxCells.resize(nextSlot, false);
+    }
+    for (size_t i = 0; i < cells; ++i) {
+        maxCells[slot + i] = i == maxCell;
+    }
+    return slot;
+}
+
+void releaseSlots(size_t slot, size_t cells) {
+    Shard::clear(slot, cells);
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    freeSlots[cells].push_back(slot);
+}
+
+thread_local bool exiting = false;
+
+// Retires the calling thread's shard when the thread exits
+struct Owner {
+    Shard *shard = nullptr;
+    Shard **local = nullptr;
+
+    ~Owner() {
+        exiting = true;
+        if (shard) {
+            *local = nullptr;
+            Shard::retire(shard);
+        }
+    }
+};
+
+} // anonymous namespace
+
+Shard::Chunk::Chunk() {
+    for (auto& cell : cells) {
+        cell.store(0, std::memory_order_relaxed);
+    }
+}
+
+Shard::Directory::Directory() {
+    for (auto& chunk : chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+Shard::Shard() {
+    for (auto& directory : directories_) {
+        directory.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+Shard::~Shard() {
+    for (auto& slot : directories_) {
+        Directory *directory = slot.load(std::memory_order_relaxed);
+        if (!directory) {
+            continue;
+        }
+        for (auto& chunk : directory->chunks) {
+            delete chunk.load(std::memory_order_relaxed);
+        }
+        delete directory;
+    }
+}
+
+Shard* Shard::create(Shard **local) {
+    Shard *shard = new Shard();
+    {
+        std::lock_guard<std::mutex> lock(shardsMutex);
+        shards.push_back(shard);
+    }
+
+    // A shard created while the thread exits, by a later destructor, is
+    // kept like the totals instead
+    if (!exiting) {
+        static thread_local Owner owner;
+        owner.shard = shard;
+        owner.local = local;
+    }
+    return shard;
+}
+
+void Shard::retire(Shard *shard) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    if (!retired) {
+        retired = new Shard();
+        shards.push_back(retired);
+    }
+
+    {
+        std::lock_guard<std::mutex> slotsLock(slotsMutex);
+        for (size_t c = 0; c < kMaxChunks; ++c) {
+            Chunk *from = shard->find(c);
+            if (!from) {
+                continue;
+            }
+            Chunk *into = retired->find(c);
+            if (!into) {
+                into = retired->allocate(c);
+            }
+            for (size_t i = 0; i < kChunkCells; ++i) {
+                int64_t value = from->cells[i].load(std::memory_order_relaxed);
+                if (value == 0) {
+                    continue;
+                }
+                std::atomic<int64_t>& cell = into->cells[i];
+                int64_t total = cell.load(std::memory_order_relaxed);
+                if (maxCells[c * kChunkCells + i]) {
+                    cell.store(std::max(total, value),
+                        std::memory_order_relaxed);
+                } else {
+                    cell.store(total + value, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    shards.erase(std::find(shards.begin(), shards.end(), shard));
+    delete shard;
+}
+
+void Shard::clear(size_t slot, size_t cells) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    for (Shard *shard : shards) {
+        Chunk *chunk = shard->find(slot / kChunkCells);
+        if (!chunk) {
+            continue;
+        }
+        for (size_t i = 0; i < cells; ++i) {
+            chunk->cells[slot % kChunkCells + i].store(0,
+                std::memory_order_relaxed);
+        }
+    }
+}
+
+Shard::Chunk* Shard::allocate(size_t chunk) {
+    std::atomic<Directory*>& slot = directories_[chunk / kDirectoryChunks];
+    Directory *directory = slot.load(std::memory_order_relaxed);
+    if (!directory) {
+        directory = new Directory();
+        slot.store(directory, std::memory_order_release);
+    }
+    Chunk *allocated = new Chunk();
+    directory->chunks[chunk % kDirectoryChunks].store(allocated,
+        std::memory_order_release);
+    return allocated;
+}
+
+void Shard::forEach(std::function<void(Shard const&)> const& fn) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    for (Shard const* shard : shards) {
+        fn(*shard);
+    }
+}
+
+} // detail namespace
+
+const size_t Counter::kCells;
+const size_t Timer::kSubBuckets;
+const size_t Timer::kBuckets;
+const size_t Timer::kSum;
+const size_t Timer::kMax;
+const size_t Timer::kCells;
+
+int64_t Counter::count() const {
+    int64_t count = 0;
+    detail::Shard::forEach([this, &count](detail::Shard const& shard) {
+            count += shard.read(slot_);
+        });
+    return count;
+}
+
+size_t Timer::bucket(uint64_t value) {
+    if (value < kSubBuckets) {
+        return value;
+    }
+    int exponent = std::min(63 - __builtin_clzll(value), kMaxExponent - 1);
+    int shift = exponent - kSubBits + 1;
+    size_t bucket = shift * (kSubBuckets / 2) + (value >> shift);
+    return std::min(bucket, kBuckets - 1);
+}
+
+uint64_t Timer::upperBound(size_t bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    int shift = bucket / (kSubBuckets / 2) - 1;
+    uint64_t sub = bucket - shift * (kSubBuckets / 2);
+    return ((sub + 1) << shift) - 1;
+}
+
+TimerSnapshot Timer::snapshot() const {
+    TimerSnapshot snapshot;
+    snapshot.buckets.resize(kBuckets, 0);
+    detail::Shard::forEach([this, &snapshot](detail::Shard const& shard) {
+            for (size_t i = 0; i < kBuckets; ++i) {
+                int64_t count = shard.read(slot_ + i);
+                snapshot.buckets[i] += count;
+                snapshot.count += count;
+            }
+            snapshot.sum += shard.read(slot_ + kSum);
+            snapshot.max = std::max<uint64_t>(snapshot.max,
+                shard.read(slot_ + kMax));
+        });
+    return snapshot;
+}
+
+uint64_t TimerSnapshot::percentile(double percentile) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(
+        std::ceil(percentile / 100.0 * count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(Timer::upperBound(i), max);
+        }
+    }
+    return max;
+}
+
+template<typename M>
+M* MetricRegistry::get(
+        std::map<std::pair<std::string, Labels>, std::unique_ptr<M>> *map,
+        std::string const& name, Labels const& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& metric = (*map)[std::make_pair(name, labels)];
+    if (!metric) {
+        metric.reset(new M(name, labels, detail::allocateSlots(M::kCells,
+            std::is_same<M, Timer>::value ? Timer::kMax : M::kCells)));
+    }
+    ++metric->refs_;
+    return metric.get();
+}
+
+template<typename M>
+void MetricRegistry::put(
+        std::map<std::pair<std::string, Labels>, std::unique_ptr<M>> *map,
+        M *metric) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map->find(std::make_pair(metric->name(), metric->labels()));
+    if (it == map->end() || it->second.get() != metric ||
+            --metric->refs_ > 0) {
+        return;
+    }
+    detail::releaseSlots(metric->slot_, M::kCells);
+    map->erase(it);
+}
+
+void MetricRegistry::release(Counter *counter) {
+    put(&counters_, counter);
+}
+
+void MetricRegistry::release(Gauge *gauge) {
+    put(&gauges_, gauge);
+}
+
+void MetricRegistry::release(Timer *timer) {
+    put(&timers_, timer);
+}
+
+Counter* MetricRegistry::counter(std::string const& name,
+        Labels const& labels) {
+    return get(&counters_, name, labels);
+}
+
+Gauge* MetricRegistry::gauge(std::string const& name, Labels const& labels) {
+    return get(&gauges_, name, labels);
+}
+
+Timer* MetricRegistry::timer(std::string const& name, Labels const& labels) {
+    return get(&timers_, name, labels);
+}
+
+void MetricRegistry::forEachCounter(
+        std::function<void(Counter const&)> const& fn,
+        NameFilter const& filter) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto const& entry : counters_) {
+        if (!filter || filter(entry.first.first)) {
+            fn(*entry.second);
+        }
+    }
+}
+
+void MetricRegistry::forEachGauge(
+        std::function<void(Gauge const&)> const& fn,
+        NameFilter const& filter) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto const& entry : gauges_) {
+        if (!filter || filter(entry.first.first)) {
+            fn(*entry.second);
+        }
+    }
+}
+
+void MetricRegistry::forEachTimer(
+        std::function<void(Timer const&, TimerSnapshot const&)> const& fn,
+        NameFilter const& filter) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto const& entry : timers_) {
+        if (!filter || filter(entry.first.first)) {
+            fn(*entry.second, entry.second->snapshot());
+        }
+    }
+}
+
+} // topper namespace
@@ -0,0 +1,287 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_METRIC_REGISTRY_H_
+#define SRC_METRIC_REGISTRY_H_
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace topper {
+
+// Label names and values distinguishing metrics that share a name
+typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+namespace detail {
+
+/**
+ * Metric storage for one thread.
+ *
+ * Every metric owns a range of cells at the same offset in each thread's
+ * shard. Only the owning thread writes to its shard, so recording is a
+ * plain load and store; readers merge the shards when metrics are
+ * scraped. Cells are allocated in chunks on first use and never move;
+ * the chunks are found through a two-level table, whose second level is
+ * also allocated on first use, so that a shard costs little until its
+ * thread records to many metrics. When a thread exits, its shard is folded
+ * into a shard of totals left by exited threads, and freed.
+ */
+class Shard {
+public:
+    static const size_t kChunkCells = 4096;
+    static const size_t kDirectoryChunks = 256;
+    static const size_t kMaxChunks = 65536;
+
+    Shard();
+    ~Shard();
+
+    // The calling thread's shard
+    static Shard& local() {
+        static thread_local Shard *shard = nullptr;
+        if (!shard) {
+            shard = create(&shard);
+        }
+        return *shard;
+    }
+
+    // The cells starting at slot; only valid on the owning thread
+    std::atomic<int64_t>* cells(size_t slot) {
+        Chunk *chunk = find(slot / kChunkCells);
+        if (!chunk) {
+            chunk = allocate(slot / kChunkCells);
+        }
+        return &chunk->cells[slot % kChunkCells];
+    }
+
+    // Read a cell from any thread
+    int64_t read(size_t slot) const {
+        Chunk *chunk = find(slot / kChunkCells);
+        return chunk ? chunk->cells[slot % kChunkCells].load(
+            std::memory_order_relaxed) : 0;
+    }
+
+    // Visit every live shard, and the totals of exited threads
+    static void forEach(std::function<void(Shard const&)> const& fn);
+
+    // Zero a range of cells in every shard, so that they can be reused
+    static void clear(size_t slot, size_t cells);
+
+    // Fold an exited thread's shard into the totals, and free it
+    static void retire(Shard *shard);
+private:
+    struct Chunk {
+        Chunk();
+        std::atomic<int64_t> cells[kChunkCells];
+    };
+
+    struct Directory {
+        Directory();
+        std::atomic<Chunk*> chunks[kDirectoryChunks];
+    };
+
+    static const size_t kDirectories = kMaxChunks / kDirectoryChunks;
+
+    // Create the calling thread's shard, which clears the given pointer to
+    // it when the thread exits
+    static Shard* create(Shard **local);
+
+    // A chunk, or null if it hasn't been allocated
+    Chunk* find(size_t chunk) const {
+        Directory *directory = directories_[chunk / kDirectoryChunks].load(
+            std::memory_order_acquire);
+        return directory ? directory->chunks[chunk % kDirectoryChunks].load(
+            std::memory_order_acquire) : nullptr;
+    }
+
+    Chunk* allocate(size_t chunk);
+
+    std::atomic<Directory*> directories_[kDirectories];
+};
+
+// Add to a cell owned by the calling thread
+inline void add(std::atomic<int64_t> *cell, int64_t n) {
+    cell->store(cell->load(std::memory_order_relaxed) + n,
+        std::memory_order_relaxed);
+}
+
+} // detail namespace
+
+class Metric {
+public:
+    Metric(std::string const& name, Labels const& labels, size_t slot)
+        : name_(name), labels_(labels), slot_(slot) { }
+
+    std::string const& name() const { return name_; }
+    Labels const& labels() const { return labels_; }
+protected:
+    const std::string name_;
+    const Labels labels_;
+    const size_t slot_;
+private:
+    friend class MetricRegistry;
+
+    // Lookups not yet released; guarded by the registry
+    size_t refs_ = 0;
+};
+
+/**
+ * A sum that may be adjusted up or down, e.g. a request count. Counts of
+ * things that come and go should use a Gauge.
+ */
+class Counter : public Metric {
+public:
+    using Metric::Metric;
+
+    void increment(int64_t n = 1) {
+        detail::add(detail::Shard::local().cells(slot_), n);
+    }
+
+    void decrement(int64_t n = 1) {
+        increment(-n);
+    }
+
+    // Sum over every thread
+    int64_t count() const;
+
+    static const size_t kCells = 1;
+};
+
+/**
+ * A counter reporting a current level, e.g. the number of open
+ * connections, rather than a running total. Threads may increment and
+ * decrement it independently; only the sum is meaningful.
+ */
+class Gauge : public Counter {
+public:
+    using Counter::Counter;
+};
+
+// Merged state of a timer
+struct TimerSnapshot {
+    uint64_t count = 0;
+    uint64_t sum = 0;       // Nanoseconds
+    uint64_t max = 0;       // Nanoseconds
+    std::vector<uint64_t> buckets;
+
+    double mean() const { return count ? static_cast<double>(sum) / count : 0; }
+
+    // The upper bound of the bucket holding the given percentile
+    uint64_t percentile(double percentile) const;
+};
+
+/**
+ * A latency distribution, recorded in a log-linear histogram with
+ * better than 7% precision. Durations beyond about 18 minutes share the
+ * last bucket.
+ */
+class Timer : public Metric {
+public:
+    using Metric::Metric;
+
+    void update(std::chrono::nanoseconds duration) {
+        int64_t value = duration.count() > 0 ? duration.count() : 0;
+        std::atomic<int64_t> *cells = detail::Shard::local().cells(slot_);
+        detail::add(&cells[bucket(value)], 1);
+        detail::add(&cells[kSum], value);
+        if (value > cells[kMax].load(std::memory_order_relaxed)) {
+            cells[kMax].store(value, std::memory_order_relaxed);
+        }
+    }
+
+    TimerSnapshot snapshot() const;
+
+    // Bucketing; visible for testing
+    static size_t bucket(uint64_t value);
+    static uint64_t upperBound(size_t bucket);
+
+    static const int kSubBits = 5;
+    static const int kMaxExponent = 40;
+    static const size_t kSubBuckets = 1 << kSubBits;
+    static const size_t kBuckets =
+        (kMaxExponent - kSubBits + 1) * (kSubBuckets / 2) + kSubBuckets / 2;
+    static const size_t kSum = kBuckets;
+    static const size_t kMax = kBuckets + 1;
+    static const size_t kCells = kBuckets + 2;
+};
+
+/**
+ * Counters and timers recorded into per-thread shards.
+ *
+ * Creating a metric takes a lock; callers should look metrics up once and
+ * hold on to them. Recording never contends with other threads.
+ */
+class MetricRegistry {
+public:
+    // Selects metrics by name when visiting the registry
+    typedef std::function<bool(std::string const&)> NameFilter;
+
+    MetricRegistry() { }
+
+    // Returns the named metric, creating it if necessary
+    Counter* counter(std::string const& name, Labels const& labels = Labels());
+    Gauge* gauge(std::string const& name, Labels const& labels = Labels());
+    Timer* timer(std::string const& name, Labels const& labels = Labels());
+
+    // Give up a metric returned by a lookup. Once every lookup of it has
+    // been released, the metric is removed, with what it recorded, and its
+    // storage reused; nothing may record to it after that.
+    void release(Counter *counter);
+    void release(Gauge *gauge);
+    void release(Timer *timer);
+
+    // Visit metrics in order of name and labels, skipping those rejected
+    // by the filter. Timers are merged from all threads first.
+    void forEachCounter(std::function<void(Counter const&)> const& fn,
+        NameFilter const& filter = NameFilter()) const;
+    void forEachGauge(std::function<void(Gauge const&)> const& fn,
+        NameFilter const& filter = NameFilter()) const;
+    void forEachTimer(
+        std::function<void(Timer const&, TimerSnapshot const&)> const& fn,
+        NameFilter const& filter = NameFilter()) const;
+private:
+    template<typename M>
+    M* get(std::map<std::pair<std::string, Labels>, std::unique_ptr<M>> *map,
+        std::string const& name, Labels const& labels);
+
+    template<typename M>
+    void put(std::map<std::pair<std::string, Labels>, std::unique_ptr<M>> *map,
+        M *metric);
+
+    mutable std::mutex mutex_;
+    std::map<std::pair<std::string, Labels>, std::unique_ptr<Counter>>
+        counters_;
+    std::map<std::pair<std::string, Labels>, std::unique_ptr<Gauge>> gauges_;
+    std::map<std::pair<std::string, Labels>, std::unique_ptr<Timer>> timers_;
+};
+
+} // topper namespace
+
+#endif // SRC_METRIC_REGISTRY_H_
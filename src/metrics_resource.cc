@@ -22,14 +22,277 @@
 
 #include "metrics_resource.h"
 
-#include "ccmetrics/serializing/json_serializer.h"
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json.h"
 
 namespace topper {
 
+namespace {
+
+void appendKey(std::string *out, Metric const& metric) {
+    out->push_back('"');
+    appendJsonEscaped(out, metric.name());
+    if (!metric.labels().empty()) {
+        out->push_back('{');
+        bool first = true;
+        for (auto const& label : metric.labels()) {
+            if (!first) {
+                out->push_back(',');
+            }
+            first = false;
+            appendJsonEscaped(out, label.first);
+            out->push_back('=');
+            appendJsonEscaped(out, label.second);
+        }
+        out->push_back('}');
+    }
+    out->append("\":");
+}
+
+void appendSeconds(std::string *out, const char *field, double nanos) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%s\":%.9g", field, nanos / 1e9);
+    out->append(buf);
+}
+
+// Prometheus names and label names admit [a-zA-Z_:][a-zA-Z0-9_:]*
+char promChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == ':'
+        ? c : '_';
+}
+
+void appendPromName(std::string *out, std::string const& name) {
+    if (!name.empty() && isdigit(static_cast<unsigned char>(name[0]))) {
+        out->push_back('_');
+    }
+    for (char c : name) {
+        out->push_back(promChar(c));
+    }
+}
+
+bool hasPromPrefix(std::string const& name, std::string const& prefix) {
+    if (prefix.size() > name.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < prefix.size(); ++i) {
+        if (promChar(name[i]) != promChar(prefix[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Appends `{k="v",...}`, with an optional extra label (e.g. `le`)
+void appendPromLabels(std::string *out, Labels const& labels,
+        const char *extraName = nullptr, const char *extraValue = nullptr) {
+    if (labels.empty() && !extraName) {
+        return;
+    }
+    out->push_back('{');
+    bool first = true;
+    for (auto const& label : labels) {
+        if (!first) {
+            out->push_back(',');
+        }
+        first = false;
+        appendPromName(out, label.first);
+        out->append("=\"");
+        for (char c : label.second) {
+            switch (c) {
+            case '\\':
+                out->append("\\\\");
+                break;
+            case '"':
+                out->append("\\\"");
+                break;
+            case '\n':
+                out->append("\\n");
+                break;
+            default:
+                out->push_back(c);
+            }
+        }
+        out->push_back('"');
+    }
+    if (extraName) {
+        if (!first) {
+            out->push_back(',');
+        }
+        out->append(extraName).append("=\"").append(extraValue)
+            .push_back('"');
+    }
+    out->push_back('}');
+}
+
+// Emits the TYPE line when a new metric family starts
+void appendPromType(std::string *out, std::string *family,
+        std::string const& name, const char *suffix, const char *type) {
+    if (*family == name) {
+        return;
+    }
+    *family = name;
+    out->append("# TYPE ");
+    appendPromName(out, name);
+    out->append(suffix).push_back(' ');
+    out->append(type).push_back('\n');
+}
+
+void appendNumber(std::string *out, const char *format, double value) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), format, value);
+    out->append(buf, n);
+}
+
+// Histogram bounds in seconds
+const struct {
+    const char *label;
+    uint64_t nanos;
+} kPromBounds[] = {
+    {"0.0001", 100000}, {"0.00025", 250000}, {"0.0005", 500000},
+    {"0.001", 1000000}, {"0.0025", 2500000}, {"0.005", 5000000},
+    {"0.01", 10000000}, {"0.025", 25000000}, {"0.05", 50000000},
+    {"0.1", 100000000}, {"0.25", 250000000}, {"0.5", 500000000},
+    {"1", 1000000000}, {"2.5", 2500000000}, {"5", 5000000000},
+    {"10", 10000000000},
+};
+
+} // anonymous namespace
+
 Response MetricsResource::get() const {
+    std::string body("{\"counters\":{");
+    bool first = true;
+    auto appendCount = [&body, &first](Counter const& counter) {
+        if (!first) {
+            body.push_back(',');
+        }
+        first = false;
+        appendKey(&body, counter);
+        body.append(std::to_string(counter.count()));
+    };
+    metrics_->forEachCounter(appendCount);
+
+    body.append("},\"gauges\":{");
+    first = true;
+    metrics_->forEachGauge(appendCount);
+
+    body.append("},\"timers\":{");
+    first = true;
+    metrics_->forEachTimer([&body, &first](Timer const& timer,
+            TimerSnapshot const& snapshot) {
+            if (!first) {
+                body.push_back(',');
+            }
+            first = false;
+            appendKey(&body, timer);
+            body.append("{\"count\":");
+            body.append(std::to_string(snapshot.count));
+            body.push_back(',');
+            appendSeconds(&body, "mean", snapshot.mean());
+            body.push_back(',');
+            appendSeconds(&body, "max", snapshot.max);
+            static const struct {
+                const char *name;
+                double percentile;
+            } kPercentiles[] = {
+                {"p50", 50}, {"p75", 75}, {"p95", 95}, {"p99", 99},
+                {"p999", 99.9},
+            };
+            for (auto const& p : kPercentiles) {
+                body.push_back(',');
+                appendSeconds(&body, p.name, snapshot.percentile(p.percentile));
+            }
+            body.push_back('}');
+        });
+    body.append("}}");
+
     return Response(HttpCode::OK, MediaType::APPLICATION_JSON,
-        ccmetrics::Serializer<ccmetrics::JsonSerializer>().serialize(
-            metrics_));
+        std::move(body));
+}
+
+Response PrometheusResource::get(QueryParams const& query) const {
+    const std::vector<std::string> prefixes = query.get("prefix");
+    MetricRegistry::NameFilter filter;
+    if (!prefixes.empty()) {
+        filter = [&prefixes](std::string const& name) -> bool {
+            for (auto const& prefix : prefixes) {
+                if (hasPromPrefix(name, prefix)) {
+                    return true;
+                }
+            }
+            return false;
+        };
+    }
+
+    std::string body;
+    body.reserve(lastSize_.load(std::memory_order_relaxed));
+    std::string family;
+
+    metrics_->forEachCounter([&body, &family](Counter const& counter) {
+            appendPromType(&body, &family, counter.name(), "_total",
+                "counter");
+            appendPromName(&body, counter.name());
+            body.append("_total");
+            appendPromLabels(&body, counter.labels());
+            body.push_back(' ');
+            body.append(std::to_string(counter.count())).push_back('\n');
+        }, filter);
+
+    family.clear();
+    metrics_->forEachGauge([&body, &family](Gauge const& gauge) {
+            appendPromType(&body, &family, gauge.name(), "", "gauge");
+            appendPromName(&body, gauge.name());
+            appendPromLabels(&body, gauge.labels());
+            body.push_back(' ');
+            body.append(std::to_string(gauge.count())).push_back('\n');
+        }, filter);
+
+    family.clear();
+    metrics_->forEachTimer([&body, &family](Timer const& timer,
+            TimerSnapshot const& snapshot) {
+            appendPromType(&body, &family, timer.name(), "_seconds",
+                "histogram");
+
+            // Cumulative counts of the buckets that lie within each bound
+            uint64_t cumulative = 0;
+            size_t bucket = 0;
+            for (auto const& bound : kPromBounds) {
+                while (bucket < snapshot.buckets.size() &&
+                        Timer::upperBound(bucket) <= bound.nanos) {
+                    cumulative += snapshot.buckets[bucket++];
+                }
+                appendPromName(&body, timer.name());
+                body.append("_seconds_bucket");
+                appendPromLabels(&body, timer.labels(), "le", bound.label);
+                body.push_back(' ');
+                body.append(std::to_string(cumulative)).push_back('\n');
+            }
+            appendPromName(&body, timer.name());
+            body.append("_seconds_bucket");
+            appendPromLabels(&body, timer.labels(), "le", "+Inf");
+            body.push_back(' ');
+            body.append(std::to_string(snapshot.count)).push_back('\n');
+
+            appendPromName(&body, timer.name());
+            body.append("_seconds_sum");
+            appendPromLabels(&body, timer.labels());
+            body.push_back(' ');
+            appendNumber(&body, "%.9g", snapshot.sum / 1e9);
+            body.push_back('\n');
+
+            appendPromName(&body, timer.name());
+            body.append("_seconds_count");
+            appendPromLabels(&body, timer.labels());
+            body.push_back(' ');
+            body.append(std::to_string(snapshot.count)).push_back('\n');
+        }, filter);
+
+    lastSize_.store(body.size() + body.size() / 8, std::memory_order_relaxed);
+    return Response(HttpCode::OK, MediaType::TEXT_PLAIN, std::move(body));
 }
 
 } // topper namespace
@@ -23,19 +23,50 @@
 #ifndef SRC_METRICS_RESOURCE_H_
 #define SRC_METRICS_RESOURCE_H_
 
-#include "resource.h"
+#include <atomic>
 
-#include "ccmetrics/metric_registry.h"
+#include "metric_registry.h"
+#include "parameter.h"
+#include "resource.h"
 
 namespace topper {
 
+/**
+ * Serves the registry as JSON. Counters and gauges map to their value and
+ * timers to a summary in seconds; labeled metrics are keyed as `name{k=v,...}`.
+ */
 class MetricsResource : public Resource {
 public:
-    explicit MetricsResource(ccmetrics::MetricRegistry *metrics)
+    explicit MetricsResource(MetricRegistry *metrics)
         : Resource("/metrics"), metrics_(metrics) { }
     Response get() const;
 private:
-    ccmetrics::MetricRegistry *metrics_;
+    MetricRegistry *metrics_;
+};
+
+/**
+ * Serves the registry in the Prometheus text exposition format.
+ *
+ * Names are converted to Prometheus form by replacing characters other
+ * than `[a-zA-Z0-9_:]` with `_`. Counters gain a `_total` suffix, gauges
+ * keep their name, and timers become histograms in seconds with a fixed
+ * set of `le` bounds, derived from the timer's finer buckets. Labels are
+ * carried over unchanged.
+ *
+ * Any number of `prefix` query parameters restrict the output to metrics
+ * whose converted name starts with one of them, e.g.
+ * `/metrics/prometheus?prefix=topper_resource`; filtered metrics are not
+ * merged or serialized at all.
+ */
+class PrometheusResource : public Resource {
+public:
+    explicit PrometheusResource(MetricRegistry *metrics)
+        : Resource("/metrics/prometheus"), metrics_(metrics) { }
+    Response get(QueryParams const& query) const;
+private:
+    MetricRegistry *metrics_;
+    // Size of the previous scrape, used to size the next buffer
+    mutable std::atomic<size_t> lastSize_{4096};
 };
 
 } // topper namespace
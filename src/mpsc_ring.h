@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_MPSC_RING_H_
+#define SRC_MPSC_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+
+namespace topper {
+
+/**
+ * A bounded queue with any number of producers and a single consumer.
+ *
+ * Each cell carries a sequence number telling producers and the consumer
+ * whose turn it is, so neither side takes a lock: producers claim a cell
+ * with one compare-and-swap on the tail, and the consumer only touches the
+ * cell at its head. Pushing to a full ring fails rather than waiting.
+ */
+template<typename T>
+class MpscRing {
+public:
+    // Capacity is rounded up to a power of two
+    explicit MpscRing(size_t capacity)
+            : mask_(roundUp(capacity) - 1),
+              cells_(new Cell[mask_ + 1]) {
+        for (size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(MpscRing const&) = delete;
+    MpscRing& operator=(MpscRing const&) = delete;
+
+    // Enqueue from any thread; returns false if the ring is full
+    bool push(T const& value) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) -
+                static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The consumer hasn't freed this cell yet
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Dequeue on the consumer thread; returns false if the ring is empty
+    bool pop(T *value) {
+        Cell *cell = &cells_[head_ & mask_];
+        if (cell->sequence.load(std::memory_order_acquire) != head_ + 1) {
+            return false;
+        }
+        *value = cell->value;
+        cell->sequence.store(head_ + mask_ + 1, std::memory_order_release);
+        ++head_;
+        return true;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUp(size_t n) {
+        size_t size = 1;
+        while (size < n) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+
+    // Producers and the consumer on separate cache lines
+    char pad0_[64];
+    std::atomic<size_t> tail_{0};
+    char pad1_[64];
+    size_t head_ = 0;
+};
+
+} // topper namespace
+
+#endif // SRC_MPSC_RING_H_
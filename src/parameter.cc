@@ -20,12 +20,142 @@
  * SOFTWARE.
  */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+
+#include "detail/convert.h"
 #include "parameter.h"
 
 namespace topper {
 
+namespace detail {
+
+ConvertResult fromChars(const char *first, const char *last, double *value) {
+    // strtod accepts leading whitespace, hex floats, infinities and NaNs,
+    // none of which are wanted in a path parameter; restrict the input to
+    // [-]digits[.digits][(e|E)[+|-]digits] before handing it off.
+    const char *p = first;
+    if (p != last && *p == '-') {
+        ++p;
+    }
+    size_t ndigits = 0;
+    for (; p != last && *p >= '0' && *p <= '9'; ++p, ++ndigits) { }
+    if (p != last && *p == '.') {
+        for (++p; p != last && *p >= '0' && *p <= '9'; ++p, ++ndigits) { }
+    }
+    if (ndigits == 0) {
+        return ConvertResult{first, ConvertError::INVALID};
+    }
+    if (p != last && (*p == 'e' || *p == 'E')) {
+        const char *exp = p + 1;
+        if (exp != last && (*exp == '+' || *exp == '-')) {
+            ++exp;
+        }
+        if (exp != last && *exp >= '0' && *exp <= '9') {
+            for (p = exp; p != last && *p >= '0' && *p <= '9'; ++p) { }
+        }
+    }
+
+    // strtod requires a terminated string
+    char buf[64];
+    std::string large;
+    const char *input = buf;
+    size_t len = p - first;
+    if (len < sizeof(buf)) {
+        memcpy(buf, first, len);
+        buf[len] = '\0';
+    } else {
+        large.assign(first, len);
+        input = large.c_str();
+    }
+
+    errno = 0;
+    double val = strtod(input, nullptr);
+    if (errno == ERANGE && std::isinf(val)) {
+        return ConvertResult{p, ConvertError::OUT_OF_RANGE};
+    }
+    *value = val;
+    return ConvertResult{p, ConvertError::NONE};
+}
+
+} // detail namespace
+
+namespace {
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+} // anonymous namespace
+
 StringParam StringParam::parse(std::string const& input) {
-    return StringParam(input);
+    return StringParam(&input);
+}
+
+DoubleParam DoubleParam::parse(std::string const& input, bool *ok) {
+    double val = 0;
+    const char *end = input.data() + input.size();
+    detail::ConvertResult res = detail::fromChars(input.data(), end, &val);
+    if (res.ec != detail::ConvertError::NONE || res.ptr != end) {
+        *ok = false;
+        return DoubleParam(0);
+    }
+    return DoubleParam(val);
+}
+
+BoolParam BoolParam::parse(std::string const& input, bool *ok) {
+    if (input == "true" || input == "1") {
+        return BoolParam(true);
+    } else if (input == "false" || input == "0") {
+        return BoolParam(false);
+    }
+    *ok = false;
+    return BoolParam(false);
+}
+
+UuidParam UuidParam::parse(std::string const& input, bool *ok) {
+    static const size_t kLength = 36;
+    Bytes bytes = {};
+
+    if (input.size() != kLength) {
+        *ok = false;
+        return UuidParam(bytes);
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < kLength; ) {
+        if (i == 8 || i == 13 || i == 18 || i == 23) {
+            if (input[i] != '-') {
+                break;
+            }
+            ++i;
+            continue;
+        }
+        int hi = hexValue(input[i]);
+        int lo = hexValue(input[i + 1]);
+        if (hi < 0 || lo < 0) {
+            break;
+        }
+        bytes[out++] = static_cast<uint8_t>((hi << 4) | lo);
+        i += 2;
+    }
+
+    if (out != bytes.size()) {
+        *ok = false;
+        return UuidParam(Bytes{});
+    }
+    return UuidParam(bytes);
 }
 
 } // topper namespace
@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "rate_limiter.h"
+
+#include <cmath>
+
+namespace topper {
+
+namespace {
+
+int64_t interval(RateLimit const& limit) {
+    return static_cast<int64_t>(std::ceil(1e9 / limit.rate));
+}
+
+size_t sets(size_t capacity) {
+    size_t sets = 1;
+    while (sets * RateLimiter::kWays < capacity) {
+        sets <<= 1;
+    }
+    return sets;
+}
+
+} // anonymous namespace
+
+const size_t RateLimiter::kWays;
+
+TokenBucket::TokenBucket(RateLimit const& limit)
+    : interval_(interval(limit)),
+      tolerance_(interval_ * static_cast<int64_t>(
+          limit.burst > 1 ? limit.burst - 1 : 0)) { }
+
+RateLimiter::RateLimiter(RateLimit const& limit, size_t capacity)
+    : bucket_(limit), mask_(sets(capacity) - 1),
+      slots_(new Slot[sets(capacity) * kWays]) { }
+
+bool RateLimiter::acquire(uint64_t key,
+        std::chrono::steady_clock::time_point time) {
+    int64_t now = TokenBucket::nanos(time);
+    Slot *set = &slots_[(key & mask_) * kWays];
+    for (size_t i = 0; i < kWays; ++i) {
+        if (set[i].key.load(std::memory_order_acquire) == key) {
+            return bucket_.acquire(&set[i].full, now);
+        }
+    }
+
+    // Claim a slot whose bucket has refilled
+    for (size_t i = 0; i < kWays; ++i) {
+        uint64_t current = set[i].key.load(std::memory_order_acquire);
+        if (set[i].full.load(std::memory_order_relaxed) > now) {
+            continue;
+        }
+        if (set[i].key.compare_exchange_strong(current, key,
+                std::memory_order_acq_rel)) {
+            return bucket_.acquire(&set[i].full, now);
+        }
+    }
+    return true;
+}
+
+uint64_t RateLimiter::key(const void *data, size_t size) {
+    // FNV-1a
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+} // topper namespace
@@ -0,0 +1,114 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_RATE_LIMITER_H_
+#define SRC_RATE_LIMITER_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#include "server.h"
+
+namespace topper {
+
+/**
+ * A token bucket, kept as the time at which it will next be full (the
+ * generic cell rate algorithm). Admitting a request advances that time by
+ * one interval; a request that would push it more than a burst into the
+ * future is refused. The state is a single word updated by compare and
+ * swap, so buckets are shared by every event base without locking.
+ */
+class TokenBucket {
+public:
+    explicit TokenBucket(RateLimit const& limit);
+
+    // Take a token; returns false if the bucket is empty
+    bool acquire(std::chrono::steady_clock::time_point now) {
+        return acquire(&full_, nanos(now));
+    }
+private:
+    friend class RateLimiter;
+
+    static int64_t nanos(std::chrono::steady_clock::time_point now) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now.time_since_epoch()).count();
+    }
+
+    bool acquire(std::atomic<int64_t> *full, int64_t now) const {
+        int64_t current = full->load(std::memory_order_relaxed);
+        for (;;) {
+            int64_t start = current > now ? current : now;
+            if (start - now > tolerance_) {
+                return false;
+            }
+            if (full->compare_exchange_weak(current, start + interval_,
+                    std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    const int64_t interval_;    // Nanoseconds per token
+    const int64_t tolerance_;   // Nanoseconds of burst beyond one token
+    std::atomic<int64_t> full_{0};
+};
+
+/**
+ * Token buckets keyed by client.
+ *
+ * Buckets live in a fixed, set-associative table: a key hashes to a set of
+ * kWays slots and takes any of them. Nothing is ever deleted; a bucket that
+ * has refilled is indistinguishable from a new one, so its slot is simply
+ * reclaimed by the next key that needs it. Lookups and updates are
+ * lock-free. When every slot in a set is held by a client that is still
+ * being limited, other clients hashing to that set are admitted untracked.
+ */
+class RateLimiter {
+public:
+    static const size_t kWays = 8;
+
+    // The capacity is rounded up to a power of two number of sets
+    explicit RateLimiter(RateLimit const& limit, size_t capacity = 65536);
+
+    // Take a token from the key's bucket; returns false if it is empty
+    bool acquire(uint64_t key, std::chrono::steady_clock::time_point now);
+
+    // Hash client identifiers into keys; never returns 0
+    static uint64_t key(const void *data, size_t size);
+private:
+    struct Slot {
+        std::atomic<uint64_t> key{0};
+        std::atomic<int64_t> full{0};
+    };
+
+    const TokenBucket bucket_;
+    const size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+} // topper namespace
+
+#endif // SRC_RATE_LIMITER_H_
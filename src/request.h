@@ -36,8 +36,28 @@ enum class HttpMethod {
     PUT,
     POST,
     DELETE,
+    HEAD,
+    OPTIONS,
 };
 
+inline const char* methodName(HttpMethod method) {
+    switch (method) {
+    case HttpMethod::GET:
+        return "GET";
+    case HttpMethod::PUT:
+        return "PUT";
+    case HttpMethod::POST:
+        return "POST";
+    case HttpMethod::DELETE:
+        return "DELETE";
+    case HttpMethod::HEAD:
+        return "HEAD";
+    case HttpMethod::OPTIONS:
+        return "OPTIONS";
+    }
+    return "UNKNOWN";
+}
+
 // Immutable
 class Request {
 public:
@@ -45,13 +65,14 @@ public:
             HttpMethod type,
             std::unordered_multimap<std::string, std::string> &&queryParams,
             std::unordered_multimap<std::string, std::string> &&postParams,
-            std::unordered_map<std::string, std::string> &&headerParams)
+            std::unordered_map<std::string, std::string> &&headerParams,
+            detail::Responder *responder = nullptr)
         : path_(path), type_(type),
           data_({QueryParamsImpl(std::move(queryParams)),
             PostParamsImpl(std::move(postParams)),
             HeaderParamsImpl(std::move(headerParams)), Entity(body)}),
           uriInfo_({data_.queryParams, data_.postParams, data_.headerParams,
-              data_.entity})
+              data_.entity, responder})
     { }
 
     // Returns the request URI path
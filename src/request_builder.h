@@ -29,6 +29,7 @@
 #include "http_parser.h"
 #include "logging.h"
 #include "request.h"
+#include "response.h"
 #include "query_string.h"
 
 namespace topper {
@@ -91,24 +92,48 @@ public:
         return 0;
     }
 
+    static int on_headers_complete(http_parser *parser) {
+        RequestBuilder *b = builder(parser->data);
+        if (b->hstate_ == HeaderState::VALUE) {
+            // Save the final header
+            VLOG(3) << "Header " << b->hname_ << " = " << b->hvalue_;
+            b->headers_[b->hname_] = b->hvalue_;
+            b->hname_.clear();
+            b->hvalue_.clear();
+        }
+        b->hstate_ = HeaderState::INIT;
+        return 0;
+    }
+
     static int on_body(http_parser *parser, const char *at, size_t length) {
         RequestBuilder *b = builder(parser->data);
         b->body_.append(at, length);
         return 0;
     }
 
-    static HttpMethod convertMethod(int method) {
+    // Returns false for methods that are not supported
+    static bool convertMethod(int method, HttpMethod *out) {
         switch(method) {
-        case 0:
-            return HttpMethod::DELETE;
-        case 1:
-            return HttpMethod::GET;
-        case 3:
-            return HttpMethod::POST;
-        case 4:
-            return HttpMethod::PUT;
+        case HTTP_DELETE:
+            *out = HttpMethod::DELETE;
+            return true;
+        case HTTP_GET:
+            *out = HttpMethod::GET;
+            return true;
+        case HTTP_POST:
+            *out = HttpMethod::POST;
+            return true;
+        case HTTP_PUT:
+            *out = HttpMethod::PUT;
+            return true;
+        case HTTP_HEAD:
+            *out = HttpMethod::HEAD;
+            return true;
+        case HTTP_OPTIONS:
+            *out = HttpMethod::OPTIONS;
+            return true;
         default:
-            throw std::runtime_error("Invalid method");
+            return false;
         }
     }
     static std::unordered_multimap<std::string, std::string>
@@ -122,31 +147,70 @@ public:
     }
 
 
-    // Construct a request object (throws)
-    Request build(int method) const {
-        struct http_parser_url parser_url;
-        // XXX return code checking?
+    /**
+     * Validates a completely received request in preparation for build().
+     *
+     * @param[in] parser the parser that received the request
+     * @return OK, or the code of the error response to send
+     */
+    HttpCode validate(http_parser const* parser) {
+        if (parser->http_major != 1) {
+            return HttpCode::VERSION_NOT_SUPPORTED;
+        }
+
+        if (!convertMethod(parser->method, &method_)) {
+            return HttpCode::NOT_IMPLEMENTED;
+        }
+
         int rc = http_parser_parse_url(url_.c_str(), url_.size(),
-            /*isconnect=*/ 0, &parser_url);
+            /*isconnect=*/ 0, &parser_url_);
         if (rc != 0) {
-            throw std::runtime_error("Error parsing url");
+            return HttpCode::BAD_REQUEST;
         }
 
-        std::string path {"/"}; // Default to root
-        if (parser_url.field_set & (1 << UF_PATH)) {
-            path = std::string(&url_[parser_url.field_data[UF_PATH].off],
-                parser_url.field_data[UF_PATH].len);
+        return HttpCode::OK;
+    }
+
+    // The request path, for routing before the request is built. Requires
+    // a successful validate().
+    std::string path() const {
+        if (parser_url_.field_set & (1 << UF_PATH)) {
+            return std::string(&url_[parser_url_.field_data[UF_PATH].off],
+                parser_url_.field_data[UF_PATH].len);
         }
+        return "/"; // Default to root
+    }
+
+    // The request method. Requires a successful validate().
+    HttpMethod method() const { return method_; }
+
+    // A received header, or null
+    std::string const* header(std::string const& name) const {
+        auto it = headers_.find(name);
+        return it != headers_.end() ? &it->second : nullptr;
+    }
+
+    // Make room for a body of the given size ahead of its arrival
+    void reserveBody(size_t size) { body_.reserve(size); }
+
+    // Construct a request object. Requires a successful validate().
+    Request build(detail::Responder *responder) const {
+        return build(path(), responder);
+    }
+
+    // As above, for a path already taken from path()
+    Request build(std::string const& path,
+            detail::Responder *responder) const {
 
         std::unordered_multimap<std::string, std::string> queryParams;
-        if (parser_url.field_set & (1 << UF_QUERY)) {
+        if (parser_url_.field_set & (1 << UF_QUERY)) {
             queryParams = parseQueryParameters(
-                &url_[parser_url.field_data[UF_QUERY].off],
-                parser_url.field_data[UF_QUERY].len);
+                &url_[parser_url_.field_data[UF_QUERY].off],
+                parser_url_.field_data[UF_QUERY].len);
         }
 
         std::unordered_multimap<std::string, std::string> postParams;
-        if (convertMethod(method) == HttpMethod::POST) {
+        if (method_ == HttpMethod::POST) {
             // Same same; assuming application/x-www-form-urlencoded.
             // TODO: support multipart
             postParams = parseQueryParameters(body_.c_str(), body_.size());
@@ -154,9 +218,23 @@ public:
 
         // Sigh. Fix this.
         auto copy = headers_;
-        return Request(path, body_, convertMethod(method),
-            std::move(queryParams), std::move(postParams), std::move(copy));
+        return Request(path, body_, method_, std::move(queryParams),
+            std::move(postParams), std::move(copy), responder);
     }
+
+    // The request target as received, including any query string
+    std::string const& url() const { return url_; }
+
+    // Approximate size of the request line and headers, as received
+    size_t headerBytes() const {
+        size_t size = url_.size() + 16;
+        for (auto const& header : headers_) {
+            size += header.first.size() + header.second.size() + 4;
+        }
+        return size;
+    }
+
+    size_t bodyBytes() const { return body_.size(); }
 private:
     // State for parsing headers. See documentation at
     // https://github.com/joyent/http-parser for discussion.
@@ -176,6 +254,10 @@ private:
 
     // Completed headers
     std::unordered_map<std::string, std::string> headers_;
+
+    // Validated request line
+    HttpMethod method_ = HttpMethod::GET;
+    struct http_parser_url parser_url_;
 };
 
 } // topper namespace
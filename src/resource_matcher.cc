@@ -21,15 +21,21 @@
  */
 
 #include <deque>
+#include <memory>
+#include <mutex>
 #include <set>
-#include <stack>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/optional.hpp>
 
+#include "epoch.h"
 #include "logging.h"
 #include "path_components.h"
 #include "resource_matcher.h"
+#include "response.h"
 
 namespace topper {
 
@@ -43,39 +49,46 @@ bool isVariable(std::string const& component) {
 
 } // anonymous namespace
 
-ResourceMatcher::Node::~Node() {
-    DCHECK(children.empty());
+Route::Route(detail::Methods const& methods, RouteMetrics metrics,
+        RouteOptions const& config)
+        : methods(methods),
+          config(config),
+          metrics(std::move(metrics)),
+          options(Response(HttpCode::OK).header("Allow", methods.allow)),
+          notAllowed(Response(HttpCode::NOT_ALLOWED)
+            .header("Allow", methods.allow)) {
+    if (config.maxInFlight > 0) {
+        bulkhead = std::make_shared<Bulkhead>(config.maxInFlight);
+    }
+    if (config.rateLimit.rate > 0) {
+        rateLimit = std::make_shared<TokenBucket>(config.rateLimit);
+    }
 }
 
-ResourceMatcher::~ResourceMatcher() {
-    clear();
+ResourceMatcher::Node* ResourceMatcher::Builder::own(
+        std::shared_ptr<Node> *node) {
+    if (!*node) {
+        *node = std::make_shared<Node>();
+    } else if (!owned_.count(node->get())) {
+        *node = std::make_shared<Node>(**node);
+    } else {
+        return node->get();
+    }
+    owned_.insert(node->get());
+    return node->get();
 }
 
-void ResourceMatcher::addResource(Resource *resource,
-        detail::Methods const& methods) {
-    DCHECK(resource);
-
-    Node *cur = &head_;
+void ResourceMatcher::Builder::insert(Resource *resource,
+        std::shared_ptr<const Route> const& route) {
+    Node *cur = own(&root_);
 
     for (auto const& component : PathComponents(resource->path())) {
-        bool isvar = isVariable(component);
-
         if (isVariable(component)) {
             // Variable component handling
-            if (!cur->varChild) {
-                cur->varChild = new Node();
-            }
-            cur = cur->varChild;
+            cur = own(&cur->varChild);
             continue;
         }
-        auto match = cur->children.find(component);
-        if (match != cur->children.end()) {
-            cur = match->second;
-        } else {
-            Node *next = new Node();
-            cur->children[component] = next;
-            cur = next;
-        }
+        cur = own(&cur->children[component]);
     }
 
     // If there is already a resource at the terminal node, this is a resource
@@ -86,51 +99,143 @@ void ResourceMatcher::addResource(Resource *resource,
     }
 
     cur->resource = resource;
-    cur->methods = methods;
+    cur->route = route;
+}
+
+bool ResourceMatcher::Builder::remove(Resource *resource) {
+    // Find the resource without copying anything, in case it isn't there
+    std::vector<std::string> components;
+    const Node *found = root_.get();
+    for (auto const& component : PathComponents(resource->path())) {
+        if (!found) {
+            break;
+        }
+        if (isVariable(component)) {
+            found = found->varChild.get();
+        } else {
+            auto match = found->children.find(component);
+            found = match != found->children.end() ? match->second.get()
+                : nullptr;
+        }
+        components.push_back(component);
+    }
+    if (!found || found->resource != resource) {
+        return false;
+    }
 
-    resources_.push_back(resource);
+    // Copy the path down to the resource, then prune the nodes that lead
+    // nowhere without it
+    std::vector<std::pair<Node*, std::string const*>> path;
+    Node *cur = own(&root_);
+    for (auto const& component : components) {
+        path.emplace_back(cur, &component);
+        cur = own(isVariable(component) ? &cur->varChild
+            : &cur->children[component]);
+    }
+    cur->resource = nullptr;
+    cur->route.reset();
+
+    for (auto it = path.rbegin(); it != path.rend() && cur->empty(); ++it) {
+        Node *parent = it->first;
+        if (isVariable(*it->second)) {
+            parent->varChild.reset();
+        } else {
+            parent->children.erase(*it->second);
+        }
+        cur = parent;
+    }
+    return true;
 }
 
-std::vector<Resource *> const& ResourceMatcher::resources() const {
-    return resources_;
+ResourceMatcher::ResourceMatcher()
+    : current_(new Snapshot(std::make_shared<Node>())) { }
+
+ResourceMatcher::~ResourceMatcher() {
+    // Nothing can be matching any more
+    delete current_.load();
+    for (auto const& retired : retired_) {
+        delete retired.first;
+    }
 }
 
-void ResourceMatcher::clear() {
-    // Post-order DFS, deleting nodes as we go
-    struct SearchState {
-        Node *node;
-        Node *parent;
-        bool visited;
-    };
+void ResourceMatcher::addResource(Resource *resource,
+        detail::Methods const& methods, MetricRegistry *metrics,
+        RouteOptions const& options) {
+    addResources({{resource, methods, options}}, metrics);
+}
 
-    std::stack<SearchState> searchStack;
-    searchStack.push({&head_, /*parent=*/ nullptr, /*visited=*/ false});
+void ResourceMatcher::addResources(
+        std::vector<Registration> const& registrations,
+        MetricRegistry *metrics) {
+    std::vector<std::shared_ptr<const Route>> routes;
+    for (auto const& registration : registrations) {
+        DCHECK(registration.resource);
+        routes.push_back(std::make_shared<const Route>(registration.methods,
+            metrics ? RouteMetrics(metrics, registration.resource->path(),
+                registration.methods) : RouteMetrics(),
+            registration.options));
+    }
 
-    while (!searchStack.empty()) {
-        auto cur = searchStack.top();
+    std::lock_guard<std::mutex> lock(mutex_);
+    Builder builder(current_.load()->root);
+    for (size_t i = 0; i < registrations.size(); ++i) {
+        builder.insert(registrations[i].resource, routes[i]);
+    }
+    publish(new Snapshot(builder.root()));
+    for (auto const& registration : registrations) {
+        resources_.push_back(registration.resource);
+    }
+}
 
-        if (!cur.visited) {
-            // We'll come back to this after processing its children
-            searchStack.top().visited = true;
-            for (auto const& tuple : cur.node->children) {
-                searchStack.push({tuple.second, cur.node, /*visited=*/ false});
-            }
-            if (cur.node->varChild) {
-                searchStack.push({cur.node->varChild, cur.node,
-                    /*visited=*/ false});
-            }
-            // Forget about the children
-            cur.node->children.clear();
-            continue;
+bool ResourceMatcher::removeResource(Resource *resource) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Builder builder(current_.load()->root);
+    if (!builder.remove(resource)) {
+        return false;
+    }
+    publish(new Snapshot(builder.root()));
+    for (auto it = resources_.begin(); it != resources_.end(); ++it) {
+        if (*it == resource) {
+            resources_.erase(it);
+            break;
         }
+    }
+    return true;
+}
 
-        searchStack.pop();
+std::vector<Resource *> ResourceMatcher::resources() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resources_;
+}
+
+void ResourceMatcher::publish(Snapshot *snapshot) {
+    const Snapshot *old = current_.exchange(snapshot);
+    retired_.emplace_back(old, Epoch::retire());
+    reclaim();
+}
 
-        // Post-order step; clean up this node
-        if (cur.node != &head_){
-            delete cur.node;
+void ResourceMatcher::reclaim() {
+    auto it = retired_.begin();
+    while (it != retired_.end()) {
+        if (Epoch::reclaimable(it->second)) {
+            delete it->first;
+            it = retired_.erase(it);
+        } else {
+            ++it;
         }
     }
+    retiring_.store(!retired_.empty(), std::memory_order_relaxed);
+}
+
+void ResourceMatcher::collect() {
+    if (!retiring_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // Skipped while a change is being made; the change reclaims what it can
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (lock.owns_lock()) {
+        reclaim();
+    }
 }
 
 boost::optional<Match> ResourceMatcher::match(std::string const& path) const {
@@ -138,12 +243,17 @@ boost::optional<Match> ResourceMatcher::match(std::string const& path) const {
         const Node *cur;
         std::vector<std::string> variables;
         Resource *matched;
-        const detail::Methods *methods;
+        const Route *route;
         bool terminated;
         std::string literals;
     };
 
-    std::deque<SearchState> states = {{&head_, {}, NULL, NULL, false, ""}};
+    // The snapshot stays alive until the guard is released
+    Epoch::Guard guard;
+    const Snapshot *snapshot = current_.load();
+
+    std::deque<SearchState> states = {{snapshot->root.get(), {}, NULL, NULL,
+        false, ""}};
 
     for (auto const& component : PathComponents(path)) {
         // Variable matches add additional search paths
@@ -165,9 +275,9 @@ boost::optional<Match> ResourceMatcher::match(std::string const& path) const {
 
             // A variable child adds a new seach path
             if (state.cur->varChild) {
-                SearchState s = {state.cur->varChild, state.variables,
+                SearchState s = {state.cur->varChild.get(), state.variables,
                     state.cur->varChild->resource,
-                    &state.cur->varChild->methods,
+                    state.cur->varChild->route.get(),
                     false, state.literals + "."};
                 s.variables.push_back(component);
                 add.push_back(s);
@@ -182,7 +292,7 @@ boost::optional<Match> ResourceMatcher::match(std::string const& path) const {
             }
 
             // Move to the matching node
-            state.cur = match->second;
+            state.cur = match->second.get();
 
             // Save literal path
             state.literals += component;
@@ -190,7 +300,7 @@ boost::optional<Match> ResourceMatcher::match(std::string const& path) const {
             if (state.cur->resource) {
                 // Possible match, if this is the last component
                 state.matched = state.cur->resource;
-                state.methods = &state.cur->methods;
+                state.route = state.cur->route.get();
             }
         }
 
@@ -225,7 +335,7 @@ boost::optional<Match> ResourceMatcher::match(std::string const& path) const {
     }
 
     const SearchState *ret = *candidates.begin();
-    return boost::make_optional(Match{ret->matched, *ret->methods,
+    return boost::make_optional(Match{ret->matched, ret->route,
         ret->variables});
 }
 
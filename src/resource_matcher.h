@@ -23,23 +23,83 @@
 #ifndef SRC_RESOURCE_MATCHER_H_
 #define SRC_RESOURCE_MATCHER_H_
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <boost/optional.hpp>
 
+#include "formatted_response.h"
+#include "rate_limiter.h"
 #include "resource.h"
+#include "route_metrics.h"
 #include "server.h"
 
 namespace topper {
 
+// Bounds the number of requests handled at once
+class Bulkhead {
+public:
+    explicit Bulkhead(size_t limit) : limit_(limit) { }
+
+    // Claim a slot; returns false if none is free
+    bool acquire() {
+        if (inFlight_.fetch_add(1, std::memory_order_relaxed) >= limit_) {
+            inFlight_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void release() {
+        inFlight_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    size_t inFlight() const {
+        return inFlight_.load(std::memory_order_relaxed);
+    }
+private:
+    const size_t limit_;
+    std::atomic<size_t> inFlight_{0};
+};
+
+// Per-resource dispatch state, computed once when the resource is added
+struct Route {
+    Route() { }
+    explicit Route(detail::Methods const& methods,
+        RouteMetrics metrics = RouteMetrics(),
+        RouteOptions const& config = RouteOptions());
+
+    detail::Methods methods;
+
+    // Settings given at registration
+    RouteOptions config;
+
+    // Limits concurrent requests, if the resource has a limit
+    std::shared_ptr<Bulkhead> bulkhead;
+
+    // Limits the request rate, if the resource has a limit
+    std::shared_ptr<TokenBucket> rateLimit;
+
+    // Timers and counters for the resource
+    RouteMetrics metrics;
+
+    // Preformatted responses carrying the resource's Allow header
+    FormattedResponse options;
+    FormattedResponse notAllowed;
+};
+
+// The route is owned by the matcher. It stays valid after the resource is
+// removed for as long as the caller remains in a read-side critical section
+// entered before matching (see Epoch).
 struct Match {
     Resource *resource;
-    // TODO: copying this around on every match is wasteful. The methods
-    // are sort of bound to the resource; why can't these be extracted
-    // self-referentially and stored?
-    detail::Methods methods;
+    const Route *route;
     std::vector<std::string> parameters;
 };
 
@@ -64,56 +124,142 @@ struct Match {
  *
  * the former wins, as it matches two template variables.
  *
+ * Resources may be added and removed while other threads match. Each
+ * change builds a new, immutable trie off to the side and publishes it
+ * atomically; matching reads whichever trie is current without taking a
+ * lock, and replaced tries are freed once no thread can still be reading
+ * them (see Epoch). A new trie copies only the nodes on the paths that
+ * changed and shares the rest with the trie it replaces, so routes carry
+ * across changes to other resources along with their metrics and limits.
  */
-// TODO: unregistering resource paths
 class ResourceMatcher {
 public:
-    ResourceMatcher() { }
+    // A resource to add, for adding several at once
+    struct Registration {
+        Resource *resource;
+        detail::Methods methods;
+        RouteOptions options;
+    };
+
+    ResourceMatcher();
     ~ResourceMatcher();
 
     /**
      * Add a resource to the matcher.
      *
      * The caller is responsible for ensuring that the @p resource parameter
-     * remains viable for the lifetime of the matcher.
+     * remains viable until it is removed, and for as long as requests
+     * matched to it are in progress.
      *
      * @param[in]      resource        the resource object
      * @param[in]      methods         the resource methods
+     * @param[in]      metrics         registry for the resource's metrics,
+     *                                 or null to record none
+     * @param[in]      options         settings for the resource
      * @throws         PathException   if the paths collide
      */
-    void addResource(Resource *resource, detail::Methods const& methods);
+    void addResource(Resource *resource, detail::Methods const& methods,
+        MetricRegistry *metrics = nullptr,
+        RouteOptions const& options = RouteOptions());
+
+    /**
+     * Add several resources at once, publishing a single trie; cheaper
+     * than adding them one by one when registering many. Either all of
+     * them are added or, if any paths collide, none.
+     *
+     * @throws         PathException   if the paths collide
+     */
+    void addResources(std::vector<Registration> const& registrations,
+        MetricRegistry *metrics = nullptr);
+
+    /**
+     * Remove a resource from the matcher. Matches already returned for it
+     * remain valid while their callers' critical sections last.
+     *
+     * @return false if the resource was not registered
+     */
+    bool removeResource(Resource *resource);
 
     /** @return a matching resource. */
     boost::optional<Match> match(std::string const& path) const;
 
     /** @return all registered resources. */
-    std::vector<Resource *> const& resources() const;
-private:
-    void clear();
+    std::vector<Resource *> resources() const;
 
+    /**
+     * Free the tries replaced by changes, and the routes only they held,
+     * once no reader can still hold them. Changes free what they can
+     * straight away; readers should call this after leaving a critical
+     * section, so that what they held back is freed without waiting for
+     * the next change. Cheap when nothing is waiting to be freed.
+     */
+    void collect();
+private:
+    // Nodes are immutable once published, and shared between tries
     struct Node {
-        Node() : resource(nullptr), varChild(nullptr) { }
-        Node(Resource *resource, detail::Methods const& methods)
-            : resource(resource), methods(methods) { }
-        ~Node();
-
         // Resource
-        Resource *resource;
+        Resource *resource = nullptr;
 
-        // Invocation methods
-        detail::Methods methods;
+        // Invocation methods & responses
+        std::shared_ptr<const Route> route;
 
         // Non-variable children (literal matches)
-        std::unordered_map<std::string, Node*> children;
+        std::unordered_map<std::string, std::shared_ptr<Node>> children;
 
         // Variable child
-        Node *varChild;
+        std::shared_ptr<Node> varChild;
+
+        // Whether the node leads nowhere
+        bool empty() const {
+            return !resource && children.empty() && !varChild;
+        }
+    };
+
+    // A published trie
+    struct Snapshot {
+        explicit Snapshot(std::shared_ptr<Node> const& root) : root(root) { }
+
+        std::shared_ptr<Node> root;
+    };
+
+    // Derives a new trie from a published one. Nodes on changed paths are
+    // copied the first time they are reached, and modified in place after
+    // that, so a batch of changes copies each node at most once.
+    class Builder {
+    public:
+        explicit Builder(std::shared_ptr<Node> const& root) : root_(root) { }
+
+        void insert(Resource *resource,
+            std::shared_ptr<const Route> const& route); // throws
+        bool remove(Resource *resource);
+
+        std::shared_ptr<Node> const& root() const { return root_; }
+    private:
+        // A private copy of the node, made on first use
+        Node* own(std::shared_ptr<Node> *node);
+
+        std::shared_ptr<Node> root_;
+        std::unordered_set<const Node*> owned_;
     };
 
-    Node head_;
+    // Make a trie current and retire the one it replaces; called with
+    // mutex_ held
+    void publish(Snapshot *snapshot);
 
-    // TODO: provide resource iterator interface to avoid this duplicate array
+    // Free retired snapshots that no thread is reading; called with mutex_
+    // held
+    void reclaim();
+
+    std::atomic<const Snapshot*> current_;
+
+    // Serializes changes. Registered resources are kept in the order they
+    // were added.
+    mutable std::mutex mutex_;
     std::vector<Resource *> resources_;
+    std::vector<std::pair<const Snapshot*, uint64_t>> retired_;
+
+    // Whether retired_ is non-empty, for checking without the lock
+    std::atomic<bool> retiring_{false};
 };
 
 } // topper namespace
@@ -20,9 +20,10 @@
  * SOFTWARE.
  */
 
-#include <sstream>
 #include <string>
+#include <utility>
 
+#include "formatted_response.h"
 #include "response.h"
 
 namespace topper {
@@ -51,14 +52,28 @@ std::string reasonPhrase(HttpCode code) {
         return "OK";
     case HttpCode::CREATED:
         return "Created";
+    case HttpCode::BAD_REQUEST:
+        return "Bad Request";
     case HttpCode::FORBIDDEN:
         return "Forbidden";
     case HttpCode::NOT_FOUND:
         return "Not Found";
     case HttpCode::NOT_ALLOWED:
         return "Method Not Allowed";
+    case HttpCode::REQUEST_TIMEOUT:
+        return "Request Timeout";
+    case HttpCode::TOO_MANY_REQUESTS:
+        return "Too Many Requests";
     case HttpCode::INTERNAL_ERROR:
         return "Internal Server Error";
+    case HttpCode::NOT_IMPLEMENTED:
+        return "Not Implemented";
+    case HttpCode::SERVICE_UNAVAILABLE:
+        return "Service Unavailable";
+    case HttpCode::GATEWAY_TIMEOUT:
+        return "Gateway Timeout";
+    case HttpCode::VERSION_NOT_SUPPORTED:
+        return "HTTP Version Not Supported";
     }
 }
 
@@ -72,30 +87,106 @@ Response::Response(HttpCode code, MediaType type, std::string const& content)
           type_(type),
           content_(content) { }
 
-std::string Response::to_string() const {
+Response::Response(HttpCode code, MediaType type, std::string&& content)
+        : code_(code),
+          type_(type),
+          content_(std::move(content)) { }
+
+Response& Response::header(std::string const& name,
+        std::string const& value) {
+    headers_.push_back(std::make_pair(name, value));
+    return *this;
+}
+
+std::string Response::to_string(bool includeBody, bool keepAlive) const {
     static const std::string kCrlf("\r\n");
     static const std::string kVersion("HTTP/1.1");
-    std::stringstream response;
+
+    // Size the buffer up front so that the body is copied once
+    size_t size = 128 + (includeBody ? content_.size() : 0);
+    for (auto const& header : headers_) {
+        size += header.first.size() + header.second.size() + 4;
+    }
+    std::string response;
+    response.reserve(size);
 
     // Status line
-    response << kVersion << " " << codeToInt(code_) << " "
-             << reasonPhrase(code_) << kCrlf;
+    response.append(kVersion).append(" ")
+            .append(std::to_string(codeToInt(code_))).append(" ")
+            .append(reasonPhrase(code_)).append(kCrlf);
 
     // Headers
-    response << "Content-Length: " << content_.size() << kCrlf
-             << "Connection: close" << kCrlf
-             << "Content-Type: " << mediaTypeToString(type_) << kCrlf << kCrlf;
+    response.append("Content-Length: ")
+            .append(std::to_string(content_.size())).append(kCrlf)
+            .append("Connection: ")
+            .append(keepAlive ? "keep-alive" : "close").append(kCrlf)
+            .append("Content-Type: ").append(mediaTypeToString(type_))
+            .append(kCrlf);
+    for (auto const& header : headers_) {
+        response.append(header.first).append(": ").append(header.second)
+                .append(kCrlf);
+    }
+    response.append(kCrlf);
 
     // Body
-    response << content_;
+    if (includeBody) {
+        response.append(content_);
+    }
+
+    return response;
+}
+
+std::string const& Response::preformatted(HttpCode code, bool keepAlive) {
+    switch (code) {
+    case HttpCode::BAD_REQUEST: {
+        static const FormattedResponse kResponse(badRequest());
+        return kResponse.get(keepAlive);
+    }
+    case HttpCode::NOT_FOUND: {
+        static const FormattedResponse kResponse(notFound());
+        return kResponse.get(keepAlive);
+    }
+    case HttpCode::NOT_ALLOWED: {
+        static const FormattedResponse kResponse(notAllowed());
+        return kResponse.get(keepAlive);
+    }
+    case HttpCode::REQUEST_TIMEOUT: {
+        static const FormattedResponse kResponse(
+            Response(HttpCode::REQUEST_TIMEOUT));
+        return kResponse.get(keepAlive);
+    }
+    case HttpCode::NOT_IMPLEMENTED: {
+        static const FormattedResponse kResponse(
+            Response(HttpCode::NOT_IMPLEMENTED));
+        return kResponse.get(keepAlive);
+    }
+    case HttpCode::VERSION_NOT_SUPPORTED: {
+        static const FormattedResponse kResponse(
+            Response(HttpCode::VERSION_NOT_SUPPORTED));
+        return kResponse.get(keepAlive);
+    }
+    default: {
+        static const FormattedResponse kResponse(
+            Response(HttpCode::INTERNAL_ERROR));
+        return kResponse.get(keepAlive);
+    }
+    }
+}
 
-    return response.str();
+Response Response::badRequest() {
+    return Response(HttpCode::BAD_REQUEST);
 }
 
 Response Response::notAllowed() {
     return Response(HttpCode::NOT_ALLOWED);
 }
 
+Response Response::deferredResponse() {
+    Response resp(HttpCode::OK);
+    resp.deferred_ = true;
+    return resp;
+}
+
 Response Response::notFound() {
     return Response(HttpCode::NOT_FOUND);
 }
@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <utility>
+
+#include "route_metrics.h"
+
+namespace topper {
+
+RouteMetrics::RouteMetrics(MetricRegistry *registry,
+        std::string const& path, detail::Methods const& methods)
+        : registry_(registry) {
+    struct {
+        HttpMethod method;
+        detail::Method const& bound;
+        const char *name;
+    } verbs[] = {
+        {HttpMethod::GET, methods.get, "GET"},
+        {HttpMethod::PUT, methods.put, "PUT"},
+        {HttpMethod::POST, methods.post, "POST"},
+        {HttpMethod::DELETE, methods.del, "DELETE"},
+        {HttpMethod::HEAD, methods.head, "HEAD"},
+    };
+    for (auto const& verb : verbs) {
+        if (verb.bound) {
+            timers_[static_cast<int>(verb.method)] =
+                registry->timer("topper.resource.latency",
+                    {{"resource", path}, {"method", verb.name}});
+        }
+    }
+
+    for (int i = 0; i < kStatusClasses; ++i) {
+        statuses_[i] = registry->counter("topper.resource.responses",
+            {{"resource", path}, {"status", std::to_string(i + 1) + "xx"}});
+    }
+}
+
+RouteMetrics::RouteMetrics(RouteMetrics&& other) {
+    *this = std::move(other);
+}
+
+RouteMetrics& RouteMetrics::operator=(RouteMetrics&& other) {
+    if (this != &other) {
+        release();
+        registry_ = other.registry_;
+        std::copy(other.timers_, other.timers_ + kMethods, timers_);
+        std::copy(other.statuses_, other.statuses_ + kStatusClasses,
+            statuses_);
+        other.registry_ = nullptr;
+        std::fill(other.timers_, other.timers_ + kMethods, nullptr);
+        std::fill(other.statuses_, other.statuses_ + kStatusClasses, nullptr);
+    }
+    return *this;
+}
+
+RouteMetrics::~RouteMetrics() {
+    release();
+}
+
+void RouteMetrics::release() {
+    if (!registry_) {
+        return;
+    }
+    for (Timer *&timer : timers_) {
+        if (timer) {
+            registry_->release(timer);
+            timer = nullptr;
+        }
+    }
+    for (Counter *&counter : statuses_) {
+        registry_->release(counter);
+        counter = nullptr;
+    }
+    registry_ = nullptr;
+}
+
+} // topper namespace
@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_ROUTE_METRICS_H_
+#define SRC_ROUTE_METRICS_H_
+
+#include <chrono>
+#include <string>
+
+#include "detail/server-impl.h"
+#include "metric_registry.h"
+#include "request.h"
+#include "response.h"
+
+namespace topper {
+
+/**
+ * Metrics for one resource, resolved from the registry when the resource
+ * is registered so that recording a request needs no lookups.
+ *
+ * Handler latency is recorded per verb in `topper.resource.latency`, and
+ * responses are counted by status class in `topper.resource.responses`.
+ * Both are labeled with the resource path; the labels `method` and
+ * `status` (`2xx` etc.) distinguish the verbs and classes. The metrics are
+ * released to the registry when this is destroyed, so a resource that is
+ * removed stops being reported once no request can be recording to it.
+ */
+class RouteMetrics {
+public:
+    // Records nothing
+    RouteMetrics() { }
+
+    RouteMetrics(MetricRegistry *registry, std::string const& path,
+        detail::Methods const& methods);
+
+    RouteMetrics(RouteMetrics&& other);
+    RouteMetrics& operator=(RouteMetrics&& other);
+    ~RouteMetrics();
+
+    RouteMetrics(RouteMetrics const&) = delete;
+    RouteMetrics& operator=(RouteMetrics const&) = delete;
+
+    // Record the handler latency for a request to a bound verb
+    void time(HttpMethod method, std::chrono::nanoseconds elapsed) const {
+        Timer *timer = timers_[static_cast<int>(method)];
+        if (timer) {
+            timer->update(elapsed);
+        }
+    }
+
+    // Count a response sent for this resource
+    void count(HttpCode code) const {
+        Counter *counter = statuses_[statusClass(code)];
+        if (counter) {
+            counter->increment();
+        }
+    }
+
+    // Index of the 1xx - 5xx counter for a response code
+    static int statusClass(HttpCode code) {
+        int cls = static_cast<int>(code) / 100 - 1;
+        return cls >= 0 && cls < kStatusClasses ? cls : kStatusClasses - 1;
+    }
+
+    static const int kMethods = static_cast<int>(HttpMethod::OPTIONS) + 1;
+    static const int kStatusClasses = 5;
+private:
+    void release();
+
+    MetricRegistry *registry_ = nullptr;
+    Timer *timers_[kMethods] = {};
+    Counter *statuses_[kStatusClasses] = {};
+};
+
+} // topper namespace
+
+#endif // SRC_ROUTE_METRICS_H_
@@ -20,32 +20,34 @@
  * SOFTWARE.
  */
 
-#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <atomic>
+#include <chrono>
 #include <exception>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <unordered_map>
 
-#include "ccmetrics/detail/define_once.h"
-#include "ccmetrics/metric_registry.h"
-#include "ccmetrics/timer.h"
-
 #include "wte/event_base.h"
 
 #include "logging.h"
 #include "metrics_resource.h"
+#include "current_base.h"
+#include "listener.h"
 #include "server.h"
+#include "server_impl.h"
 #include "server_instance.h"
+#include "trace_resource.h"
 
 namespace topper {
 
 namespace {
-bool validateAddr(std::string const& ipaddr) {
-    struct in_addr tmp;
-    return inet_aton(ipaddr.c_str(), &tmp) == 1;
-}
 
 class PingResource : public Resource {
 public:
@@ -55,81 +57,103 @@ public:
     }
 };
 
+// The write end of the pipe that wakes the server stopping on a signal
+std::atomic<int> signalPipe(-1);
+
+void onSignal(int) {
+    int saved = errno;
+    int fd = signalPipe.load();
+    if (fd >= 0) {
+        char stop = 's';
+        ssize_t ret = write(fd, &stop, 1);
+        (void) ret;
+    }
+    errno = saved;
+}
+
+} // unnamed namespace
+
+namespace {
+
+ServerOptions adminOptions(mode_t unixSocketMode) {
+    ServerOptions options;
+    options.unixSocketMode = unixSocketMode;
+    return options;
+}
+
+} // anonymous namespace
+
 struct AdminServer {
     AdminServer(std::string const& ipaddr, short port,
-                ccmetrics::MetricRegistry *metrics)
-            : server(ipaddr, port, metrics),
-              server_metrics(metrics) {
+                MetricRegistry *metrics, Tracer *tracer,
+                mode_t unixSocketMode)
+            : server(ipaddr, port, &own_metrics, /*tracer=*/ nullptr,
+                  adminOptions(unixSocketMode)),
+              server_metrics(metrics),
+              prometheus_metrics(metrics),
+              traces(tracer) {
         server.registerResource(&ping, detail::bindMethods(&ping));
         server.registerResource(&server_metrics,
             detail::bindMethods(&server_metrics));
+        server.registerResource(&prometheus_metrics,
+            detail::bindMethods(&prometheus_metrics));
+        server.registerResource(&traces, detail::bindMethods(&traces));
     }
+    // The admin server's own traffic is kept apart from the application's
+    // metrics and traces, which it reports
+    MetricRegistry own_metrics;
     ServerInstance server;
     PingResource ping;
     MetricsResource server_metrics;
-};
-} // unnamed namespace
-
-class ServerImpl {
-public:
-    ServerImpl(std::string const& ip_addr, short port)
-        : listener_base_(wte::mkEventBase()),
-          application_(ip_addr, port, &metrics_) { }
-
-    ~ServerImpl() {
-        if (started_) {
-            stopAndWait();
-        }
-        delete listener_base_;
-    }
-
-    void start();
-    void stopAndWait();
-    void wait();
-    void startAdminServer(std::string const& ipaddr, short port);
-
-    void registerResource(Resource *resource, detail::Methods const& methods) {
-        application_.registerResource(resource, methods);
-    }
-private:
-    bool started_ = false;
-    bool shutdown_ = false;
-    wte::EventBase *listener_base_ = nullptr;
-
-    std::vector<wte::EventBase*> bases_;
-    std::vector<std::thread*> base_threads_;
-    // TODO: worker pool for compute-intensive or blocking requests
-
-    std::thread main_;
-
-    // Metrics
-    ccmetrics::MetricRegistry metrics_;
-
-    ServerInstance application_;
-    AdminServer *admin_server_ = nullptr;
+    PrometheusResource prometheus_metrics;
+    TraceResource traces;
 };
 
 void ServerImpl::start() {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
     if (started_) {
         throw std::logic_error("Server has already been started");
     }
 
     // Bring up the worker bases
-    const int kBases = 4;
     for (int i = 0; i < kBases; ++i) {
         wte::EventBase *base = wte::mkEventBase();
         std::thread *base_thread = new std::thread([base]() {
+                setCurrentEventBase(base);
                 base->loop(wte::EventBase::LoopMode::FOREVER);
             });
         bases_.push_back(base);
         base_threads_.push_back(base_thread);
     }
 
+    // Take over the listening sockets of a previous process, if any. It
+    // keeps serving them unless told that this one has started.
+    ListenerFds inherited = activatedListeners();
+    if (inherited.application.empty() && !upgrade_socket_.empty()) {
+        inherited = receiveListeners(upgrade_socket_);
+    }
+    try {
+        startServing(inherited);
+    } catch (...) {
+        if (inherited.sender >= 0) {
+            close(inherited.sender);
+        }
+        throw;
+    }
+    if (inherited.sender >= 0) {
+        acknowledgeListeners(inherited.sender);
+    }
+}
+
+void ServerImpl::startServing(ListenerFds const& inherited) {
     // Bring up application server
-    application_.start(listener_base_, bases_);
+    application_.start(listener_base_, bases_, inherited.application);
 
     // Ok we're off
-    started_ = true;
+    {
+        std::lock_guard<std::mutex> state(state_mutex_);
+        started_ = true;
+    }
 
     main_ = std::thread([this]() {
             listener_base_->loop(wte::EventBase::LoopMode::FOREVER);
@@ -137,27 +161,193 @@ void ServerImpl::start() {
 
     // Wait for the loop to start running by running a nop.
     listener_base_->runOnEventLoopAndWait([]() -> void { }, /*defer=*/ true);
+
+    admin_fds_ = inherited.admin;
+    if (admin_server_) {
+        startAdmin();
+    }
+
+    // Watch every base for saturation
+    monitor_.monitor(listener_base_, "listener");
+    for (size_t i = 0; i < bases_.size(); ++i) {
+        monitor_.monitor(bases_[i], std::to_string(i));
+    }
+
+    // Stand ready to hand over to the next process
+    if (!upgrade_socket_.empty()) {
+        upgrade_.reset(new UpgradeServer(upgrade_socket_,
+            [this]() { return listeners(); },
+            [this]() {
+                {
+                    // The next process serves any Unix socket paths now
+                    std::lock_guard<std::mutex> lock(stop_mutex_);
+                    application_.handOff();
+                    if (admin_server_) {
+                        admin_server_->server.handOff();
+                    }
+                }
+                try {
+                    stopAndWait();
+                } catch (std::logic_error const&) {
+                    // Never started
+                }
+            }));
+    }
+}
+
+ListenerFds ServerImpl::listeners() {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
+    ListenerFds fds;
+    if (shutdown_) {
+        return fds;
+    }
+    std::vector<int> admin = admin_fds_;
+    if (admin_server_) {
+        std::vector<int> bound = admin_server_->server.listenFds();
+        admin.insert(admin.end(), bound.begin(), bound.end());
+    }
+    for (int fd : application_.listenFds()) {
+        fds.application.push_back(fcntl(fd, F_DUPFD_CLOEXEC, 0));
+    }
+    for (int fd : admin) {
+        fds.admin.push_back(fcntl(fd, F_DUPFD_CLOEXEC, 0));
+    }
+    return fds;
 }
 
 void ServerImpl::startAdminServer(std::string const& ipaddr, short port) {
+    if (!Listener::valid(ipaddr)) {
+        throw std::invalid_argument("Invalid address " + ipaddr);
+    }
+
+    std::lock_guard<std::mutex> lock(stop_mutex_);
     if (admin_server_) {
         throw std::logic_error("Admin server has already been started");
     }
 
-    admin_server_ = new AdminServer(ipaddr, port, &metrics_);
-    listener_base_->runOnEventLoop([this]() -> void {
-            admin_server_->server.start(listener_base_, bases_);
+    admin_server_ = new AdminServer(ipaddr, port, &metrics_, &tracer_,
+        unix_socket_mode_);
+    if (started_) {
+        startAdmin();
+    }
+}
+
+void ServerImpl::startAdmin() {
+    // Any inherited sockets are the admin server's to keep
+    std::vector<int> fds;
+    fds.swap(admin_fds_);
+    std::exception_ptr error;
+    listener_base_->runOnEventLoopAndWait([this, fds, &error]() -> void {
+            try {
+                admin_server_->server.start(listener_base_, bases_, fds);
+            } catch (...) {
+                error = std::current_exception();
+            }
         });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ServerImpl::addListener(std::string const& address, short port) {
+    if (!Listener::valid(address)) {
+        throw std::invalid_argument("Invalid address " + address);
+    }
+
+    std::lock_guard<std::mutex> lock(stop_mutex_);
+    if (started_) {
+        throw std::logic_error(
+            "Listeners must be added before the server starts");
+    }
+    application_.addAddress(address, port);
+}
+
+void ServerImpl::enableSlowLog(SlowLogOptions const& options) {
+    if (started_) {
+        throw std::logic_error(
+            "The slow log must be enabled before the server starts");
+    }
+    slow_log_.reset(new SlowLog(options, &metrics_));
+    application_.setSlowLog(slow_log_.get());
 }
 
 void ServerImpl::wait() {
+    std::unique_lock<std::mutex> lock(state_mutex_);
     if (!started_) {
         return;
     }
-    main_.join();
+    stopped_.wait(lock, [this]() { return shutdown_; });
+}
+
+void ServerImpl::stopOnSignal(int signal) {
+    if (signal_thread_.joinable()) {
+        throw std::logic_error("The server already stops on a signal");
+    }
+    if (pipe2(signal_pipe_, O_CLOEXEC) != 0) {
+        throw std::runtime_error(std::string("pipe: ") + strerror(errno));
+    }
+    int unused = -1;
+    if (!signalPipe.compare_exchange_strong(unused, signal_pipe_[1])) {
+        close(signal_pipe_[0]);
+        close(signal_pipe_[1]);
+        throw std::logic_error("Another server stops on signals");
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(signal, &action, &previous_);
+    signal_ = signal;
+
+    signal_thread_ = std::thread([this]() {
+            char c = 0;
+            ssize_t n;
+            do {
+                n = read(signal_pipe_[0], &c, 1);
+            } while (n < 0 && errno == EINTR);
+            if (n == 1 && c == 's') {
+                LOG(INFO) << "Stopping on signal " << signal_;
+                try {
+                    stopAndWait();
+                } catch (std::logic_error const&) {
+                    // Never started
+                }
+            }
+        });
+}
+
+void ServerImpl::releaseSignal() {
+    if (!signal_thread_.joinable()) {
+        return;
+    }
+    sigaction(signal_, &previous_, nullptr);
+    signalPipe.store(-1);
+    char quit = 'q';
+    ssize_t ret = write(signal_pipe_[1], &quit, 1);
+    (void) ret;
+    signal_thread_.join();
+    close(signal_pipe_[0]);
+    close(signal_pipe_[1]);
+}
+
+void ServerImpl::drain() {
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + drain_timeout_;
+    draining_->increment();
+    application_.drain();
+    while (application_.connections() > 0 &&
+            std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    abandoned_->increment(application_.connections());
+    drain_time_->update(std::chrono::steady_clock::now() - start);
+    draining_->decrement();
 }
 
 void ServerImpl::stopAndWait() {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
     if (!started_) {
         throw std::logic_error("Server was not started");
     }
@@ -167,6 +357,9 @@ void ServerImpl::stopAndWait() {
         return;
     }
 
+    // Let in-flight requests finish while the admin server reports progress
+    drain();
+
     listener_base_->runOnEventLoopAndWait([this]() -> void {
             application_.stop();
             if (admin_server_) {
@@ -176,6 +369,7 @@ void ServerImpl::stopAndWait() {
             }
         });
 
+    monitor_.stop();
     listener_base_->stop();
     for (wte::EventBase *base : bases_) {
         base->stop();
@@ -190,14 +384,19 @@ void ServerImpl::stopAndWait() {
     base_threads_.clear();
 
     main_.join();
-    shutdown_ = true;
+    {
+        std::lock_guard<std::mutex> state(state_mutex_);
+        shutdown_ = true;
+    }
+    stopped_.notify_all();
 }
 
-Server::Server(std::string const& ipaddr, short port) : internal_(nullptr) {
-    if (!validateAddr(ipaddr)) {
+Server::Server(std::string const& ipaddr, short port,
+        ServerOptions const& options) : internal_(nullptr) {
+    if (!Listener::valid(ipaddr)) {
         throw std::invalid_argument("Invalid address " + ipaddr);
     }
-    internal_ = new ServerImpl(ipaddr, port);
+    internal_ = new ServerImpl(ipaddr, port, options);
 }
 
 Server::~Server() {
@@ -212,6 +411,10 @@ void Server::stopAndWait() {
     internal_->stopAndWait();
 }
 
+void Server::stopOnSignal(int signal) {
+    internal_->stopOnSignal(signal);
+}
+
 void Server::wait() {
     internal_->wait();
 }
@@ -220,6 +423,18 @@ void Server::startAdminServer(std::string const& ipaddr, short port) {
     internal_->startAdminServer(ipaddr, port);
 }
 
+void Server::addListener(std::string const& address, short port) {
+    internal_->addListener(address, port);
+}
+
+bool Server::unregisterResource(Resource *resource) {
+    return internal_->unregisterResource(resource);
+}
+
+void Server::enableSlowLog(SlowLogOptions const& options) {
+    internal_->enableSlowLog(options);
+}
+
 //
 // Registration helper
 //
@@ -227,8 +442,8 @@ void Server::startAdminServer(std::string const& ipaddr, short port) {
 namespace detail {
 
 void doRegister(ServerImpl *server, Resource *resource,
-        Methods const& methods) {
-    server->registerResource(resource, methods);
+        Methods const& methods, RouteOptions const& options) {
+    server->registerResource(resource, methods, options);
 }
 
 } // detail namespace
@@ -0,0 +1,163 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_SERVER_IMPL_H_
+#define SRC_SERVER_IMPL_H_
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wte/event_base.h"
+
+#include "loop_monitor.h"
+#include "metric_registry.h"
+#include "server_instance.h"
+#include "slow_log.h"
+#include "tracer.h"
+#include "upgrade.h"
+
+namespace topper {
+
+struct AdminServer;
+
+class ServerImpl {
+public:
+    ServerImpl(std::string const& ip_addr, short port,
+            ServerOptions const& options)
+        : listener_base_(wte::mkEventBase()),
+          tracer_(kBases),
+          monitor_(&metrics_),
+          application_(ip_addr, port, &metrics_, &tracer_, options),
+          drain_timeout_(options.drainTimeout),
+          draining_(metrics_.gauge("topper.drain.draining")),
+          abandoned_(metrics_.counter("topper.drain.abandoned")),
+          drain_time_(metrics_.timer("topper.drain.duration")),
+          upgrade_socket_(options.upgradeSocket),
+          unix_socket_mode_(options.unixSocketMode) { }
+
+    ~ServerImpl() {
+        releaseSignal();
+        upgrade_.reset();
+        if (started_) {
+            stopAndWait();
+        }
+        for (int fd : admin_fds_) {
+            close(fd);
+        }
+        delete listener_base_;
+    }
+
+    void start();
+    void stopAndWait();
+    void stopOnSignal(int signal);
+    void wait();
+    void startAdminServer(std::string const& ipaddr, short port);
+    void addListener(std::string const& address, short port);
+
+    void registerResource(Resource *resource, detail::Methods const& methods,
+            RouteOptions const& options) {
+        application_.registerResource(resource, methods, options);
+    }
+
+    bool unregisterResource(Resource *resource) {
+        return application_.unregisterResource(resource);
+    }
+
+    void enableSlowLog(SlowLogOptions const& options);
+
+    // The request handling bases; empty unless the server is running
+    std::vector<wte::EventBase*> const& bases() const { return bases_; }
+
+    static const int kBases = 4;
+private:
+    // Wait for the application server's connections to close
+    void drain();
+    void releaseSignal();
+
+    // The rest of start(), given the sockets taken over from elsewhere;
+    // called with stop_mutex_ held
+    void startServing(ListenerFds const& inherited);
+
+    // Listening sockets for the next process in a hot upgrade
+    ListenerFds listeners();
+
+    // Start the admin server on the running listener base; throws if it
+    // can't listen. Called with stop_mutex_ held.
+    void startAdmin();
+
+    // Serializes starting and stopping; shutdown_ is also guarded by
+    // state_mutex_, for wait()
+    std::mutex stop_mutex_;
+    std::mutex state_mutex_;
+    std::condition_variable stopped_;
+    bool started_ = false;
+    bool shutdown_ = false;
+    wte::EventBase *listener_base_ = nullptr;
+
+    std::vector<wte::EventBase*> bases_;
+    std::vector<std::thread*> base_threads_;
+    // TODO: worker pool for compute-intensive or blocking requests
+
+    std::thread main_;
+
+    // Metrics
+    MetricRegistry metrics_;
+    Tracer tracer_;
+    std::unique_ptr<SlowLog> slow_log_;
+    LoopMonitor monitor_;
+
+    ServerInstance application_;
+    AdminServer *admin_server_ = nullptr;
+
+    // Draining
+    const std::chrono::milliseconds drain_timeout_;
+    Gauge *draining_;
+    Counter *abandoned_;
+    Timer *drain_time_;
+
+    // Hot upgrades; the admin server's inherited sockets are kept until the
+    // admin server starts
+    const std::string upgrade_socket_;
+    std::vector<int> admin_fds_;
+
+    // Permissions for the admin server's Unix sockets
+    const mode_t unix_socket_mode_;
+    std::unique_ptr<UpgradeServer> upgrade_;
+
+    // Stopping on a signal
+    int signal_ = 0;
+    int signal_pipe_[2] = {-1, -1};
+    struct sigaction previous_;
+    std::thread signal_thread_;
+};
+
+} // topper namespace
+
+#endif // SRC_SERVER_IMPL_H_
@@ -22,39 +22,150 @@
 
 #include "server_instance.h"
 
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
 #include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
 
 namespace topper {
 
+void ServerInstance::stopAccepting() {
+    {
+        std::lock_guard<std::mutex> lock(listenMutex_);
+        listenFds_.clear();
+    }
+    for (Listener *listener : listeners_) {
+        listener->stopAccepting();
+        if (!handedOff_.load(std::memory_order_relaxed)) {
+            listener->removePath();
+        }
+        delete listener;
+    }
+    listeners_.clear();
+}
+
 void ServerInstance::stop() {
-    if (!listener_) {
+    stopAccepting();
+    for (size_t i = 0; i < timers_.size(); ++i) {
+        Timers *timers = timers_[i].get();
+        Handoff *handoff = handoffs_[i].get();
+        bases_[i]->runOnEventLoopAndWait([this, i, timers, handoff]() {
+                timers->stop();
+                handoff->stop();
+                closeAll(i);
+            });
+    }
+}
+
+void ServerInstance::drain() {
+    if (!listenerBase_) {
         return;
     }
 
-    listener_->stopAccepting();
+    listenerBase_->runOnEventLoopAndWait([this]() { stopAccepting(); });
+    draining_.store(true, std::memory_order_relaxed);
 
-    delete listener_;
-    listener_ = nullptr;
+    // Connections accepted before this point have been listed by now
+    for (size_t i = 0; i < bases_.size(); ++i) {
+        bases_[i]->runOnEventLoopAndWait([this, i]() { closeIdle(i); });
+    }
+}
+
+void ServerInstance::closeIdle(size_t index) {
+    // Connections already accepted are served like any other
+    handoffs_[index]->adoptAll();
+
+    RequestContext *ctx = open_[index];
+    while (ctx) {
+        RequestContext *next = ctx->nextOpen;
+        if (idle(ctx) && ctx->served) {
+            counters_.idleClosed->increment();
+            delete ctx;
+        }
+        ctx = next;
+    }
+}
+
+void ServerInstance::closeAll(size_t index) {
+    handoffs_[index]->discard();
+
+    // Abandoned requests are cancelled, and their contexts detached from
+    // any asynchronous completion
+    while (RequestContext *ctx = open_[index]) {
+        if (ctx->cancelled) {
+            ctx->cancelled->store(true, std::memory_order_relaxed);
+        }
+        delete ctx;
+    }
 }
 
 void ServerInstance::start(wte::EventBase *listener_base,
-        std::vector<wte::EventBase*> const& handlers) {
-    if (listener_) {
+        std::vector<wte::EventBase*> const& handlers,
+        std::vector<int> const& listenFds) {
+    if (!listeners_.empty()) {
         throw std::logic_error("Server has already been started");
     }
 
+    listenerBase_ = listener_base;
     bases_ = handlers;
-    listener_ = wte::mkConnectionListener(listener_base,
-        std::bind(&ServerInstance::acceptCb, this, std::placeholders::_1),
-        std::bind(&ServerInstance::listenErrorCb, this, std::placeholders::_1));
+    open_.assign(bases_.size(), nullptr);
+    for (size_t i = 0; i < bases_.size(); ++i) {
+        counters_.active.push_back(metrics_->gauge(
+            "topper.connections.active", {{"base", std::to_string(i)}}));
+        timers_.emplace_back(new Timers(bases_[i]));
+        handoffs_.emplace_back(new Handoff(this, i));
+        Handoff *handoff = handoffs_.back().get();
+        bases_[i]->runOnEventLoopAndWait([handoff]() { handoff->start(); });
+    }
 
-    listener_->bind(ipaddr_, port_);
-    listener_->listen(128);
-    listener_->startAccepting();
+    std::vector<int> fds = listenFds;
+    if (fds.empty()) {
+        try {
+            for (auto const& address : addresses_) {
+                fds.push_back(Listener::bind(address.first, address.second,
+                    options_));
+            }
+        } catch (...) {
+            for (int fd : fds) {
+                close(fd);
+            }
+            throw;
+        }
+    } else {
+        // Inherited sockets take this server's settings
+        for (int fd : fds) {
+            Listener::listen(fd, options_);
+        }
+    }
+    for (int fd : fds) {
+        listeners_.push_back(new Listener(listener_base, fd,
+            std::bind(&ServerInstance::acceptCb, this,
+                std::placeholders::_1),
+            std::bind(&ServerInstance::flushCb, this)));
+    }
+    {
+        std::lock_guard<std::mutex> lock(listenMutex_);
+        listenFds_ = fds;
+    }
+    for (Listener *listener : listeners_) {
+        listener->startAccepting();
+    }
 
     // Ok we're off
-    printf("Started server on %s port %hu\n", ipaddr_.c_str(),
-        listener_->port());
+    for (Listener *listener : listeners_) {
+        printf("Started server on %s\n", listener->address().c_str());
+    }
     printf("The following resource paths are registered:\n\n");
     for (Resource *resource : matcher().resources()) {
         printf("    %s\n", resource->path().c_str());
@@ -62,65 +173,457 @@ void ServerInstance::start(wte::EventBase *listener_base,
     printf("\n");
 }
 
-void ServerInstance::listenErrorCb(std::exception const& e) {
-    LOG(INFO) << e.what();
-}
-
-wte::EventBase* ServerInstance::chooseBase() {
+size_t ServerInstance::chooseBase() {
     // Simply round-robin for the moment
     static std::atomic<int> iter(0);
-    return bases_[++iter % bases_.size()];
+    return ++iter % bases_.size();
 }
 
 void ServerInstance::acceptCb(int fd) {
-    wte::EventBase *base = chooseBase();
+    auto accepted = std::chrono::steady_clock::now();
+    counters_.accepted->increment();
+    if (options_.maxConnections > 0 && connections_.load(
+            std::memory_order_relaxed) >= options_.maxConnections) {
+        // Refuse without touching an event base; the response fits in the
+        // socket buffer, and if it doesn't the client just sees the close
+        counters_.rejectedConnections->increment();
+        std::string const& response = overloaded_.get(/*keepAlive=*/ false);
+        ssize_t ret = send(fd, response.data(), response.size(),
+            MSG_DONTWAIT | MSG_NOSIGNAL);
+        (void) ret;
+        close(fd);
+        return;
+    }
+    connections_.fetch_add(1, std::memory_order_relaxed);
+
+    // Queue the connection for its base, which builds its context
+    size_t index = chooseBase();
+    if (!handoffs_[index]->push(fd, accepted)) {
+        bases_[index]->runOnEventLoop([this, fd, index, accepted]() {
+                adopt(fd, index, accepted);
+            });
+    }
+}
+
+void ServerInstance::flushCb() {
+    for (auto& handoff : handoffs_) {
+        handoff->flush();
+    }
+}
 
+void ServerInstance::adopt(int fd, size_t index,
+        std::chrono::steady_clock::time_point accepted) {
     // Released on error or completion
-    auto *ctx = new RequestContext(this, base, fd);
+    auto *ctx = new RequestContext(this, bases_[index], fd, index);
+    if (clients_) {
+        ctx->peer = peerKey(fd);
+    }
+
+    ctx->waiting = std::chrono::steady_clock::now();
+    ctx->handoff = ctx->waiting - accepted;
+    counters_.accept->update(ctx->handoff);
+    list(ctx);
+    ctx->stream->startRead(&ctx->rcb);
+    expect(ctx, Waiting::IDLE);
+}
+
+ServerInstance::Handoff::Handoff(ServerInstance *server, size_t index)
+        : server_(server), index_(index), ring_(/*capacity=*/ 1024) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    }
+    setFd(fd);
+}
+
+ServerInstance::Handoff::~Handoff() {
+    discard();
+    close(fd());
+}
+
+bool ServerInstance::Handoff::push(int fd,
+        std::chrono::steady_clock::time_point accepted) {
+    if (!ring_.push(Accepted{fd, accepted})) {
+        return false;
+    }
+    pending_ = true;
+    return true;
+}
+
+void ServerInstance::Handoff::flush() {
+    if (!pending_) {
+        return;
+    }
+    pending_ = false;
+    uint64_t one = 1;
+    ssize_t ret = write(fd(), &one, sizeof(one));
+    (void) ret;
+}
+
+void ServerInstance::Handoff::start() {
+    if (!started_) {
+        server_->bases_[index_]->registerHandler(this, wte::What::READ);
+        started_ = true;
+    }
+}
+
+void ServerInstance::Handoff::stop() {
+    if (started_) {
+        server_->bases_[index_]->unregisterHandler(this);
+        started_ = false;
+    }
+}
+
+void ServerInstance::Handoff::discard() {
+    Accepted next;
+    while (ring_.pop(&next)) {
+        close(next.fd);
+        server_->connections_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void ServerInstance::Handoff::ready(wte::What) noexcept {
+    uint64_t count;
+    ssize_t ret = read(fd(), &count, sizeof(count));
+    (void) ret;
+    adoptAll();
+}
+
+void ServerInstance::Handoff::adoptAll() {
+    Accepted next;
+    while (ring_.pop(&next)) {
+        server_->adopt(next.fd, index_, next.accepted);
+    }
+}
 
-    // Queue asynchronous reading
-    base->runOnEventLoop([ctx]() { ctx->stream->startRead(&ctx->rcb); });
+void ServerInstance::Timers::schedule(TimerWheel::Entry *entry,
+        std::chrono::steady_clock::time_point deadline) {
+    wheel_.schedule(entry, deadline);
+    arm();
+}
+
+void ServerInstance::Timers::stop() {
+    if (armed_) {
+        base_->unregisterTimeout(this);
+        armed_ = false;
+    }
+    stopped_ = true;
+}
+
+void ServerInstance::Timers::expired() noexcept {
+    armed_ = false;
+    wheel_.advance(std::chrono::steady_clock::now());
+    if (wheel_.size() > 0) {
+        arm();
+    }
+}
+
+void ServerInstance::Timers::arm() {
+    // Ticks only while something is scheduled
+    if (!armed_ && !stopped_) {
+        struct timeval tv;
+        tv.tv_sec = wheel_.resolution().count() / 1000;
+        tv.tv_usec = (wheel_.resolution().count() % 1000) * 1000;
+        base_->registerTimeout(this, &tv);
+        armed_ = true;
+    }
+}
+
+void ServerInstance::Timeout::expired() {
+    RequestContext *ctx = ctx_;
+    if (waiting == Waiting::HANDLER) {
+        // The first completion wins, so the handler's own response will be
+        // dropped; the flag tells it to stop working on one
+        ctx->server->counters_.deadlinesExceeded->increment();
+        if (ctx->cancelled) {
+            ctx->cancelled->store(true, std::memory_order_relaxed);
+        }
+        std::shared_ptr<detail::AsyncState> state = ctx->async.lock();
+        if (state) {
+            state->complete(Response(HttpCode::GATEWAY_TIMEOUT));
+        }
+        return;
+    }
+
+    ctx->server->counters_.timeouts[static_cast<size_t>(waiting)]
+        ->increment();
+    switch (waiting) {
+    case Waiting::HEADERS:
+    case Waiting::BODY:
+        // Tell the client, and stop listening to it
+        VLOG(1) << "Timed out receiving a request";
+        respondAndClose(ctx, Response::preformatted(
+            HttpCode::REQUEST_TIMEOUT));
+        break;
+    case Waiting::IDLE:
+    case Waiting::WRITE:
+        delete ctx;
+        break;
+    case Waiting::HANDLER:
+        break;
+    }
+}
+
+uint64_t ServerInstance::peerKey(int fd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&addr),
+            &len) != 0) {
+        return 0;
+    }
+    // Only the address identifies the client, not the port
+    switch (addr.ss_family) {
+    case AF_INET: {
+        auto *in = reinterpret_cast<struct sockaddr_in*>(&addr);
+        return RateLimiter::key(&in->sin_addr, sizeof(in->sin_addr));
+    }
+    case AF_INET6: {
+        auto *in6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            // An IPv4 client of a dual-stack listener
+            return RateLimiter::key(&in6->sin6_addr.s6_addr[12],
+                sizeof(struct in_addr));
+        }
+        return RateLimiter::key(&in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+    default:
+        return RateLimiter::key(&addr, len);
+    }
+}
+
+ServerInstance::AsyncCompletion::~AsyncCompletion() {
+    if (!done_.load()) {
+        complete(Response(HttpCode::INTERNAL_ERROR, MediaType::TEXT_PLAIN,
+            "Request was not completed"));
+    }
+}
+
+void ServerInstance::AsyncCompletion::complete(Response const& response) {
+    if (done_.exchange(true)) {
+        return;
+    }
+    // Always queued, so that completion from within the handler doesn't
+    // write before dispatch has returned
+    std::shared_ptr<AsyncLink> link = link_;
+    std::lock_guard<std::mutex> lock(link->mutex);
+    if (!link->ctx) {
+        // The connection is gone; nobody is left to respond to
+        return;
+    }
+    link->ctx->base->runOnEventLoop([link, response]() {
+            // Only detached on this base, so no lock is needed to read it
+            RequestContext *ctx = link->ctx;
+            if (ctx) {
+                completeAsync(ctx, response);
+            }
+        }, /*defer=*/ true);
 }
 
 void ServerInstance::WriteCallback::complete(wte::Stream *s) {
     DCHECK(ctx_->stream == s); // XXX this parameter is apparently silly
-    // TODO: support keepalives
-    delete ctx_;
+    auto now = std::chrono::steady_clock::now();
+    TimerWheel::cancel(&ctx_->timeout);
+    release(ctx_);
+    Counters& counters = ctx_->server->counters_;
+    counters.write->update(now - ctx_->writeStart);
+    counters.bytesWritten->increment(ctx_->writing);
+    if (ctx_->route) {
+        inspect(ctx_, now);
+    }
+    if (!ctx_->keepAlive) {
+        delete ctx_;
+        return;
+    }
+
+    // Serve any requests that were pipelined behind this one
+    RequestContext *ctx = ctx_;
+    ctx->reset(now);
+    std::string backlog;
+    backlog.swap(ctx->backlog);
+    feed(ctx, backlog.data(), backlog.size());
+    if (ctx->throttled && ctx->backlog.empty()) {
+        ctx->throttled = false;
+        ctx->stream->startRead(&ctx->rcb);
+    }
+    if (ctx->eof && !ctx->responded && !ctx->pending) {
+        // The client is done sending requests
+        delete ctx;
+        return;
+    }
+    if (idle(ctx)) {
+        if (ctx->server->draining_.load(std::memory_order_relaxed)) {
+            delete ctx;
+            return;
+        }
+        expect(ctx, Waiting::IDLE);
+    }
 }
 
 void ServerInstance::WriteCallback::error(std::runtime_error const& e) {
     LOG(INFO) << "While writing: " << e.what();
+    ctx_->server->counters_.writeErrors->increment();
     delete ctx_;
 }
 
 void ServerInstance::ReadCallback::error(std::runtime_error const& e) {
     LOG(INFO) << "While reading: " << e.what();
+    ctx_->server->counters_.readErrors->increment();
+    if (ctx_->pending) {
+        // Released by the asynchronous completion
+        ctx_->closed = true;
+        if (ctx_->cancelled) {
+            ctx_->cancelled->store(true, std::memory_order_relaxed);
+        }
+        ctx_->stream->stopRead();
+        return;
+    }
     delete ctx_;
 }
 
+namespace {
+
+// The code of the response to send for a request the parser rejected
+HttpCode parseErrorCode(http_parser const* parser) {
+    switch (HTTP_PARSER_ERRNO(parser)) {
+    case HPE_INVALID_VERSION:
+        return HttpCode::VERSION_NOT_SUPPORTED;
+    case HPE_INVALID_METHOD:
+        return HttpCode::NOT_IMPLEMENTED;
+    default:
+        return HttpCode::BAD_REQUEST;
+    }
+}
+
+} // anonymous namespace
+
 void ServerInstance::ReadCallback::eof() {
-    int rc = http_parser_execute(&ctx_->parser, &ctx_->settings, nullptr, 0);
-    if (rc != 0) {
-        LOG(INFO) << "Error on eof";
+    ctx_->eof = true;
+    if (ctx_->responded || ctx_->pending) {
+        // Released when the response has been written
+        return;
+    }
+
+    http_parser_execute(&ctx_->parser, &ctx_->settings, nullptr, 0);
+    if (!ctx_->responded) {
+        // The client went away without sending a complete request;
+        // there is nobody to respond to
         delete ctx_;
     }
 }
 
+void ServerInstance::backlog(RequestContext *ctx, const char *data,
+        size_t size) {
+    // Bounds the memory held for clients that pipeline aggressively
+    static const size_t kMaxBacklog = 64 * 1024;
+
+    ctx->backlog.append(data, size);
+    if (ctx->backlog.size() >= kMaxBacklog && !ctx->throttled) {
+        ctx->throttled = true;
+        ctx->stream->stopRead();
+    }
+}
+
+void ServerInstance::feed(RequestContext *ctx, const char *data,
+        size_t size) {
+    if (ctx->responded || ctx->pending) {
+        if (ctx->keepAlive) {
+            backlog(ctx, data, size);
+        }
+        // Otherwise discard anything sent after the request
+        return;
+    }
+    if (size == 0) {
+        return;
+    }
+
+    ctx->parseStart = std::chrono::steady_clock::now();
+    if (ctx->awaiting) {
+        ctx->awaiting = false;
+        ctx->firstByte = ctx->parseStart;
+        ctx->server->counters_.firstByte->update(
+            ctx->parseStart - ctx->waiting);
+        expect(ctx, Waiting::HEADERS);
+    }
+
+    size_t parsed = http_parser_execute(&ctx->parser, &ctx->settings, data,
+        size);
+    if (!ctx->responded && !ctx->pending) {
+        // Mid-request; the remainder is timed when it arrives
+        ctx->parsing += std::chrono::steady_clock::now() - ctx->parseStart;
+    }
+    if (ctx->responded || ctx->pending) {
+        // Parsing stopped at the end of a request
+        if (ctx->keepAlive) {
+            backlog(ctx, data + parsed, size - parsed);
+        }
+    } else if (parsed != size) {
+        VLOG(1) << "Parsed " << parsed << " bytes of " << size
+            << ": " << http_errno_name(HTTP_PARSER_ERRNO(&ctx->parser));
+        ctx->server->counters_.parseErrors->increment();
+        respondAndClose(ctx, Response::preformatted(
+            parseErrorCode(&ctx->parser)));
+    }
+}
+
+void ServerInstance::fillTrace(RequestContext *ctx,
+        std::chrono::steady_clock::time_point written, Trace *trace) {
+    auto nanos = [](std::chrono::steady_clock::duration d) -> int64_t {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            d).count();
+    };
+
+    snprintf(trace->path, sizeof(trace->path), "%s",
+        ctx->builder.url().c_str());
+    snprintf(trace->resource, sizeof(trace->resource), "%s",
+        ctx->resource->path().c_str());
+    trace->method = ctx->method;
+    trace->status = ctx->status;
+    trace->base = ctx->index;
+    trace->timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    trace->phases[Trace::ACCEPT] = ctx->handoff.count();
+    trace->phases[Trace::READ] = nanos(ctx->firstByte - ctx->waiting);
+    trace->phases[Trace::PARSE] = nanos(ctx->parsed - ctx->firstByte);
+    trace->phases[Trace::MATCH] = nanos(ctx->dispatched - ctx->parsed);
+    trace->phases[Trace::DISPATCH] = nanos(ctx->handled - ctx->dispatched);
+    trace->phases[Trace::SERIALIZE] = nanos(ctx->writeStart - ctx->handled);
+    trace->phases[Trace::WRITE] = nanos(written - ctx->writeStart);
+}
+
+void ServerInstance::inspect(RequestContext *ctx,
+        std::chrono::steady_clock::time_point written) {
+    if (ctx->traced) {
+        ctx->traced = false;
+        Trace trace;
+        fillTrace(ctx, written, &trace);
+        ctx->ring->push(trace);
+    }
+
+    SlowLog *log = ctx->server->slowLog_;
+    if (log && written - ctx->firstByte > log->threshold(ctx->route->config)) {
+        SlowRequest slow;
+        fillTrace(ctx, written, &slow.trace);
+        slow.thread = std::this_thread::get_id();
+        slow.headerBytes = ctx->builder.headerBytes();
+        slow.bodyBytes = ctx->builder.bodyBytes();
+        log->log(slow);
+    }
+
+    // Later requests on the connection were not delayed by the accept
+    ctx->handoff = std::chrono::nanoseconds(0);
+}
+
 void ServerInstance::ReadCallback::available(wte::Buffer *buffer) {
+    Counters& counters = ctx_->server->counters_;
     std::vector<wte::Extent> extents;
     size_t drain = 0;
     buffer->peek(-1, &extents);
     for (auto& extent : extents) {
-        size_t parsed = http_parser_execute(&ctx_->parser, &ctx_->settings,
-            extent.data, extent.size);
-        if (parsed != extent.size) {
-            LOG(INFO) << "Parsed " << parsed << " bytes of " << extent.size;
-            delete ctx_;
-            return;
-        }
-        drain += parsed;
+        feed(ctx_, extent.data, extent.size);
+        drain += extent.size;
     }
     buffer->drain(drain);
+    counters.bytesRead->increment(drain);
 }
 
 } // topper namespace
@@ -23,36 +23,67 @@
 #ifndef SRC_SERVER_INSTANCE_H_
 #define SRC_SERVER_INSTANCE_H_
 
+#include <limits.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
-#include "ccmetrics/detail/define_once.h"
-#include "ccmetrics/metric_registry.h"
-#include "ccmetrics/timer.h"
-
-#include "wte/connection_listener.h"
 #include "wte/event_base.h"
 #include "wte/event_handler.h"
 #include "wte/stream.h"
 
+#include "async_response.h"
+#include "epoch.h"
+#include "formatted_response.h"
 #include "http_parser.h"
+#include "listener.h"
+#include "metric_registry.h"
+#include "mpsc_ring.h"
+#include "rate_limiter.h"
 #include "resource.h"
 #include "resource_matcher.h"
 #include "response.h"
 #include "request.h"
 #include "request_builder.h"
+#include "slow_log.h"
+#include "timer_wheel.h"
+#include "tracer.h"
 
 namespace topper {
 
 class ServerInstance {
 public:
+    // Requests are traced only if given a tracer
     ServerInstance(std::string const& ipaddr, short port,
-            ccmetrics::MetricRegistry *metrics)
-        : ipaddr_(ipaddr), port_(port), metrics_(metrics) { }
+            MetricRegistry *metrics, Tracer *tracer,
+            ServerOptions const& options = ServerOptions())
+        : addresses_{{ipaddr, port}}, options_(options),
+          overloaded_(Response(HttpCode::SERVICE_UNAVAILABLE)
+              .header("Retry-After",
+                  std::to_string(options.retryAfter.count()))),
+          inFlight_(options.maxInFlight > 0
+              ? new Bulkhead(options.maxInFlight) : nullptr),
+          limited_(Response(HttpCode::TOO_MANY_REQUESTS)
+              .header("Retry-After",
+                  std::to_string(options.retryAfter.count()))),
+          clients_(options.clientRateLimit.rate > 0
+              ? new RateLimiter(options.clientRateLimit) : nullptr),
+          timeouts_{options.idleTimeout, options.headerTimeout,
+              options.bodyTimeout, options.writeTimeout},
+          metrics_(metrics), counters_(metrics), tracer_(tracer) { }
 
     ~ServerInstance() {
-        delete listener_;
+        for (Listener *listener : listeners_) {
+            delete listener;
+        }
     }
 
     struct RequestContext;
@@ -75,10 +106,122 @@ public:
         RequestContext *ctx_ = nullptr;
     };
 
+    // Links an asynchronous request's completion state to its context.
+    // Closing the context detaches it, on the context's base; completions
+    // queue their response on the base while holding the lock, so once a
+    // context is detached nothing can reach it or its base any more.
+    struct AsyncLink {
+        explicit AsyncLink(RequestContext *ctx) : ctx(ctx) { }
+
+        std::mutex mutex;
+        RequestContext *ctx;    // Null once detached
+    };
+
+    // Completion state for a request dispatched to an asynchronous handler.
+    // The response is written from the connection's event base, or dropped
+    // if the connection has been closed. If the state is released without
+    // completion, the request fails with a 500.
+    class AsyncCompletion final : public detail::AsyncState {
+    public:
+        explicit AsyncCompletion(std::shared_ptr<AsyncLink> const& link)
+            : link_(link) { }
+        ~AsyncCompletion();
+        void complete(Response const& response) override;
+    private:
+        std::shared_ptr<AsyncLink> link_;
+        std::atomic<bool> done_{false};
+    };
+
+    // The timer wheel of one event base, and the OS timer that advances it
+    // while any entries are scheduled
+    class Timers final : public wte::TimeoutHandler {
+    public:
+        explicit Timers(wte::EventBase *base) : base_(base) { }
+
+        // Runs on the base
+        void schedule(TimerWheel::Entry *entry,
+            std::chrono::steady_clock::time_point deadline);
+        void stop();
+
+        void expired() noexcept override;
+    private:
+        void arm();
+
+        wte::EventBase *base_;
+        TimerWheel wheel_;
+        bool armed_ = false;
+        bool stopped_ = false;
+    };
+
+    // Accepted connections on their way from the listener to one base. The
+    // listener queues a batch of them in a ring and signals the base once;
+    // the base then builds their contexts itself.
+    class Handoff final : public wte::EventHandler {
+    public:
+        Handoff(ServerInstance *server, size_t index); // throws
+        ~Handoff();
+
+        // Run on the listener base. push() fails if the ring is full;
+        // flush() wakes the base if anything was pushed since the last one.
+        bool push(int fd, std::chrono::steady_clock::time_point accepted);
+        void flush();
+
+        // Run on the base. adoptAll() takes on every queued connection;
+        // discard() closes them instead, when the base is shutting down.
+        void start();
+        void stop();
+        void adoptAll();
+        void discard();
+
+        void ready(wte::What event) noexcept override;
+    private:
+        struct Accepted {
+            int fd;
+            std::chrono::steady_clock::time_point accepted;
+        };
+
+        ServerInstance *server_;
+        const size_t index_;
+        MpscRing<Accepted> ring_;
+        bool pending_ = false;
+        bool started_ = false;
+    };
+
+    // What a connection is waiting for when its timeout is armed
+    enum class Waiting {
+        IDLE,       // The next request
+        HEADERS,    // The rest of the request headers
+        BODY,       // The rest of the request body
+        WRITE,      // The response to be written
+        HANDLER,    // An asynchronous handler, until the route's deadline
+    };
+
+    class Timeout final : public TimerWheel::Entry {
+    public:
+        explicit Timeout(RequestContext *ctx) : ctx_(ctx) { }
+        void expired() override;
+
+        Waiting waiting = Waiting::IDLE;
+    private:
+        RequestContext *ctx_ = nullptr;
+    };
+
     // Context used for receiving a request
-    struct RequestContext {
-        RequestContext(ServerInstance *server, wte::EventBase *base, int sock)
-                : server(server), wcb(this), rcb(this) {
+    struct RequestContext final : public detail::Responder {
+        RequestContext(ServerInstance *server, wte::EventBase *base, int sock,
+                size_t index = 0)
+                : server(server), base(base), index(index),
+                  ring(server->tracer_ ? server->tracer_->ring(index)
+                      : nullptr),
+                  active(index < server->counters_.active.size()
+                      ? server->counters_.active[index] : nullptr),
+                  timers(index < server->timers_.size()
+                      ? server->timers_[index].get() : nullptr),
+                  timeout(this), wcb(this), rcb(this) {
+            if (active) {
+                active->increment();
+            }
+
             // TODO: dispatch to one of N bases
             stream = wte::wrapFd(base, sock);
 
@@ -87,6 +230,7 @@ public:
             settings.on_url = RequestBuilder::on_url;
             settings.on_header_field = RequestBuilder::on_header_field;
             settings.on_header_value = RequestBuilder::on_header_value;
+            settings.on_headers_complete = headers_complete;
             settings.on_body = RequestBuilder::on_body;
             settings.on_message_complete = message_complete;
             http_parser_init(&parser, HTTP_REQUEST);
@@ -94,101 +238,733 @@ public:
         }
 
         ~RequestContext() {
+            if (link) {
+                std::lock_guard<std::mutex> lock(link->mutex);
+                link->ctx = nullptr;
+            }
+            forget(this);
             stream->stopRead();
             stream->close();
             delete stream;
+            release(this);
+            pin.leave();
+            server->matcher_.collect();
+            server->connections_.fetch_sub(1, std::memory_order_relaxed);
+            if (active) {
+                active->decrement();
+            }
+        }
+
+        Deadline deadline() override {
+            if (!cancelled) {
+                cancelled = std::make_shared<std::atomic<bool>>(false);
+            }
+            return Deadline(expires, cancelled);
+        }
+
+        AsyncResponse defer() override {
+            std::shared_ptr<detail::AsyncState> state = async.lock();
+            if (!state) {
+                link = std::make_shared<AsyncLink>(this);
+                state = std::make_shared<AsyncCompletion>(link);
+                async = state;
+                pending = true;
+            }
+            return AsyncResponse(state);
+        }
+
+        // Prepare for the next request on a persistent connection
+        void reset(std::chrono::steady_clock::time_point now) {
+            builder = RequestBuilder();
+            responded = false;
+            head = false;
+            http_parser_pause(&parser, 0);
+            resource = nullptr;
+            route = nullptr;
+            pin.leave();
+            server->matcher_.collect();
+            expires = std::chrono::steady_clock::time_point::max();
+            cancelled.reset();
+            awaiting = true;
+            waiting = now;
+            served = true;
         }
 
         http_parser parser;
         http_parser_settings settings;
         RequestBuilder builder;
         ServerInstance *server;
+        wte::EventBase *base;
         wte::Stream *stream;
 
+        // The base's index in the server, and its trace ring if the server
+        // traces requests
+        size_t index;
+        TraceRing *ring;
+
+        // Open connections on this context's base
+        Gauge *active;
+
+        // The base's timer wheel, and this connection's timeout
+        Timers *timers;
+        Timeout timeout;
+
+        // Links in the base's list of open connections
+        bool listed = false;
+        RequestContext *prevOpen = nullptr;
+        RequestContext *nextOpen = nullptr;
+
+        // Set once a response has been written
+        bool responded = false;
+
+        // Set once a request on the connection has been answered
+        bool served = false;
+
+        // Whether the connection persists after the current response
+        bool keepAlive = false;
+
+        // Set once the client has closed its end of the connection
+        bool eof = false;
+
+        // Pipelined input received while a response was outstanding.
+        // Reading stops while the backlog is full.
+        std::string backlog;
+        bool throttled = false;
+
+        // Asynchronous completion state. While a request is pending, the
+        // context is released by the completion rather than by read errors.
+        std::weak_ptr<detail::AsyncState> async;
+        std::shared_ptr<AsyncLink> link;
+        bool pending = false;
+        bool closed = false;
+
+        // Whether the response body is to be omitted
+        bool head = false;
+
+        // Admission slots held by the request until its response has been
+        // written
+        Bulkhead *admitted = nullptr;
+        Bulkhead *bulkhead = nullptr;
+
+        // Rate limiting key for the peer address
+        uint64_t peer = 0;
+
+        // Keeps the routes matched for the current request alive, even if
+        // their resources are removed meanwhile
+        Epoch::Pin pin;
+
+        // The request being handled, for recording its metrics. Only set
+        // for requests dispatched to a handler.
+        Resource *resource = nullptr;
+        const Route *route = nullptr;
+        HttpCode status = HttpCode::OK;
+        HttpMethod method = HttpMethod::GET;
+        std::chrono::steady_clock::time_point dispatched;
+
+        // The request's deadline, and its cancellation flag once a handler
+        // has asked for it
+        std::chrono::steady_clock::time_point expires =
+            std::chrono::steady_clock::time_point::max();
+        std::shared_ptr<std::atomic<bool>> cancelled;
+
+        // Phase timing. Parsing time accumulates over the reads that make
+        // up a request, excluding time spent waiting for input.
+        bool awaiting = true;
+        std::chrono::steady_clock::time_point waiting;
+        std::chrono::steady_clock::time_point parseStart;
+        std::chrono::nanoseconds parsing{0};
+        std::chrono::steady_clock::time_point writeStart;
+        size_t writing = 0;
+
+        // Further timestamps for sampled requests. The accept handoff is
+        // only attributed to the first request on a connection.
+        bool traced = false;
+        std::chrono::nanoseconds handoff{0};
+        std::chrono::steady_clock::time_point firstByte;
+        std::chrono::steady_clock::time_point parsed;
+        std::chrono::steady_clock::time_point handled;
+
         WriteCallback wcb;
         ReadCallback rcb;
     };
 
+    // Listen on another address too; must be called before start()
+    void addAddress(std::string const& address, short port) {
+        addresses_.emplace_back(address, port);
+    }
+
+    // Accepts on the given listening sockets if there are any, e.g. ones
+    // inherited in a hot upgrade, or else binds the configured addresses
     void start(wte::EventBase *listener_base,
-        std::vector<wte::EventBase*> const& handlers); // throws
+        std::vector<wte::EventBase*> const& handlers,
+        std::vector<int> const& listenFds = std::vector<int>()); // throws
+
+    // The listening sockets; empty once the instance stops accepting
+    std::vector<int> listenFds() const {
+        std::lock_guard<std::mutex> lock(listenMutex_);
+        return listenFds_;
+    }
+
+    // Stop accepting connections, stop the bases' timers and close every
+    // connection still open; runs on the listener base. Asynchronous
+    // handlers that complete afterwards have their responses dropped.
     void stop();
 
-    void registerResource(Resource *resource, detail::Methods const& methods) {
-        matcher_.addResource(resource, methods);
+    // Stop accepting connections, close those that are idle, and close the
+    // rest once their current request has been answered. Runs on neither
+    // the listener base nor a handler base.
+    void drain();
+
+    // The listening sockets have been handed to another process, which
+    // serves their Unix paths from now on; stopping leaves the files
+    void handOff() {
+        handedOff_.store(true, std::memory_order_relaxed);
+    }
+
+    // Open connections
+    size_t connections() const {
+        return connections_.load(std::memory_order_relaxed);
+    }
+
+    // Resources may be added and removed while the server is running
+    void registerResource(Resource *resource, detail::Methods const& methods,
+            RouteOptions const& options = RouteOptions()) {
+        matcher_.addResource(resource, methods, metrics_, options);
     }
 
+    bool unregisterResource(Resource *resource) {
+        return matcher_.removeResource(resource);
+    }
+
+    // Log slow requests; must be set before the server starts
+    void setSlowLog(SlowLog *log) { slowLog_ = log; }
+
     ResourceMatcher const& matcher() const {
         return matcher_;
     }
 
-    ccmetrics::MetricRegistry& metrics() { return *metrics_; }
+    MetricRegistry& metrics() { return *metrics_; }
 private:
-    static Response dispatch(Request const& req, Match const& handler) {
-        switch (req.type()) {
+    // Returns the bound method for the request, or null if the resource
+    // does not implement it
+    static detail::Method const* method(HttpMethod type,
+            Match const& handler) {
+        detail::Methods const& methods = handler.route->methods;
+        detail::Method const *method = nullptr;
+        switch (type) {
         case HttpMethod::GET:
-            return handler.methods.get(handler.parameters, req.uriInfo());
+            method = &methods.get;
+            break;
         case HttpMethod::PUT:
-            return handler.methods.put(handler.parameters, req.uriInfo());
+            method = &methods.put;
+            break;
         case HttpMethod::POST:
-            return handler.methods.post(handler.parameters, req.uriInfo());
+            method = &methods.post;
+            break;
         case HttpMethod::DELETE:
-            return handler.methods.del(handler.parameters, req.uriInfo());
+            method = &methods.del;
+            break;
+        case HttpMethod::HEAD:
+            method = &methods.head;
+            break;
+        case HttpMethod::OPTIONS:
+            // Answered from the route
+            return nullptr;
         }
+        return *method ? method : nullptr;
     }
 
-    // Choose a base for the request
-    wte::EventBase* chooseBase();
+    // Choose a base for the request; returns its index in bases_
+    size_t chooseBase();
 
+    // Runs on the listener base for each accepted connection, and after
+    // each batch
     void acceptCb(int fd);
-    void listenErrorCb(std::exception const& e);
+    void flushCb();
+
+    // Take on an accepted connection; runs on the chosen base
+    void adopt(int fd, size_t index,
+        std::chrono::steady_clock::time_point accepted);
+
+    // Rate limiting key for a connection's peer address, or 0 if unknown
+    static uint64_t peerKey(int fd);
 
-    static Response get_response(http_parser *parser, RequestContext *ctx) {
+    static Response get_response(Request const& req,
+            detail::Method const& method, Match const& match) {
         try {
-            // Build the request object
-            Request req = ctx->builder.build(parser->method);
-
-            // Find a resouce that matches this requests's path
-            auto match = ctx->server->matcher_.match(req.path());
-
-            // Dispatch to the resource or return 404
-            if (match) {
-                // TODO: would be nice to have different metrics for each
-                // endpoint. To amortize lookups, should cache the timer
-                // handle in the Resource.
-                SCOPED_TIMER("topper.resource.dispatch",
-                    ctx->server->metrics());
-                return dispatch(req, match.get());
-            }
-            return Response::notFound();
+            return method(match.parameters, req.uriInfo());
         } catch (std::exception const& e) {
             return Response(HttpCode::INTERNAL_ERROR, MediaType::TEXT_PLAIN,
                 e.what());
         }
     }
 
+    // The client's rate limiting key: the configured header if the request
+    // has it, otherwise the connection's address
+    static uint64_t clientKey(RequestContext *ctx) {
+        std::string const& name = ctx->server->options_.clientHeader;
+        if (!name.empty()) {
+            std::string const *value = ctx->builder.header(name);
+            if (value) {
+                return RateLimiter::key(value->data(), value->size());
+            }
+        }
+        return ctx->peer;
+    }
+
+    // Arm the connection's timeout for what it is now waiting for; does
+    // nothing if that timeout is disabled
+    static void expect(RequestContext *ctx, Waiting waiting) {
+        std::chrono::milliseconds timeout =
+            ctx->server->timeouts_[static_cast<size_t>(waiting)];
+        if (!ctx->timers || timeout.count() == 0) {
+            TimerWheel::cancel(&ctx->timeout);
+            return;
+        }
+        ctx->timeout.waiting = waiting;
+        ctx->timers->schedule(&ctx->timeout,
+            std::chrono::steady_clock::now() + timeout);
+    }
+
+    // The deadline for a request to a route: the route's own, or a shorter
+    // one from the request
+    static std::chrono::steady_clock::time_point deadline(
+            RequestContext *ctx, Route const& route,
+            std::chrono::steady_clock::time_point received) {
+        std::chrono::milliseconds limit = route.config.deadline;
+        if (!route.config.deadlineHeader.empty()) {
+            std::string const *value =
+                ctx->builder.header(route.config.deadlineHeader);
+            char *end = nullptr;
+            long long requested = value ? strtoll(value->c_str(), &end, 10)
+                : 0;
+            if (requested > 0 && *end == '\0' && (limit.count() == 0 ||
+                    requested < limit.count())) {
+                limit = std::chrono::milliseconds(requested);
+            }
+        }
+        return limit.count() > 0 ? received + limit
+            : std::chrono::steady_clock::time_point::max();
+    }
+
+    // Add a connection to its base's list of open connections, so that it
+    // can be found when draining; runs on the base
+    static void list(RequestContext *ctx) {
+        RequestContext *&head = ctx->server->open_[ctx->index];
+        ctx->nextOpen = head;
+        if (head) {
+            head->prevOpen = ctx;
+        }
+        head = ctx;
+        ctx->listed = true;
+    }
+
+    static void forget(RequestContext *ctx) {
+        if (!ctx->listed) {
+            return;
+        }
+        if (ctx->prevOpen) {
+            ctx->prevOpen->nextOpen = ctx->nextOpen;
+        } else {
+            ctx->server->open_[ctx->index] = ctx->nextOpen;
+        }
+        if (ctx->nextOpen) {
+            ctx->nextOpen->prevOpen = ctx->prevOpen;
+        }
+        ctx->listed = false;
+    }
+
+    // Whether a connection is between requests
+    static bool idle(RequestContext *ctx) {
+        return ctx->awaiting && !ctx->responded && !ctx->pending;
+    }
+
+    // Close the connections on a base that are kept alive between
+    // requests; runs on the base. Connections that haven't been served yet
+    // may already have a request on the way, so they get to finish one.
+    void closeIdle(size_t index);
+
+    // Close every connection on a base, whatever it is doing; runs on the
+    // base
+    void closeAll(size_t index);
+
+    // Stop accepting connections; runs on the listener base
+    void stopAccepting();
+
+    // Give up the admission slots held by a request
+    static void release(RequestContext *ctx) {
+        if (ctx->admitted) {
+            ctx->admitted->release();
+            ctx->admitted = nullptr;
+        }
+        if (ctx->bulkhead) {
+            ctx->bulkhead->release();
+            ctx->bulkhead = nullptr;
+        }
+    }
+
+    // Record the outcome of a request dispatched to a resource
+    static void record(RequestContext *ctx, HttpCode code) {
+        ctx->status = code;
+        ctx->route->metrics.time(ctx->method,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - ctx->dispatched));
+        ctx->route->metrics.count(code);
+    }
+
+    // Write a response. Parsing is paused until it has been written; the
+    // connection is then either closed or reset for the next request.
+    static void respond(RequestContext *ctx, std::string const& response) {
+        ctx->writeStart = std::chrono::steady_clock::now();
+        ctx->writing = response.size();
+        ctx->responded = true;
+        http_parser_pause(&ctx->parser, 1);
+        expect(ctx, Waiting::WRITE);
+        ctx->stream->write(response.c_str(), response.size(), &ctx->wcb);
+    }
+
+    // Write a response that terminates the connection
+    static void respondAndClose(RequestContext *ctx,
+            std::string const& response) {
+        ctx->keepAlive = false;
+        respond(ctx, response);
+    }
+
+    // Parse client input. Input that follows a request is retained until
+    // the request has been answered.
+    static void feed(RequestContext *ctx, const char *data, size_t size);
+    static void backlog(RequestContext *ctx, const char *data, size_t size);
+
+    static int headers_complete(http_parser *parser) {
+        auto ctx = reinterpret_cast<RequestContext*>(parser->data);
+        expect(ctx, Waiting::BODY);
+
+        // Read a body of known length without growing its buffer
+        size_t reserve = ctx->server->options_.readBufferSize;
+        if (parser->content_length > 0 &&
+                parser->content_length != ULLONG_MAX) {
+            ctx->builder.reserveBody(parser->content_length < reserve
+                ? parser->content_length : reserve);
+        }
+        return RequestBuilder::on_headers_complete(parser);
+    }
+
     static int message_complete(http_parser *parser) {
         auto ctx = reinterpret_cast<RequestContext*>(parser->data);
+        Counters& counters = ctx->server->counters_;
+        TimerWheel::cancel(&ctx->timeout);
+
+        // The request has been parsed
+        auto parsed = std::chrono::steady_clock::now();
+        ctx->parsed = parsed;
+        ctx->parsing += parsed - ctx->parseStart;
+        counters.parse->update(ctx->parsing);
+        ctx->parsing = std::chrono::nanoseconds(0);
+
+        // Requests that can't be served are answered with preformatted
+        // responses, before doing any work on their behalf
+        HttpCode status = ctx->builder.validate(parser);
+        if (status != HttpCode::OK) {
+            counters.parseErrors->increment();
+            respondAndClose(ctx, Response::preformatted(status));
+            return 0;
+        }
+        ctx->keepAlive = http_should_keep_alive(parser) != 0 &&
+            !ctx->server->draining_.load(std::memory_order_relaxed);
+
+        // Shed load before doing any work for the request
+        ServerInstance *server = ctx->server;
+        if (server->inFlight_) {
+            if (!server->inFlight_->acquire()) {
+                counters.rejectedRequests->increment();
+                respondAndClose(ctx,
+                    server->overloaded_.get(/*keepAlive=*/ false));
+                return 0;
+            }
+            ctx->admitted = server->inFlight_.get();
+        }
+
+        // Find a resouce that matches this requests's path; its route
+        // stays valid until the request is done
+        HttpMethod type = ctx->builder.method();
+        std::string path = ctx->builder.path();
+        ctx->pin.enter();
+        auto match = server->matcher_.match(path);
+        auto matched = std::chrono::steady_clock::now();
+        counters.match->update(matched - parsed);
+        if (!match) {
+            if (type == HttpMethod::OPTIONS && path == "*") {
+                respond(ctx, serverOptions().get(ctx->keepAlive));
+                return 0;
+            }
+            counters.notFound->increment();
+            respond(ctx, Response::preformatted(HttpCode::NOT_FOUND,
+                ctx->keepAlive));
+            return 0;
+        }
+
+        // Rate limits apply before the request is built
+        Route const& route = *match.get().route;
+        if (server->clients_ && !server->clients_->acquire(
+                clientKey(ctx), matched)) {
+            counters.limitedClient->increment();
+            route.metrics.count(HttpCode::TOO_MANY_REQUESTS);
+            respond(ctx, server->limited_.get(ctx->keepAlive));
+            return 0;
+        }
+        if (route.rateLimit && !route.rateLimit->acquire(matched)) {
+            counters.limitedResource->increment();
+            route.metrics.count(HttpCode::TOO_MANY_REQUESTS);
+            respond(ctx, server->limited_.get(ctx->keepAlive));
+            return 0;
+        }
+
+        if (type == HttpMethod::OPTIONS) {
+            route.metrics.count(HttpCode::OK);
+            respond(ctx, route.options.get(ctx->keepAlive));
+            return 0;
+        }
+
+        detail::Method const *handler = method(type, match.get());
+        if (!handler) {
+            counters.notAllowed->increment();
+            route.metrics.count(HttpCode::NOT_ALLOWED);
+            respond(ctx, route.notAllowed.get(ctx->keepAlive));
+            return 0;
+        }
+
+        if (route.bulkhead) {
+            if (!route.bulkhead->acquire()) {
+                counters.rejectedBulkhead->increment();
+                route.metrics.count(HttpCode::SERVICE_UNAVAILABLE);
+                respond(ctx, server->overloaded_.get(ctx->keepAlive));
+                return 0;
+            }
+            ctx->bulkhead = route.bulkhead.get();
+        }
+
+        // Build the request object
+        Request req = ctx->builder.build(path, ctx);
+
+        ctx->head = type == HttpMethod::HEAD;
+        ctx->resource = match.get().resource;
+        ctx->route = match.get().route;
+        ctx->method = type;
+        ctx->dispatched = matched;
+        ctx->expires = deadline(ctx, route, parsed);
+        ctx->traced = ctx->ring && server->tracer_->sample(ctx->ring);
 
         // TODO: move this off of the event loop
-        Response resp = get_response(parser, ctx);
+        Response resp = get_response(req, *handler, match.get());
+
+        // Time spent in the handler on the event loop
+        auto handled = std::chrono::steady_clock::now();
+        ctx->handled = handled;
+        counters.dispatch->update(handled - ctx->dispatched);
+
+        if (ctx->pending) {
+            // Asynchronous handlers complete through their state; one that
+            // threw still has to release it
+            if (!resp.deferred()) {
+                std::shared_ptr<detail::AsyncState> state = ctx->async.lock();
+                if (state) {
+                    state->complete(resp);
+                }
+            }
+            if (ctx->timers && ctx->expires !=
+                    std::chrono::steady_clock::time_point::max()) {
+                ctx->timeout.waiting = Waiting::HANDLER;
+                ctx->timers->schedule(&ctx->timeout, ctx->expires);
+            }
+            http_parser_pause(parser, 1);
+            return 0;
+        }
+
+        record(ctx, resp.code());
 
         // XXX uhg.
-        std::string resp_str = resp.to_string();
-        ctx->stream->write(resp_str.c_str(), resp_str.size(), &ctx->wcb);
+        std::string serialized = resp.to_string(/*includeBody=*/ !ctx->head,
+            ctx->keepAlive);
+        counters.serialize->update(std::chrono::steady_clock::now() - handled);
+        respond(ctx, serialized);
         return 0;
     }
 
+    // Writes the response to an asynchronous request; runs on the
+    // connection's event base
+    static void completeAsync(RequestContext *ctx, Response const& resp) {
+        ctx->pending = false;
+        ctx->async.reset();
+        record(ctx, resp.code());
+        if (ctx->closed) {
+            // Nobody left to respond to
+            delete ctx;
+            return;
+        }
+        ctx->handled = std::chrono::steady_clock::now();
+        if (ctx->server->draining_.load(std::memory_order_relaxed)) {
+            ctx->keepAlive = false;
+        }
+        std::string serialized = resp.to_string(/*includeBody=*/ !ctx->head,
+            ctx->keepAlive);
+        ctx->server->counters_.serialize->update(
+            std::chrono::steady_clock::now() - ctx->handled);
+        respond(ctx, serialized);
+    }
+
+    // Describe a dispatched request once its response has been written
+    static void fillTrace(RequestContext *ctx,
+        std::chrono::steady_clock::time_point written, Trace *trace);
+
+    // Record a dispatched request in the trace ring or slow log, if
+    // sampled or slow
+    static void inspect(RequestContext *ctx,
+        std::chrono::steady_clock::time_point written);
+
+    // The response to OPTIONS *, listing every verb the server supports
+    static FormattedResponse const& serverOptions() {
+        static const FormattedResponse kResponse(Response(HttpCode::OK)
+            .header("Allow", "GET, HEAD, PUT, POST, DELETE, OPTIONS"));
+        return kResponse;
+    }
+
     // Configuration
-    const std::string ipaddr_;
-    const short port_;
+    std::vector<std::pair<std::string, short>> addresses_;
+    const ServerOptions options_;
+
+    // Admission control
+    const FormattedResponse overloaded_;
+    std::unique_ptr<Bulkhead> inFlight_;
+    std::atomic<size_t> connections_{0};
+
+    // Rate limiting
+    const FormattedResponse limited_;
+    std::unique_ptr<RateLimiter> clients_;
+
+    // Connection timeouts, indexed by what is being waited for, and the
+    // timer wheel of each base
+    const std::chrono::milliseconds timeouts_[4];
+    std::vector<std::unique_ptr<Timers>> timers_;
+
+    // Accepted connections queued for each base
+    std::vector<std::unique_ptr<Handoff>> handoffs_;
+
+    // Server-wide metrics, resolved once
+    struct Counters {
+        explicit Counters(MetricRegistry *registry)
+            : dispatch(registry->timer("topper.resource.dispatch")),
+              notFound(registry->counter("topper.response.404")),
+              notAllowed(registry->counter("topper.response.405")),
+              parseErrors(registry->counter("topper.request.parse_errors")),
+              accepted(registry->counter("topper.connections.accepted")),
+              bytesRead(registry->counter("topper.connections.bytes_read")),
+              bytesWritten(
+                  registry->counter("topper.connections.bytes_written")),
+              readErrors(registry->counter("topper.connections.read_errors")),
+              writeErrors(
+                  registry->counter("topper.connections.write_errors")),
+              accept(phase(registry, "accept")),
+              firstByte(phase(registry, "first_byte")),
+              parse(phase(registry, "parse")),
+              match(phase(registry, "match")),
+              serialize(phase(registry, "serialize")),
+              write(phase(registry, "write")),
+              rejectedConnections(rejected(registry, "connections")),
+              rejectedRequests(rejected(registry, "requests")),
+              rejectedBulkhead(rejected(registry, "bulkhead")),
+              limitedClient(limited(registry, "client")),
+              limitedResource(limited(registry, "resource")),
+              timeouts{timedOut(registry, "idle"),
+                  timedOut(registry, "headers"), timedOut(registry, "body"),
+                  timedOut(registry, "write")},
+              deadlinesExceeded(
+                  registry->counter("topper.request.deadlines_exceeded")),
+              idleClosed(registry->counter("topper.drain.idle_closed")) { }
+
+        static Timer* phase(MetricRegistry *registry, const char *name) {
+            return registry->timer("topper.request.phase",
+                {{"phase", name}});
+        }
+
+        static Counter* rejected(MetricRegistry *registry,
+                const char *limit) {
+            return registry->counter("topper.admission.rejected",
+                {{"limit", limit}});
+        }
+
+        static Counter* timedOut(MetricRegistry *registry,
+                const char *waiting) {
+            return registry->counter("topper.connections.timeouts",
+                {{"waiting", waiting}});
+        }
+
+        static Counter* limited(MetricRegistry *registry,
+                const char *scope) {
+            return registry->counter("topper.ratelimit.limited",
+                {{"scope", scope}});
+        }
+
+        Timer *dispatch;
+        Counter *notFound;
+        Counter *notAllowed;
+        Counter *parseErrors;
+
+        // Connections
+        Counter *accepted;
+        Counter *bytesRead;
+        Counter *bytesWritten;
+        Counter *readErrors;
+        Counter *writeErrors;
+        std::vector<Gauge*> active;     // Per base
+
+        // Request phases: handing an accepted connection to its base,
+        // waiting for the first byte of a request, parsing, building and
+        // routing the request, formatting the response, and writing it
+        Timer *accept;
+        Timer *firstByte;
+        Timer *parse;
+        Timer *match;
+        Timer *serialize;
+        Timer *write;
+
+        // Work refused by admission control, by the limit that was hit
+        Counter *rejectedConnections;
+        Counter *rejectedRequests;
+        Counter *rejectedBulkhead;
+
+        // Requests refused by rate limits, by the limit's scope
+        Counter *limitedClient;
+        Counter *limitedResource;
+
+        // Connections that timed out, by what they were waiting for
+        Counter *timeouts[4];
+
+        // Asynchronous requests answered with a 504
+        Counter *deadlinesExceeded;
+
+        // Idle connections closed when draining
+        Counter *idleClosed;
+    };
 
     // Runtime state
-    ccmetrics::MetricRegistry *metrics_ = nullptr;
-    wte::ConnectionListener *listener_ = nullptr;
+    MetricRegistry *metrics_ = nullptr;
+    Counters counters_;
+    Tracer *tracer_ = nullptr;
+    SlowLog *slowLog_ = nullptr;
+    wte::EventBase *listenerBase_ = nullptr;
+    std::vector<Listener*> listeners_;
+    mutable std::mutex listenMutex_;
+    std::vector<int> listenFds_;
+    std::atomic<bool> handedOff_{false};
 
     // Request handlers. These may be shared.
     std::vector<wte::EventBase*> bases_;
 
+    // Open connections on each base, for draining; each list belongs to its
+    // base's thread
+    std::vector<RequestContext*> open_;
+    std::atomic<bool> draining_{false};
+
     // Resources
     ResourceMatcher matcher_;
 };
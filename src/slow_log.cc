@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "slow_log.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace topper {
+
+SlowLog::SlowLog(SlowLogOptions const& options, MetricRegistry *metrics)
+        : file_(fopen(options.path.c_str(), "a")),
+          threshold_(options.threshold),
+          rate_(options.maxPerSecond),
+          burst_(std::max(1.0, options.maxPerSecond)),
+          logged_(metrics->counter("topper.slowlog.logged")),
+          suppressed_(metrics->counter("topper.slowlog.suppressed")),
+          tokens_(burst_),
+          refilled_(std::chrono::steady_clock::now()) {
+    if (!file_) {
+        throw std::runtime_error("Unable to open slow log " + options.path +
+            ": " + strerror(errno));
+    }
+    writer_ = std::thread(&SlowLog::run, this);
+}
+
+SlowLog::~SlowLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_one();
+    writer_.join();
+    fclose(file_);
+}
+
+void SlowLog::log(SlowRequest const& request) {
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::chrono::duration<double> elapsed = now - refilled_;
+        tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+        refilled_ = now;
+        if (tokens_ < 1) {
+            ++pendingSuppressed_;
+            suppressed_->increment();
+            return;
+        }
+        tokens_ -= 1;
+        queue_.push_back(request);
+    }
+    logged_->increment();
+    cv_.notify_one();
+}
+
+void SlowLog::format(SlowRequest const& request, std::string *out) {
+    Trace const& trace = request.trace;
+    char buf[128];
+
+    // Completion time, in UTC
+    time_t seconds = trace.timestamp / 1000000;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + n, sizeof(buf) - n, ".%06dZ ",
+        static_cast<int>(trace.timestamp % 1000000));
+    out->append(buf);
+
+    std::ostringstream thread;
+    thread << request.thread;
+
+    out->append(methodName(trace.method)).push_back(' ');
+    out->append(trace.path);
+    snprintf(buf, sizeof(buf), " status=%d resource=",
+        static_cast<int>(trace.status));
+    out->append(buf).append(trace.resource);
+    snprintf(buf, sizeof(buf), " base=%" PRIu32 " thread=", trace.base);
+    out->append(buf).append(thread.str());
+    snprintf(buf, sizeof(buf), " headers=%zu body=%zu latency=%.6f",
+        request.headerBytes, request.bodyBytes, trace.latency() / 1e9);
+    out->append(buf);
+    for (int i = 0; i < Trace::kPhases; ++i) {
+        snprintf(buf, sizeof(buf), " %s=%.6f", Trace::phaseName(i),
+            trace.phases[i] / 1e9);
+        out->append(buf);
+    }
+}
+
+void SlowLog::run() {
+    std::deque<SlowRequest> batch;
+    std::string lines;
+    for (;;) {
+        uint64_t suppressed = 0;
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            batch.swap(queue_);
+            std::swap(suppressed, pendingSuppressed_);
+            stopping = stopping_;
+        }
+
+        lines.clear();
+        if (suppressed > 0) {
+            lines.append("suppressed " + std::to_string(suppressed) +
+                " slow requests over the rate limit\n");
+        }
+        for (auto const& request : batch) {
+            format(request, &lines);
+            lines.push_back('\n');
+        }
+        batch.clear();
+        if (!lines.empty()) {
+            fwrite(lines.data(), 1, lines.size(), file_);
+            fflush(file_);
+        }
+
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+} // topper namespace
@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_SLOW_LOG_H_
+#define SRC_SLOW_LOG_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "metric_registry.h"
+#include "server.h"
+#include "tracer.h"
+
+namespace topper {
+
+// A request that exceeded its latency threshold
+struct SlowRequest {
+    Trace trace;
+    std::thread::id thread;
+    size_t headerBytes = 0;
+    size_t bodyBytes = 0;
+};
+
+/**
+ * Appends slow requests to a file, one line each.
+ *
+ * Requests are queued by the event base threads and written by a thread
+ * of the log's own, so file IO never runs on an event loop. A token
+ * bucket limits the rate of entries; requests beyond it are counted, and
+ * the count is logged with the next entry that is written.
+ */
+class SlowLog {
+public:
+    SlowLog(SlowLogOptions const& options, MetricRegistry *metrics); // throws
+    ~SlowLog();
+
+    // The threshold for a resource
+    std::chrono::nanoseconds threshold(RouteOptions const& config) const {
+        return config.slowThreshold.count() > 0
+            ? std::chrono::nanoseconds(config.slowThreshold) : threshold_;
+    }
+
+    // Queue a request for logging; any thread
+    void log(SlowRequest const& request);
+
+    // Format an entry, without the trailing newline; visible for testing
+    static void format(SlowRequest const& request, std::string *out);
+private:
+    void run();
+
+    FILE *file_;
+    const std::chrono::nanoseconds threshold_;
+    const double rate_;
+    const double burst_;
+
+    Counter *logged_;
+    Counter *suppressed_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<SlowRequest> queue_;
+    uint64_t pendingSuppressed_ = 0;
+    double tokens_;
+    std::chrono::steady_clock::time_point refilled_;
+    bool stopping_ = false;
+
+    std::thread writer_;
+};
+
+} // topper namespace
+
+#endif // SRC_SLOW_LOG_H_
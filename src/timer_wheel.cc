@@ -0,0 +1,167 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "timer_wheel.h"
+
+namespace topper {
+
+const int TimerWheel::kLevels;
+const int TimerWheel::kSlotBits;
+const size_t TimerWheel::kSlots;
+
+TimerWheel::Entry::~Entry() {
+    cancel(this);
+}
+
+TimerWheel::TimerWheel(std::chrono::milliseconds resolution,
+        Clock::time_point now)
+    : resolution_(resolution), origin_(now) { }
+
+TimerWheel::~TimerWheel() {
+    for (int level = 0; level < kLevels; ++level) {
+        for (size_t slot = 0; slot < kSlots; ++slot) {
+            while (slots_[level][slot]) {
+                cancel(slots_[level][slot]);
+            }
+        }
+    }
+}
+
+uint64_t TimerWheel::ticks(Clock::duration elapsed) const {
+    if (elapsed <= Clock::duration::zero()) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        elapsed).count() / std::chrono::duration_cast<
+            std::chrono::nanoseconds>(resolution_).count();
+}
+
+void TimerWheel::schedule(Entry *entry, Clock::time_point deadline) {
+    cancel(entry);
+
+    // Round up, so that entries never expire early
+    uint64_t tick = ticks(deadline - origin_);
+    if (origin_ + static_cast<int64_t>(tick) * resolution_ < deadline) {
+        ++tick;
+    }
+    entry->deadline_ = tick < now_ ? now_ : tick;
+    entry->wheel_ = this;
+    ++size_;
+    insert(entry);
+}
+
+void TimerWheel::cancel(Entry *entry) {
+    if (!entry->wheel_) {
+        return;
+    }
+    unlink(entry);
+    --entry->wheel_->size_;
+    entry->wheel_ = nullptr;
+}
+
+void TimerWheel::insert(Entry *entry) {
+    // The lowest level whose current range holds the deadline. Deadlines
+    // beyond the top level's range wait in its slots and are reinserted
+    // each time the wheel reaches them.
+    uint64_t differing = entry->deadline_ ^ now_;
+    int level = 0;
+    while (level < kLevels - 1 &&
+            (differing >> ((level + 1) * kSlotBits)) != 0) {
+        ++level;
+    }
+    size_t slot = (entry->deadline_ >> (level * kSlotBits)) & (kSlots - 1);
+    link(&slots_[level][slot], entry);
+}
+
+void TimerWheel::link(Entry **head, Entry *entry) {
+    entry->next_ = *head;
+    if (entry->next_) {
+        entry->next_->pprev_ = &entry->next_;
+    }
+    entry->pprev_ = head;
+    *head = entry;
+}
+
+void TimerWheel::unlink(Entry *entry) {
+    *entry->pprev_ = entry->next_;
+    if (entry->next_) {
+        entry->next_->pprev_ = entry->pprev_;
+    }
+    entry->next_ = nullptr;
+    entry->pprev_ = nullptr;
+}
+
+void TimerWheel::cascade(int level) {
+    size_t slot = (now_ >> (level * kSlotBits)) & (kSlots - 1);
+    Entry *&head = slots_[level][slot];
+    if (!head) {
+        return;
+    }
+
+    // Detached first, since entries may land back in the same slot
+    detached_ = head;
+    head->pprev_ = &detached_;
+    head = nullptr;
+    while (detached_) {
+        Entry *entry = detached_;
+        unlink(entry);
+        insert(entry);
+    }
+}
+
+void TimerWheel::advance(Clock::time_point now) {
+    uint64_t target = ticks(now - origin_);
+    while (now_ <= target) {
+        if (size_ == 0) {
+            // Nothing to expire in between
+            now_ = target + 1;
+            return;
+        }
+
+        // Move entries down from any levels whose range starts here,
+        // highest first
+        for (int level = kLevels - 1; level > 0; --level) {
+            if ((now_ & ((uint64_t(1) << (level * kSlotBits)) - 1)) == 0) {
+                cascade(level);
+            }
+        }
+
+        Entry *&head = slots_[0][now_ & (kSlots - 1)];
+        ++now_;
+        if (!head) {
+            continue;
+        }
+
+        // Expire entries one at a time; each may cancel or reschedule
+        // others, and anything rescheduled goes to a later tick
+        detached_ = head;
+        head->pprev_ = &detached_;
+        head = nullptr;
+        while (detached_) {
+            Entry *entry = detached_;
+            cancel(entry);
+            entry->expired();
+        }
+    }
+}
+
+} // topper namespace
@@ -0,0 +1,120 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_TIMER_WHEEL_H_
+#define SRC_TIMER_WHEEL_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <chrono>
+
+namespace topper {
+
+/**
+ * A hierarchical timer wheel.
+ *
+ * Time advances in ticks of a fixed resolution. The first level has a slot
+ * for each of the next 64 ticks, and each further level a slot for 64
+ * ranges of the level below; entries move down a level when the wheel
+ * reaches their range. Scheduling and cancelling are O(1) list operations
+ * on an entry embedded in the caller's own state, so connections can arm
+ * and disarm timeouts on every request without allocating or touching an
+ * OS timer.
+ *
+ * Entries expire no earlier than their deadline and up to one tick late.
+ * The wheel is not thread safe; it belongs to one event base, which
+ * advances it periodically.
+ */
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    class Entry {
+    public:
+        Entry() { }
+        virtual ~Entry();
+
+        // Called once the deadline has passed, after the entry has been
+        // removed from the wheel. The entry may be rescheduled or deleted.
+        virtual void expired() = 0;
+
+        bool scheduled() const { return wheel_ != nullptr; }
+    private:
+        friend class TimerWheel;
+
+        Entry(Entry const&) = delete;
+        Entry& operator=(Entry const&) = delete;
+
+        TimerWheel *wheel_ = nullptr;
+        Entry *next_ = nullptr;
+        Entry **pprev_ = nullptr;   // The pointer that points to this entry
+        uint64_t deadline_ = 0;     // Tick
+    };
+
+    explicit TimerWheel(
+        std::chrono::milliseconds resolution = std::chrono::milliseconds(10),
+        Clock::time_point now = Clock::now());
+    ~TimerWheel();
+
+    // Schedule an entry, rescheduling it if it was already scheduled
+    void schedule(Entry *entry, Clock::time_point deadline);
+
+    // Remove an entry; does nothing if it isn't scheduled
+    static void cancel(Entry *entry);
+
+    // Expire every entry whose deadline has passed
+    void advance(Clock::time_point now);
+
+    // The number of scheduled entries
+    size_t size() const { return size_; }
+
+    std::chrono::milliseconds resolution() const { return resolution_; }
+
+    static const int kLevels = 4;
+    static const int kSlotBits = 6;
+    static const size_t kSlots = 1 << kSlotBits;
+private:
+    TimerWheel(TimerWheel const&) = delete;
+    TimerWheel& operator=(TimerWheel const&) = delete;
+
+    uint64_t ticks(Clock::duration elapsed) const;
+    void insert(Entry *entry);
+    static void link(Entry **head, Entry *entry);
+    static void unlink(Entry *entry);
+    void cascade(int level);
+
+    const std::chrono::milliseconds resolution_;
+    const Clock::time_point origin_;
+
+    // The next tick to be processed
+    uint64_t now_ = 0;
+    size_t size_ = 0;
+    Entry *slots_[kLevels][kSlots] = {};
+
+    // Entries being expired or moved down a level
+    Entry *detached_ = nullptr;
+};
+
+} // topper namespace
+
+#endif // SRC_TIMER_WHEEL_H_
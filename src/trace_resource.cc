@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "trace_resource.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json.h"
+
+namespace topper {
+
+const size_t TraceResource::kDefaultSlowest;
+
+namespace {
+
+// Parse a non-negative integer parameter
+bool parseCount(QueryParams const& query, std::string const& name,
+        unsigned long *value) {
+    std::vector<std::string> values = query.get(name);
+    if (values.empty() || values[0].empty()) {
+        return false;
+    }
+    char *end = nullptr;
+    *value = strtoul(values[0].c_str(), &end, 10);
+    return *end == '\0' && values[0][0] != '-';
+}
+
+void appendSeconds(std::string *out, const char *field, int64_t nanos) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%s\":%.9g", field, nanos / 1e9);
+    out->append(buf);
+}
+
+void appendTrace(std::string *out, Trace const& trace) {
+    out->append("{\"method\":\"").append(methodName(trace.method))
+        .append("\",\"path\":\"");
+    appendJsonEscaped(out, trace.path, strlen(trace.path));
+    out->append("\",\"status\":")
+        .append(std::to_string(static_cast<int>(trace.status)))
+        .append(",\"base\":").append(std::to_string(trace.base))
+        .append(",\"timestamp\":").append(std::to_string(trace.timestamp))
+        .push_back(',');
+    appendSeconds(out, "latency", trace.latency());
+    out->append(",\"phases\":{");
+    for (int i = 0; i < Trace::kPhases; ++i) {
+        if (i > 0) {
+            out->push_back(',');
+        }
+        appendSeconds(out, Trace::phaseName(i), trace.phases[i]);
+    }
+    out->append("}}");
+}
+
+} // anonymous namespace
+
+Response TraceResource::get(QueryParams const& query) const {
+    unsigned long slowest = kDefaultSlowest;
+    if (!query.get("n").empty() && !parseCount(query, "n", &slowest)) {
+        return Response(HttpCode::BAD_REQUEST, MediaType::TEXT_PLAIN,
+            "n must be a non-negative integer\n");
+    }
+
+    std::map<std::string, std::vector<Trace const*>> routes;
+    std::vector<Trace> traces = tracer_->collect();
+    for (Trace const& trace : traces) {
+        routes[trace.resource].push_back(&trace);
+    }
+
+    std::string body("{\"period\":");
+    body.append(std::to_string(tracer_->period()))
+        .append(",\"routes\":{");
+    bool first = true;
+    for (auto& route : routes) {
+        std::vector<Trace const*>& sampled = route.second;
+        size_t count = std::min<size_t>(slowest, sampled.size());
+        std::partial_sort(sampled.begin(), sampled.begin() + count,
+            sampled.end(), [](Trace const* a, Trace const* b) {
+                return a->latency() > b->latency();
+            });
+
+        if (!first) {
+            body.push_back(',');
+        }
+        first = false;
+        body.push_back('"');
+        appendJsonEscaped(&body, route.first);
+        body.append("\":[");
+        for (size_t i = 0; i < count; ++i) {
+            if (i > 0) {
+                body.push_back(',');
+            }
+            appendTrace(&body, *sampled[i]);
+        }
+        body.push_back(']');
+    }
+    body.append("}}");
+
+    return Response(HttpCode::OK, MediaType::APPLICATION_JSON,
+        std::move(body));
+}
+
+Response TraceResource::put(QueryParams const& query) const {
+    unsigned long period = 0;
+    if (!parseCount(query, "period", &period) || period > UINT32_MAX) {
+        return Response(HttpCode::BAD_REQUEST, MediaType::TEXT_PLAIN,
+            "period must be a non-negative integer\n");
+    }
+    tracer_->setPeriod(static_cast<uint32_t>(period));
+    return Response(HttpCode::OK, MediaType::APPLICATION_JSON,
+        "{\"period\":" + std::to_string(period) + "}");
+}
+
+} // topper namespace
@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_TRACE_RESOURCE_H_
+#define SRC_TRACE_RESOURCE_H_
+
+#include "parameter.h"
+#include "resource.h"
+#include "tracer.h"
+
+namespace topper {
+
+/**
+ * Serves sampled request traces at `/tracez`.
+ *
+ * `GET /tracez?n=N` lists the N slowest traces held for each resource
+ * (default 5), slowest first, with the time spent in each phase.
+ * `PUT /tracez?period=N` samples one request in every N; 0 disables
+ * tracing.
+ */
+class TraceResource : public Resource {
+public:
+    explicit TraceResource(Tracer *tracer)
+        : Resource("/tracez"), tracer_(tracer) { }
+    Response get(QueryParams const& query) const;
+    Response put(QueryParams const& query) const;
+
+    static const size_t kDefaultSlowest = 5;
+private:
+    Tracer *tracer_;
+};
+
+} // topper namespace
+
+#endif // SRC_TRACE_RESOURCE_H_
@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "tracer.h"
+
+namespace topper {
+
+const size_t Trace::kPathSize;
+const size_t Trace::kResourceSize;
+const size_t Tracer::kDefaultCapacity;
+const uint32_t Tracer::kDefaultPeriod;
+const int64_t Tracer::kRecheck;
+
+const char* Trace::phaseName(int phase) {
+    static const char *kNames[kPhases] = {
+        "accept", "read", "parse", "match", "dispatch", "serialize", "write",
+    };
+    return phase >= 0 && phase < kPhases ? kNames[phase] : "unknown";
+}
+
+TraceRing::TraceRing(size_t capacity)
+    : capacity_(capacity), slots_(new Slot[capacity]) { }
+
+void TraceRing::push(Trace const& trace) {
+    Slot& slot = slots_[head_++ % capacity_];
+    uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.trace = trace;
+    slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+void TraceRing::collect(std::vector<Trace> *out) const {
+    for (size_t i = 0; i < capacity_; ++i) {
+        Slot const& slot = slots_[i];
+        uint64_t before = slot.seq.load(std::memory_order_acquire);
+        if (before == 0 || (before & 1)) {
+            // Empty, or being written
+            continue;
+        }
+        Trace copy = slot.trace;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == before) {
+            out->push_back(copy);
+        }
+    }
+}
+
+Tracer::Tracer(size_t bases, size_t capacity) {
+    for (size_t i = 0; i < bases; ++i) {
+        rings_.emplace_back(new TraceRing(capacity));
+    }
+}
+
+bool Tracer::resample(TraceRing *ring) {
+    uint32_t period = period_.load(std::memory_order_relaxed);
+    if (period == 0) {
+        ring->countdown = kRecheck;
+        return false;
+    }
+    ring->countdown = period;
+    return true;
+}
+
+std::vector<Trace> Tracer::collect() const {
+    std::vector<Trace> traces;
+    for (auto const& ring : rings_) {
+        ring->collect(&traces);
+    }
+    return traces;
+}
+
+} // topper namespace
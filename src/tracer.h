@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_TRACER_H_
+#define SRC_TRACER_H_
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "request.h"
+#include "response.h"
+
+namespace topper {
+
+// One sampled request
+struct Trace {
+    // Pipeline phases, in order
+    enum Phase {
+        ACCEPT,     // Handing the connection to its base; first request only
+        READ,       // Waiting for the first byte of the request
+        PARSE,      // From the first byte until the request was parsed
+        MATCH,      // Building and routing the request
+        DISPATCH,   // Running the handler, until the response was ready
+        SERIALIZE,  // Formatting the response
+        WRITE,      // Writing the response
+        kPhases,
+    };
+
+    static const char* phaseName(int phase);
+
+    // From the first byte of the request until the response was written
+    int64_t latency() const {
+        int64_t sum = 0;
+        for (int i = PARSE; i < kPhases; ++i) {
+            sum += phases[i];
+        }
+        return sum;
+    }
+
+    // Truncated, NUL-terminated copies of the request target (path and
+    // query) and the path template of the resource that served it
+    static const size_t kPathSize = 128;
+    static const size_t kResourceSize = 64;
+    char path[kPathSize];
+    char resource[kResourceSize];
+
+    HttpMethod method;
+    HttpCode status;
+    uint32_t base;
+    int64_t timestamp;          // Completion, in microseconds since the epoch
+    int64_t phases[kPhases];    // Nanoseconds
+};
+
+/**
+ * A fixed-size ring of the most recent traces recorded on one event base.
+ *
+ * The base's thread is the only writer; any thread may read. Each slot is
+ * guarded by a sequence number that is odd while the slot is being
+ * written, so readers copy a slot and discard it if the sequence changed.
+ * Neither side ever blocks.
+ */
+class TraceRing {
+public:
+    explicit TraceRing(size_t capacity);
+
+    // Append a trace, overwriting the oldest; owning thread only
+    void push(Trace const& trace);
+
+    // Append a consistent copy of every trace in the ring to out
+    void collect(std::vector<Trace> *out) const;
+
+    // Requests remaining until the next sample; owning thread only
+    int64_t countdown = 1;
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq{0};
+        Trace trace;
+    };
+
+    const size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    uint64_t head_ = 0;
+};
+
+/**
+ * Samples requests into per-base rings.
+ *
+ * One request in every `period` is traced on each base. Deciding whether
+ * to trace a request costs a decrement and a branch; the period is only
+ * consulted when the countdown expires, so a change takes effect within
+ * one period (or kRecheck requests, while tracing is disabled).
+ */
+class Tracer {
+public:
+    static const size_t kDefaultCapacity = 1024;
+    static const uint32_t kDefaultPeriod = 1000;
+    static const int64_t kRecheck = 4096;
+
+    explicit Tracer(size_t bases, size_t capacity = kDefaultCapacity);
+
+    // The ring for a base, by index
+    TraceRing* ring(size_t base) { return rings_[base].get(); }
+
+    // Whether to trace the next request on a base; owning thread only
+    bool sample(TraceRing *ring) {
+        if (--ring->countdown > 0) {
+            return false;
+        }
+        return resample(ring);
+    }
+
+    // Trace one request in every period; 0 disables tracing
+    void setPeriod(uint32_t period) {
+        period_.store(period, std::memory_order_relaxed);
+    }
+
+    uint32_t period() const {
+        return period_.load(std::memory_order_relaxed);
+    }
+
+    // Copy out the traces held by every ring
+    std::vector<Trace> collect() const;
+private:
+    bool resample(TraceRing *ring);
+
+    std::vector<std::unique_ptr<TraceRing>> rings_;
+    std::atomic<uint32_t> period_{kDefaultPeriod};
+};
+
+} // topper namespace
+
+#endif // SRC_TRACER_H_
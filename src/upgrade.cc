@@ -0,0 +1,349 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "upgrade.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "logging.h"
+
+namespace topper {
+
+namespace {
+
+// The first descriptor passed by socket activation
+const int kListenFdsStart = 3;
+
+const char kApplication[] = "application";
+const char kAdmin[] = "admin";
+
+// The most sockets handed off at once
+const size_t kMaxListeners = 16;
+
+// Sent by the new process once it is serving the sockets
+const char kAcknowledged = 'k';
+
+std::runtime_error socketError(const char *what) {
+    return std::runtime_error(std::string(what) + ": " + strerror(errno));
+}
+
+bool unixAddress(std::string const& path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr->sun_path)) {
+        return false;
+    }
+    memcpy(addr->sun_path, path.c_str(), path.size());
+    return true;
+}
+
+std::vector<std::string> split(std::string const& s, char sep) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    for (;;) {
+        size_t end = s.find(sep, start);
+        parts.push_back(s.substr(start, end - start));
+        if (end == std::string::npos) {
+            return parts;
+        }
+        start = end + 1;
+    }
+}
+
+} // anonymous namespace
+
+ListenerFds activatedListeners(const char *pid, const char *fds,
+        const char *names, int self) {
+    ListenerFds listeners;
+    if (!pid || !fds || atoi(pid) != self) {
+        return listeners;
+    }
+    int count = atoi(fds);
+    std::vector<std::string> named = names ? split(names, ':')
+        : std::vector<std::string>();
+    for (int i = 0; i < count; ++i) {
+        int fd = kListenFdsStart + i;
+        bool admin = static_cast<size_t>(i) < named.size()
+            ? named[i] == kAdmin : named.empty() && i == 1;
+        (admin ? listeners.admin : listeners.application).push_back(fd);
+    }
+    return listeners;
+}
+
+ListenerFds activatedListeners() {
+    ListenerFds listeners = activatedListeners(getenv("LISTEN_PID"),
+        getenv("LISTEN_FDS"), getenv("LISTEN_FDNAMES"), getpid());
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    for (auto const *fds : {&listeners.application, &listeners.admin}) {
+        for (int fd : *fds) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+    return listeners;
+}
+
+ListenerFds receiveListeners(std::string const& path) {
+    ListenerFds listeners;
+    struct sockaddr_un addr;
+    if (!unixAddress(path, &addr)) {
+        return listeners;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return listeners;
+    }
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+            sizeof(addr)) != 0) {
+        // Nobody to take over from
+        close(fd);
+        return listeners;
+    }
+
+    // The socket names, one per line, with the sockets attached
+    char names[kMaxListeners * sizeof(kApplication)] = {};
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(kMaxListeners * sizeof(int))];
+    } control;
+    struct iovec iov = { names, sizeof(names) - 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        close(fd);
+        return listeners;
+    }
+
+    std::vector<int> fds;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c;
+            c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int *data = reinterpret_cast<const int*>(CMSG_DATA(c));
+            fds.insert(fds.end(), data, data + count);
+        }
+    }
+    std::vector<std::string> named = split(std::string(names, n), '\n');
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (i < named.size() && named[i] == kAdmin) {
+            listeners.admin.push_back(fds[i]);
+        } else if (i < named.size() && named[i] == kApplication) {
+            listeners.application.push_back(fds[i]);
+        } else {
+            close(fds[i]);
+        }
+    }
+    if (listeners.application.empty() && listeners.admin.empty()) {
+        close(fd);
+    } else {
+        listeners.sender = fd;
+    }
+    return listeners;
+}
+
+void acknowledgeListeners(int sender) {
+    ssize_t ret;
+    do {
+        ret = send(sender, &kAcknowledged, 1, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1) {
+        // The old server gave up waiting, and is still serving
+        PLOG(WARNING) << "Acknowledging listeners";
+    }
+    close(sender);
+}
+
+UpgradeServer::UpgradeServer(std::string const& path,
+        ListenersFn const& listeners, HandedOffFn const& handedOff,
+        std::chrono::milliseconds timeout)
+        : path_(path), listeners_(listeners), handedOff_(handedOff),
+          timeout_(timeout) {
+    struct sockaddr_un addr;
+    if (!unixAddress(path, &addr)) {
+        throw std::runtime_error("Upgrade socket path is too long: " + path);
+    }
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        throw socketError("socket");
+    }
+
+    // Any process that was bound here has handed over already
+    unlink(path.c_str());
+    if (bind(fd_, reinterpret_cast<struct sockaddr*>(&addr),
+            sizeof(addr)) != 0 || listen(fd_, 1) != 0) {
+        std::runtime_error error = socketError("upgrade socket");
+        close(fd_);
+        throw error;
+    }
+    if (pipe2(wake_, O_CLOEXEC) != 0) {
+        std::runtime_error error = socketError("pipe");
+        close(fd_);
+        throw error;
+    }
+    thread_ = std::thread([this]() { serve(); });
+}
+
+UpgradeServer::~UpgradeServer() {
+    char quit = 'q';
+    ssize_t ret = write(wake_[1], &quit, 1);
+    (void) ret;
+    thread_.join();
+    close(wake_[0]);
+    close(wake_[1]);
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void UpgradeServer::serve() {
+    for (;;) {
+        struct pollfd polled[2] = {
+            { fd_, POLLIN, 0 },
+            { wake_[0], POLLIN, 0 },
+        };
+        if (poll(polled, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOG(ERROR) << "poll";
+            return;
+        }
+        if (polled[1].revents) {
+            return;
+        }
+        if (!polled[0].revents) {
+            continue;
+        }
+
+        int conn = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) {
+            continue;
+        }
+        ListenerFds listeners = listeners_();
+        std::string names;
+        std::vector<int> fds;
+        for (int fd : listeners.application) {
+            names.append(kApplication).append("\n");
+            fds.push_back(fd);
+        }
+        for (int fd : listeners.admin) {
+            names.append(kAdmin).append("\n");
+            fds.push_back(fd);
+        }
+        if (fds.size() > kMaxListeners) {
+            LOG(WARNING) << "Too many listeners to hand off";
+            for (int fd : fds) {
+                close(fd);
+            }
+            close(conn);
+            continue;
+        }
+        if (fds.empty()) {
+            // Stopped already; the new process binds its own sockets
+            close(conn);
+            continue;
+        }
+
+        union {
+            struct cmsghdr header;
+            char buf[CMSG_SPACE(kMaxListeners * sizeof(int))];
+        } control;
+        memset(&control, 0, sizeof(control));
+        struct iovec iov = { &names[0], names.size() };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(fds.size() * sizeof(int));
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+        memcpy(CMSG_DATA(c), fds.data(), fds.size() * sizeof(int));
+
+        ssize_t sent;
+        do {
+            sent = sendmsg(conn, &msg, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+        for (int fd : fds) {
+            close(fd);
+        }
+        if (sent < 0) {
+            PLOG(WARNING) << "Handing off listeners";
+            close(conn);
+            continue;
+        }
+
+        // Keep serving until the new process has started
+        struct pollfd waited[2] = {
+            { conn, POLLIN, 0 },
+            { wake_[0], POLLIN, 0 },
+        };
+        int ready;
+        do {
+            ready = poll(waited, 2, timeout_.count());
+        } while (ready < 0 && errno == EINTR);
+        if (ready > 0 && waited[1].revents) {
+            close(conn);
+            return;
+        }
+        char ack = 0;
+        bool started = ready > 0 && read(conn, &ack, 1) == 1 &&
+            ack == kAcknowledged;
+        close(conn);
+        if (!started) {
+            LOG(WARNING) << "The new process did not take over the "
+                "listeners; still serving";
+            continue;
+        }
+
+        LOG(INFO) << "Handed off listeners; stopping";
+        close(fd_);
+        fd_ = -1;
+        handedOff_();
+        return;
+    }
+}
+
+} // topper namespace
@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_UPGRADE_H_
+#define SRC_UPGRADE_H_
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace topper {
+
+// Listening sockets handed from one server process to the next
+struct ListenerFds {
+    std::vector<int> application;
+    std::vector<int> admin;
+
+    // The connection to the process that sent the sockets, if they were
+    // received from one; it keeps serving them until told otherwise
+    int sender = -1;
+};
+
+/**
+ * Listening sockets passed by systemd-style socket activation, from the
+ * LISTEN_PID, LISTEN_FDS and LISTEN_FDNAMES environment variables. Sockets
+ * named "admin" are the admin server's and the rest the application's;
+ * without names, the second socket is the admin server's. The variables
+ * are removed, so that child processes don't inherit them.
+ */
+ListenerFds activatedListeners();
+
+// As above, from the variables' values; visible for testing
+ListenerFds activatedListeners(const char *pid, const char *fds,
+    const char *names, int self);
+
+/**
+ * Receives the listening sockets of a running server that serves handoff
+ * requests on a Unix socket. That server drains and stops once the
+ * receiver acknowledges them; if the sender is closed without an
+ * acknowledgement, it carries on serving.
+ *
+ * @param[in] path the Unix socket
+ * @return the sockets, or none if no server is serving handoff requests
+ */
+ListenerFds receiveListeners(std::string const& path);
+
+// Tell the server that sent the sockets that they are being served here,
+// and close the connection to it
+void acknowledgeListeners(int sender);
+
+/**
+ * Hands a running server's listening sockets to its replacement.
+ *
+ * Serves a Unix socket from a background thread. When a new process
+ * connects, the listeners are sent to it over the socket (SCM_RIGHTS). Once
+ * the new process acknowledges that it has started, the old server is told
+ * to stop; the sockets stay open throughout, so no connections are refused
+ * while the processes change over. Without an acknowledgement, the old
+ * server keeps serving and waits for the next attempt.
+ */
+class UpgradeServer {
+public:
+    // Duplicates of the listening sockets, which are closed once sent
+    typedef std::function<ListenerFds()> ListenersFn;
+    typedef std::function<void()> HandedOffFn;
+
+    // Binds the socket, replacing any stale one; throws std::runtime_error.
+    // A new process that hasn't acknowledged the sockets within the timeout
+    // is taken to have failed.
+    UpgradeServer(std::string const& path, ListenersFn const& listeners,
+        HandedOffFn const& handedOff,
+        std::chrono::milliseconds timeout = std::chrono::seconds(30));
+    ~UpgradeServer();
+private:
+    void serve();
+
+    const std::string path_;
+    ListenersFn listeners_;
+    HandedOffFn handedOff_;
+    const std::chrono::milliseconds timeout_;
+    int fd_ = -1;
+    int wake_[2] = {-1, -1};
+    std::thread thread_;
+};
+
+} // topper namespace
+
+#endif // SRC_UPGRADE_H_
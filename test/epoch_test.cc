@@ -0,0 +1,108 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "epoch.h"
+
+namespace topper {
+namespace {
+
+TEST(EpochTest, ReclaimableWithoutReaders) {
+    uint64_t retired = Epoch::retire();
+    EXPECT_TRUE(Epoch::reclaimable(retired));
+}
+
+TEST(EpochTest, ReadersHoldBackReclamation) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool entered = false;
+    bool leave = false;
+
+    std::thread reader([&]() {
+        Epoch::Guard guard;
+        std::unique_lock<std::mutex> lock(mutex);
+        entered = true;
+        cv.notify_all();
+        cv.wait(lock, [&]() { return leave; });
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return entered; });
+    }
+    uint64_t retired = Epoch::retire();
+    EXPECT_FALSE(Epoch::reclaimable(retired));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        leave = true;
+    }
+    cv.notify_all();
+    reader.join();
+    EXPECT_TRUE(Epoch::reclaimable(retired));
+
+    // Readers that enter later can't see what was retired
+    Epoch::Guard guard;
+    EXPECT_TRUE(Epoch::reclaimable(retired));
+}
+
+TEST(EpochTest, GuardsNest) {
+    uint64_t retired;
+    {
+        Epoch::Guard outer;
+        {
+            Epoch::Guard inner;
+        }
+        retired = Epoch::retire();
+        EXPECT_FALSE(Epoch::reclaimable(retired));
+    }
+    EXPECT_TRUE(Epoch::reclaimable(retired));
+}
+
+TEST(EpochTest, PinsHoldBackReclamationUntilLeft) {
+    Epoch::Pin pin;
+    pin.enter();
+    uint64_t retired = Epoch::retire();
+
+    // A pin may be left on another thread than the one that entered it
+    std::thread other([&]() {
+        EXPECT_FALSE(Epoch::reclaimable(retired));
+        pin.enter();
+        EXPECT_FALSE(Epoch::reclaimable(retired));
+        pin.leave();
+    });
+    other.join();
+    EXPECT_TRUE(Epoch::reclaimable(retired));
+
+    // Entered again, it only holds back what is retired later
+    pin.enter();
+    EXPECT_TRUE(Epoch::reclaimable(retired));
+    EXPECT_FALSE(Epoch::reclaimable(Epoch::retire()));
+}
+
+} // anonymous namespace
+} // topper namespace
@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "histogram.h"
+
+namespace topper {
+
+TEST(HistogramTest, EmptyHistogramReportsZero) {
+    Histogram h;
+    EXPECT_EQ(0U, h.count());
+    EXPECT_EQ(0U, h.min());
+    EXPECT_EQ(0U, h.max());
+    EXPECT_EQ(0U, h.percentile(50));
+}
+
+TEST(HistogramTest, SmallValuesAreExact) {
+    for (uint64_t v = 0; v < 256; ++v) {
+        EXPECT_EQ(v, Histogram::highestEquivalent(Histogram::index(v)));
+    }
+}
+
+TEST(HistogramTest, BucketsAreContiguousAndPrecise) {
+    size_t last = Histogram::index(255);
+    for (uint64_t v = 256; v < (1 << 18); ++v) {
+        size_t index = Histogram::index(v);
+        EXPECT_LE(last, index);
+        EXPECT_GE(last + 1, index);
+        last = index;
+
+        uint64_t equivalent = Histogram::highestEquivalent(index);
+        EXPECT_LE(v, equivalent);
+        EXPECT_LT(equivalent - v, v / 100 + 1);
+    }
+    EXPECT_EQ(UINT64_MAX, Histogram::highestEquivalent(
+        Histogram::index(UINT64_MAX)));
+}
+
+TEST(HistogramTest, Percentiles) {
+    Histogram h;
+    for (uint64_t v = 1; v <= 10000; ++v) {
+        h.record(v * 1000);
+    }
+    EXPECT_EQ(10000U, h.count());
+    EXPECT_EQ(1000U, h.min());
+    EXPECT_EQ(10000000U, h.max());
+    EXPECT_NEAR(5000500.0, h.mean(), 1.0);
+    EXPECT_NEAR(5000000.0, h.percentile(50), 5000000 * 0.01);
+    EXPECT_NEAR(9900000.0, h.percentile(99), 9900000 * 0.01);
+    EXPECT_NEAR(9999000.0, h.percentile(99.99), 9999000 * 0.01);
+    EXPECT_EQ(h.max(), h.percentile(100));
+}
+
+TEST(HistogramTest, MergeCombinesCounts) {
+    Histogram a;
+    Histogram b;
+    a.record(10);
+    b.record(1000000);
+    a.merge(b);
+    EXPECT_EQ(2U, a.count());
+    EXPECT_EQ(10U, a.min());
+    EXPECT_EQ(1000000U, a.max());
+    EXPECT_EQ(10U, a.percentile(50));
+}
+
+} // topper namespace
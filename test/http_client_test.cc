@@ -0,0 +1,216 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "wte/event_base.h"
+
+#include "http_client.h"
+#include "server.h"
+#include "util.h"
+
+namespace topper {
+namespace {
+
+class HelloResource : public Resource {
+public:
+    HelloResource() : Resource("/hello") { }
+    Response get() const {
+        return Response(HttpCode::OK, MediaType::TEXT_PLAIN, "hello");
+    }
+};
+
+// Holds requests until the test releases them
+class StallResource : public Resource {
+public:
+    StallResource() : Resource("/stall") { }
+
+    void get(AsyncResponse const& response) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        saved_.push_back(response);
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto const& response : saved_) {
+            response.complete(Response(HttpCode::OK));
+        }
+        saved_.clear();
+    }
+private:
+    mutable std::mutex mutex_;
+    mutable std::vector<AsyncResponse> saved_;
+};
+
+struct Result {
+    ClientError error;
+    ClientResponse response;
+};
+
+// Issue a request and wait for its outcome
+Result call(HttpClient *client, std::string const& method, short port,
+        std::string const& path) {
+    std::promise<Result> promise;
+    client->request(method, "127.0.0.1", port, path, HttpClient::Headers(),
+        std::string(),
+        [&promise](ClientError error, ClientResponse const& response) {
+            promise.set_value(Result{error, response});
+        });
+    return promise.get_future().get();
+}
+
+} // anonymous namespace
+
+class HttpClientTest : public ::testing::Test {
+protected:
+    HttpClientTest() : port(ports.get()), server("127.0.0.1", port) {
+        server.registerResource(&hello);
+        server.registerResource(&stall);
+        server.start();
+    }
+
+    ~HttpClientTest() {
+        stall.release();
+    }
+
+    static EphemeralPorts ports;
+
+    short port;
+    HelloResource hello;
+    StallResource stall;
+    Server server;
+};
+
+EphemeralPorts HttpClientTest::ports{};
+
+TEST_F(HttpClientTest, ReceivesResponses) {
+    HttpClient client(&server);
+    Result result = call(&client, "GET", port, "/hello");
+    ASSERT_EQ(ClientError::NONE, result.error);
+    EXPECT_EQ(200, result.response.status);
+    EXPECT_EQ("hello", result.response.body);
+    EXPECT_EQ("5", result.response.header("content-length"));
+
+    result = call(&client, "GET", port, "/missing");
+    ASSERT_EQ(ClientError::NONE, result.error);
+    EXPECT_EQ(404, result.response.status);
+}
+
+TEST_F(HttpClientTest, HeadResponsesHaveNoBody) {
+    HttpClient client(&server);
+    Result result = call(&client, "HEAD", port, "/hello");
+    ASSERT_EQ(ClientError::NONE, result.error);
+    EXPECT_EQ(200, result.response.status);
+    EXPECT_EQ("5", result.response.header("Content-Length"));
+    EXPECT_TRUE(result.response.body.empty());
+
+    // The connection remains usable
+    result = call(&client, "GET", port, "/hello");
+    ASSERT_EQ(ClientError::NONE, result.error);
+    EXPECT_EQ("hello", result.response.body);
+}
+
+TEST_F(HttpClientTest, PipelinedRequestsCompleteInOrder) {
+    wte::EventBase *base = wte::mkEventBase();
+    std::thread loop([base]() {
+            base->loop(wte::EventBase::LoopMode::FOREVER);
+        });
+
+    HttpClientOptions options;
+    options.maxConnectionsPerHost = 1;
+    options.pipelineDepth = 8;
+    HttpClient *client = new HttpClient(base, options);
+
+    const size_t kRequests = 32;
+    std::mutex mutex;
+    std::vector<size_t> order;
+    std::promise<void> done;
+    for (size_t i = 0; i < kRequests; ++i) {
+        client->get("127.0.0.1", port, "/hello",
+            [&, i](ClientError error, ClientResponse const& response) {
+                std::lock_guard<std::mutex> lock(mutex);
+                EXPECT_EQ(ClientError::NONE, error);
+                EXPECT_EQ("hello", response.body);
+                order.push_back(i);
+                if (order.size() == kRequests) {
+                    done.set_value();
+                }
+            });
+    }
+    done.get_future().wait();
+
+    // A single connection answers in the order requests were written
+    for (size_t i = 0; i < kRequests; ++i) {
+        EXPECT_EQ(i, order[i]);
+    }
+
+    // A client on a caller-driven base is destroyed once the loop exits
+    base->stop();
+    loop.join();
+    delete client;
+    delete base;
+}
+
+TEST_F(HttpClientTest, ConnectionsCanBeClosedAfterEachRequest) {
+    HttpClientOptions options;
+    options.keepAlive = false;
+    HttpClient client(&server, options);
+    for (int i = 0; i < 3; ++i) {
+        Result result = call(&client, "GET", port, "/hello");
+        ASSERT_EQ(ClientError::NONE, result.error);
+        EXPECT_EQ("close", result.response.header("Connection"));
+    }
+}
+
+TEST_F(HttpClientTest, RequestsTimeOut) {
+    HttpClientOptions options;
+    options.requestTimeout = std::chrono::milliseconds(50);
+    HttpClient client(&server, options);
+    Result result = call(&client, "GET", port, "/stall");
+    EXPECT_EQ(ClientError::TIMEOUT, result.error);
+}
+
+TEST_F(HttpClientTest, RefusedConnectionsFail) {
+    HttpClient client(&server);
+    Result result = call(&client, "GET", ports.get(), "/hello");
+    EXPECT_EQ(ClientError::CONNECT, result.error);
+}
+
+TEST_F(HttpClientTest, InvalidHostThrows) {
+    HttpClient client(&server);
+    ASSERT_THROW({client.get("localhost", port, "/", nullptr);},
+        std::invalid_argument);
+}
+
+TEST_F(HttpClientTest, ClientRequiresRunningServer) {
+    Server stopped("127.0.0.1", ports.get());
+    ASSERT_THROW({HttpClient client(&stopped);}, std::logic_error);
+}
+
+} // topper namespace
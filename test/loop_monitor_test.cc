@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "wte/event_base.h"
+
+#include "loop_monitor.h"
+
+namespace topper {
+namespace {
+
+class LoopMonitorTest : public ::testing::Test {
+protected:
+    LoopMonitorTest() : base(wte::mkEventBase()) {
+        thread = std::thread([this]() {
+                base->loop(wte::EventBase::LoopMode::FOREVER);
+            });
+        base->runOnEventLoopAndWait([]() { }, /*defer=*/ true);
+    }
+
+    ~LoopMonitorTest() {
+        base->stop();
+        thread.join();
+        delete base;
+    }
+
+    // Occupy the base for a while
+    void block(std::chrono::milliseconds duration) {
+        base->runOnEventLoopAndWait([duration]() {
+                auto until = std::chrono::steady_clock::now() + duration;
+                while (std::chrono::steady_clock::now() < until) { }
+            });
+    }
+
+    MetricRegistry metrics;
+    wte::EventBase *base;
+    std::thread thread;
+};
+
+TEST_F(LoopMonitorTest, MeasuresLagAndBusyTime) {
+    LoopMonitor monitor(&metrics, std::chrono::milliseconds(10));
+    monitor.monitor(base, "0");
+
+    // Let an idle probe or two run, then spin on the loop
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    block(std::chrono::milliseconds(100));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    monitor.stop();
+
+    TimerSnapshot lag = metrics.timer("topper.base.lag",
+        {{"base", "0"}})->snapshot();
+    EXPECT_LT(2u, lag.count);
+    // The probe that was due while the loop spun ran late
+    EXPECT_LE(50000000u, lag.max);
+
+    int64_t busy = metrics.counter("topper.base.busy_ns",
+        {{"base", "0"}})->count();
+    int64_t idle = metrics.counter("topper.base.idle_ns",
+        {{"base", "0"}})->count();
+    EXPECT_LE(80000000, busy);
+    EXPECT_LT(0, idle);
+}
+
+TEST_F(LoopMonitorTest, StopCancelsProbes) {
+    LoopMonitor monitor(&metrics, std::chrono::milliseconds(5));
+    monitor.monitor(base, "0");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    monitor.stop();
+
+    Timer *lag = metrics.timer("topper.base.lag", {{"base", "0"}});
+    uint64_t count = lag->snapshot().count;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(count, lag->snapshot().count);
+}
+
+} // anonymous namespace
+} // topper namespace
@@ -0,0 +1,183 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "metric_registry.h"
+
+namespace topper {
+
+TEST(MetricRegistryTest, MetricsAreKeyedByNameAndLabels) {
+    MetricRegistry registry;
+    Counter *a = registry.counter("requests", {{"route", "/a"}});
+    Counter *b = registry.counter("requests", {{"route", "/b"}});
+    EXPECT_NE(a, b);
+    EXPECT_EQ(a, registry.counter("requests", {{"route", "/a"}}));
+    EXPECT_NE(a, registry.counter("requests"));
+    EXPECT_EQ("requests", a->name());
+    EXPECT_EQ("/a", a->labels()[0].second);
+}
+
+TEST(MetricRegistryTest, CountersMergeAcrossThreads) {
+    const int kThreads = 8;
+    const int kIncrements = 10000;
+
+    MetricRegistry registry;
+    Counter *counter = registry.counter("merged");
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        threads.emplace_back([counter]() {
+                for (int j = 0; j < kIncrements; ++j) {
+                    counter->increment();
+                }
+                counter->decrement(kIncrements / 2);
+            });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Recorded values survive their threads
+    EXPECT_EQ(kThreads * kIncrements / 2, counter->count());
+}
+
+TEST(MetricRegistryTest, RegistriesDoNotShareCells) {
+    MetricRegistry r1;
+    MetricRegistry r2;
+    r1.counter("c")->increment(3);
+    r2.counter("c")->increment(5);
+    EXPECT_EQ(3, r1.counter("c")->count());
+    EXPECT_EQ(5, r2.counter("c")->count());
+}
+
+TEST(MetricRegistryTest, TimerBucketsBoundTheirValues) {
+    for (uint64_t v = 0; v < (1ULL << 20); ++v) {
+        size_t bucket = Timer::bucket(v);
+        ASSERT_LT(bucket, Timer::kBuckets);
+        ASSERT_LE(v, Timer::upperBound(bucket));
+        // 1/16 relative precision above the exact range
+        ASSERT_LE(Timer::upperBound(bucket) - v, v / 16);
+    }
+
+    // Values past the range saturate
+    EXPECT_EQ(Timer::kBuckets - 1, Timer::bucket(UINT64_MAX));
+}
+
+TEST(MetricRegistryTest, TimerSnapshotMergesThreads) {
+    MetricRegistry registry;
+    Timer *timer = registry.timer("latency");
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([timer, i]() {
+                for (int j = 1; j <= 250; ++j) {
+                    timer->update(std::chrono::microseconds(i * 250 + j));
+                }
+            });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    TimerSnapshot snapshot = timer->snapshot();
+    EXPECT_EQ(1000u, snapshot.count);
+    EXPECT_EQ(1000000u, snapshot.max);
+    EXPECT_NEAR(500500.0, snapshot.mean(), 1.0);
+
+    auto within = [](uint64_t expected, uint64_t actual) {
+        return actual >= expected && actual - expected <= expected / 16;
+    };
+    EXPECT_TRUE(within(500000, snapshot.percentile(50)));
+    EXPECT_TRUE(within(990000, snapshot.percentile(99)));
+    EXPECT_EQ(1000000u, snapshot.percentile(100));
+}
+
+TEST(MetricRegistryTest, ExitedThreadsAreFolded) {
+    auto shards = []() {
+        size_t count = 0;
+        detail::Shard::forEach([&count](detail::Shard const&) { ++count; });
+        return count;
+    };
+
+    MetricRegistry registry;
+    Counter *counter = registry.counter("folded");
+    Timer *timer = registry.timer("folded");
+    std::thread([counter]() { counter->increment(); }).join();
+    size_t before = shards();
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i <= 8; ++i) {
+        threads.emplace_back([counter, timer, i]() {
+                counter->increment(i);
+                timer->update(std::chrono::microseconds(i));
+            });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(before, shards());
+    EXPECT_EQ(37, counter->count());
+    TimerSnapshot snapshot = timer->snapshot();
+    EXPECT_EQ(8u, snapshot.count);
+    EXPECT_EQ(8000u, snapshot.max);
+}
+
+TEST(MetricRegistryTest, ReleasedMetricsAreRemovedAndReused) {
+    MetricRegistry registry;
+    Counter *counter = registry.counter("released");
+    EXPECT_EQ(counter, registry.counter("released"));
+    counter->increment(3);
+    std::thread([counter]() { counter->increment(4); }).join();
+
+    auto names = [&registry]() {
+        size_t count = 0;
+        registry.forEachCounter([&count](Counter const&) { ++count; });
+        return count;
+    };
+
+    // Removed only when every lookup has been released
+    registry.release(counter);
+    EXPECT_EQ(1u, names());
+    registry.release(counter);
+    EXPECT_EQ(0u, names());
+
+    // The storage is reused, and starts from zero
+    Counter *reused = registry.counter("reused");
+    EXPECT_EQ(0, reused->count());
+    reused->increment();
+    EXPECT_EQ(1, reused->count());
+}
+
+TEST(MetricRegistryTest, EmptyTimer) {
+    MetricRegistry registry;
+    TimerSnapshot snapshot = registry.timer("empty")->snapshot();
+    EXPECT_EQ(0u, snapshot.count);
+    EXPECT_EQ(0u, snapshot.percentile(99));
+    EXPECT_EQ(0, snapshot.mean());
+}
+
+} // topper namespace
@@ -0,0 +1,135 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include <gtest/gtest.h>
+
+#include "metrics_resource.h"
+#include "parameter_internal.h"
+
+namespace topper {
+namespace {
+
+// The body of a response, which follows the blank line
+std::string body(Response const& response) {
+    std::string full = response.to_string();
+    return full.substr(full.find("\r\n\r\n") + 4);
+}
+
+bool contains(std::string const& haystack, std::string const& needle) {
+    return haystack.find(needle) != std::string::npos;
+}
+
+QueryParamsImpl prefixes(std::initializer_list<std::string> values) {
+    std::unordered_multimap<std::string, std::string> params;
+    for (auto const& value : values) {
+        params.emplace("prefix", value);
+    }
+    return QueryParamsImpl(std::move(params));
+}
+
+class MetricsResourceTest : public ::testing::Test {
+protected:
+    MetricsResourceTest() {
+        registry.counter("topper.resource.responses",
+            {{"resource", "/users/{id}"}, {"status", "2xx"}})->increment(3);
+        registry.counter("other.count")->increment();
+        Gauge *gauge = registry.gauge("other.level", {{"base", "0"}});
+        gauge->increment(2);
+        gauge->decrement();
+        Timer *timer = registry.timer("topper.resource.latency",
+            {{"resource", "/users/{id}"}, {"method", "GET"}});
+        timer->update(std::chrono::microseconds(200));
+        timer->update(std::chrono::milliseconds(20));
+    }
+
+    MetricRegistry registry;
+};
+
+TEST_F(MetricsResourceTest, Json) {
+    std::string json = body(MetricsResource(&registry).get());
+    EXPECT_TRUE(contains(json,
+        "\"topper.resource.responses{resource=/users/{id},status=2xx}\":3"));
+    EXPECT_TRUE(contains(json, "\"other.count\":1"));
+    EXPECT_TRUE(contains(json,
+        "\"gauges\":{\"other.level{base=0}\":1}"));
+    EXPECT_TRUE(contains(json,
+        "\"topper.resource.latency{resource=/users/{id},method=GET}\":"
+        "{\"count\":2,"));
+}
+
+TEST_F(MetricsResourceTest, PrometheusNamesAndLabels) {
+    std::string text = body(PrometheusResource(&registry).get(prefixes({})));
+    EXPECT_TRUE(contains(text,
+        "# TYPE topper_resource_responses_total counter\n"
+        "topper_resource_responses_total"
+        "{resource=\"/users/{id}\",status=\"2xx\"} 3\n"));
+    EXPECT_TRUE(contains(text, "other_count_total 1\n"));
+    EXPECT_TRUE(contains(text,
+        "# TYPE other_level gauge\nother_level{base=\"0\"} 1\n"));
+    EXPECT_TRUE(contains(text,
+        "# TYPE topper_resource_latency_seconds histogram\n"));
+
+    // Buckets are cumulative
+    const std::string series =
+        "topper_resource_latency_seconds_bucket"
+        "{resource=\"/users/{id}\",method=\"GET\",";
+    EXPECT_TRUE(contains(text, series + "le=\"0.0001\"} 0\n"));
+    EXPECT_TRUE(contains(text, series + "le=\"0.00025\"} 1\n"));
+    EXPECT_TRUE(contains(text, series + "le=\"0.025\"} 2\n"));
+    EXPECT_TRUE(contains(text, series + "le=\"+Inf\"} 2\n"));
+    EXPECT_TRUE(contains(text, "topper_resource_latency_seconds_count"
+        "{resource=\"/users/{id}\",method=\"GET\"} 2\n"));
+    EXPECT_TRUE(contains(text, "topper_resource_latency_seconds_sum"
+        "{resource=\"/users/{id}\",method=\"GET\"} 0.0202\n"));
+}
+
+TEST_F(MetricsResourceTest, PrometheusPrefixFilter) {
+    PrometheusResource resource(&registry);
+
+    // Prefixes may be given in either naming scheme
+    for (auto const& prefix : {"topper_resource", "topper.resource"}) {
+        std::string text = body(resource.get(prefixes({prefix})));
+        EXPECT_TRUE(contains(text, "topper_resource_responses_total"));
+        EXPECT_TRUE(contains(text, "topper_resource_latency_seconds"));
+        EXPECT_FALSE(contains(text, "other_count"));
+    }
+
+    std::string text = body(resource.get(
+        prefixes({"other", "topper_resource_lat"})));
+    EXPECT_TRUE(contains(text, "other_count_total"));
+    EXPECT_TRUE(contains(text, "topper_resource_latency_seconds"));
+    EXPECT_FALSE(contains(text, "topper_resource_responses"));
+}
+
+TEST_F(MetricsResourceTest, PrometheusEscapesLabelValues) {
+    MetricRegistry escaped;
+    escaped.counter("c", {{"path", "a\"b\\c\nd"}})->increment();
+    std::string text = body(PrometheusResource(&escaped).get(prefixes({})));
+    EXPECT_TRUE(contains(text, "c_total{path=\"a\\\"b\\\\c\\nd\"} 1\n"));
+}
+
+} // anonymous namespace
+} // topper namespace
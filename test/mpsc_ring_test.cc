@@ -0,0 +1,99 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mpsc_ring.h"
+
+namespace topper {
+namespace {
+
+TEST(MpscRingTest, RoundsCapacityUp) {
+    EXPECT_EQ(1u, MpscRing<int>(1).capacity());
+    EXPECT_EQ(8u, MpscRing<int>(5).capacity());
+    EXPECT_EQ(64u, MpscRing<int>(64).capacity());
+}
+
+TEST(MpscRingTest, FirstInFirstOut) {
+    MpscRing<int> ring(4);
+    int value;
+    EXPECT_FALSE(ring.pop(&value));
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(ring.push(i));
+    }
+    EXPECT_FALSE(ring.push(4));
+
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(ring.pop(&value));
+        EXPECT_EQ(i, value);
+    }
+    EXPECT_FALSE(ring.pop(&value));
+
+    // Cells are reused as the ring wraps
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_TRUE(ring.push(i));
+        ASSERT_TRUE(ring.pop(&value));
+        EXPECT_EQ(i, value);
+    }
+}
+
+TEST(MpscRingTest, ProducersDeliverEverything) {
+    const int kProducers = 4;
+    const int kPerProducer = 100000;
+    MpscRing<int> ring(256);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&ring, p]() {
+            for (int i = 0; i < kPerProducer; ++i) {
+                while (!ring.push(p * kPerProducer + i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Each producer's values arrive in order, and none are lost
+    std::vector<int> next(kProducers, 0);
+    int value;
+    for (int received = 0; received < kProducers * kPerProducer; ) {
+        if (!ring.pop(&value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        int p = value / kPerProducer;
+        ASSERT_EQ(next[p], value % kPerProducer);
+        ++next[p];
+        ++received;
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    EXPECT_FALSE(ring.pop(&value));
+}
+
+} // anonymous namespace
+} // topper namespace
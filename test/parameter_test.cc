@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "parameter.h"
+
+namespace topper {
+
+enum class Color { RED, GREEN, BLUE };
+
+template<>
+struct EnumTable<Color> {
+    static EnumEntries<Color> entries() {
+        static constexpr EnumEntry<Color> kEntries[] = {
+            { "red", Color::RED },
+            { "green", Color::GREEN },
+            { "blue", Color::BLUE },
+        };
+        return kEntries;
+    }
+};
+
+namespace {
+
+template<typename P>
+bool valid(std::string const& input) {
+    bool ok = true;
+    P::parse(input, &ok);
+    return ok;
+}
+
+TEST(ParameterTest, IntParamParsesIntegers) {
+    bool ok = true;
+    EXPECT_EQ(42, IntParam<int>::parse("42", &ok).value());
+    EXPECT_EQ(-42, IntParam<int>::parse("-42", &ok).value());
+    EXPECT_EQ(0, IntParam<int>::parse("0", &ok).value());
+    EXPECT_EQ(std::numeric_limits<int64_t>::min(),
+        IntParam<int64_t>::parse("-9223372036854775808", &ok).value());
+    EXPECT_EQ(std::numeric_limits<uint64_t>::max(),
+        IntParam<uint64_t>::parse("18446744073709551615", &ok).value());
+    EXPECT_TRUE(ok);
+}
+
+TEST(ParameterTest, IntParamRejectsMalformedInput) {
+    EXPECT_FALSE(valid<IntParam<int>>(""));
+    EXPECT_FALSE(valid<IntParam<int>>("-"));
+    EXPECT_FALSE(valid<IntParam<int>>("foo"));
+    EXPECT_FALSE(valid<IntParam<int>>("42foo"));
+    EXPECT_FALSE(valid<IntParam<int>>(" 42"));
+    EXPECT_FALSE(valid<IntParam<int>>("+42"));
+    EXPECT_FALSE(valid<IntParam<unsigned>>("-1"));
+}
+
+TEST(ParameterTest, IntParamRejectsOutOfRangeInput) {
+    EXPECT_TRUE(valid<IntParam<int8_t>>("127"));
+    EXPECT_FALSE(valid<IntParam<int8_t>>("128"));
+    EXPECT_TRUE(valid<IntParam<int8_t>>("-128"));
+    EXPECT_FALSE(valid<IntParam<int8_t>>("-129"));
+    EXPECT_TRUE(valid<IntParam<uint16_t>>("65535"));
+    EXPECT_FALSE(valid<IntParam<uint16_t>>("65536"));
+    EXPECT_FALSE(valid<IntParam<int64_t>>("9223372036854775808"));
+    EXPECT_FALSE(valid<IntParam<int64_t>>("99999999999999999999999"));
+}
+
+TEST(ParameterTest, DoubleParamParsesFiniteNumbers) {
+    bool ok = true;
+    EXPECT_DOUBLE_EQ(1.5, DoubleParam::parse("1.5", &ok).value());
+    EXPECT_DOUBLE_EQ(-0.25, DoubleParam::parse("-.25", &ok).value());
+    EXPECT_DOUBLE_EQ(3, DoubleParam::parse("3.", &ok).value());
+    EXPECT_DOUBLE_EQ(1e10, DoubleParam::parse("1e10", &ok).value());
+    EXPECT_DOUBLE_EQ(2.5e-3, DoubleParam::parse("2.5E-3", &ok).value());
+    EXPECT_TRUE(ok);
+
+    EXPECT_FALSE(valid<DoubleParam>(""));
+    EXPECT_FALSE(valid<DoubleParam>("."));
+    EXPECT_FALSE(valid<DoubleParam>("inf"));
+    EXPECT_FALSE(valid<DoubleParam>("nan"));
+    EXPECT_FALSE(valid<DoubleParam>("0x10"));
+    EXPECT_FALSE(valid<DoubleParam>("1e"));
+    EXPECT_FALSE(valid<DoubleParam>("1.5.5"));
+    EXPECT_FALSE(valid<DoubleParam>("1e999"));
+}
+
+TEST(ParameterTest, BoolParamParsesBooleans) {
+    bool ok = true;
+    EXPECT_TRUE(BoolParam::parse("true", &ok).value());
+    EXPECT_TRUE(BoolParam::parse("1", &ok).value());
+    EXPECT_FALSE(BoolParam::parse("false", &ok).value());
+    EXPECT_FALSE(BoolParam::parse("0", &ok).value());
+    EXPECT_TRUE(ok);
+
+    EXPECT_FALSE(valid<BoolParam>("yes"));
+    EXPECT_FALSE(valid<BoolParam>("TRUE"));
+    EXPECT_FALSE(valid<BoolParam>(""));
+}
+
+TEST(ParameterTest, UuidParamParsesCanonicalForm) {
+    bool ok = true;
+    auto uuid = UuidParam::parse("00112233-4455-6677-8899-aAbBcCdDeEfF", &ok);
+    ASSERT_TRUE(ok);
+    for (size_t i = 0; i < uuid.value().size(); ++i) {
+        EXPECT_EQ(i * 0x11, uuid.value()[i]);
+    }
+
+    EXPECT_FALSE(valid<UuidParam>(""));
+    EXPECT_FALSE(valid<UuidParam>("00112233445566778899aabbccddeeff"));
+    EXPECT_FALSE(valid<UuidParam>("00112233-4455-6677-8899-aabbccddeefg"));
+    EXPECT_FALSE(valid<UuidParam>("0011223-34455-6677-8899-aabbccddeeff"));
+}
+
+TEST(ParameterTest, EnumParamParsesTableNames) {
+    bool ok = true;
+    EXPECT_EQ(Color::RED, EnumParam<Color>::parse("red", &ok).value());
+    EXPECT_EQ(Color::BLUE, EnumParam<Color>::parse("blue", &ok).value());
+    EXPECT_TRUE(ok);
+
+    EXPECT_FALSE(valid<EnumParam<Color>>("Red"));
+    EXPECT_FALSE(valid<EnumParam<Color>>("purple"));
+    EXPECT_FALSE(valid<EnumParam<Color>>(""));
+}
+
+TEST(ParameterTest, DeadlinesAreCancelledWhenPassedOrFlagged) {
+    Deadline unbounded;
+    EXPECT_FALSE(unbounded.bounded());
+    EXPECT_FALSE(unbounded.cancelled());
+    EXPECT_EQ(Deadline::Clock::duration::max(), unbounded.remaining());
+
+    auto flag = std::make_shared<std::atomic<bool>>(false);
+    Deadline later(Deadline::Clock::now() + std::chrono::hours(1), flag);
+    EXPECT_TRUE(later.bounded());
+    EXPECT_FALSE(later.cancelled());
+    EXPECT_GT(later.remaining(), std::chrono::minutes(59));
+
+    // Copies share the flag
+    Deadline copy = later;
+    flag->store(true);
+    EXPECT_TRUE(copy.cancelled());
+
+    Deadline passed(Deadline::Clock::now() - std::chrono::seconds(1),
+        std::make_shared<std::atomic<bool>>(false));
+    EXPECT_TRUE(passed.cancelled());
+    EXPECT_EQ(Deadline::Clock::duration::zero(), passed.remaining());
+}
+
+} // anonymous namespace
+} // topper namespace
@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "rate_limiter.h"
+
+namespace topper {
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+RateLimit limit(double rate, size_t burst) {
+    RateLimit limit;
+    limit.rate = rate;
+    limit.burst = burst;
+    return limit;
+}
+
+TEST(RateLimiterTest, BucketAdmitsBurstThenRate) {
+    TokenBucket bucket(limit(10, 3));
+    Clock::time_point now = Clock::now();
+
+    EXPECT_TRUE(bucket.acquire(now));
+    EXPECT_TRUE(bucket.acquire(now));
+    EXPECT_TRUE(bucket.acquire(now));
+    EXPECT_FALSE(bucket.acquire(now));
+
+    // One token every 100ms
+    EXPECT_FALSE(bucket.acquire(now + std::chrono::milliseconds(50)));
+    EXPECT_TRUE(bucket.acquire(now + std::chrono::milliseconds(100)));
+    EXPECT_FALSE(bucket.acquire(now + std::chrono::milliseconds(100)));
+
+    // Idle time refills up to the burst and no further
+    now += std::chrono::seconds(10);
+    EXPECT_TRUE(bucket.acquire(now));
+    EXPECT_TRUE(bucket.acquire(now));
+    EXPECT_TRUE(bucket.acquire(now));
+    EXPECT_FALSE(bucket.acquire(now));
+}
+
+TEST(RateLimiterTest, KeysHaveIndependentBuckets) {
+    RateLimiter limiter(limit(1, 1));
+    Clock::time_point now = Clock::now();
+
+    uint64_t a = RateLimiter::key("10.0.0.1", 8);
+    uint64_t b = RateLimiter::key("10.0.0.2", 8);
+    EXPECT_NE(a, b);
+
+    EXPECT_TRUE(limiter.acquire(a, now));
+    EXPECT_FALSE(limiter.acquire(a, now));
+    EXPECT_TRUE(limiter.acquire(b, now));
+    EXPECT_FALSE(limiter.acquire(b, now));
+    EXPECT_TRUE(limiter.acquire(a, now + std::chrono::seconds(1)));
+}
+
+TEST(RateLimiterTest, RefilledSlotsAreReclaimed) {
+    // A single set
+    RateLimiter limiter(limit(1, 1), RateLimiter::kWays);
+    Clock::time_point now = Clock::now();
+
+    // Fill every slot with a client that is being limited
+    for (uint64_t key = 1; key <= RateLimiter::kWays; ++key) {
+        EXPECT_TRUE(limiter.acquire(key, now));
+        EXPECT_FALSE(limiter.acquire(key, now));
+    }
+
+    // A new client can't be tracked, and so isn't limited
+    uint64_t extra = RateLimiter::kWays + 1;
+    EXPECT_TRUE(limiter.acquire(extra, now));
+    EXPECT_TRUE(limiter.acquire(extra, now));
+
+    // Once the buckets have refilled their slots are taken over
+    now += std::chrono::seconds(2);
+    EXPECT_TRUE(limiter.acquire(extra, now));
+    EXPECT_FALSE(limiter.acquire(extra, now));
+}
+
+} // anonymous namespace
+} // topper namespace
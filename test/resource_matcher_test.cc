@@ -20,16 +20,22 @@
  * SOFTWARE.
  */
 
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 #include "detail/dispatcher.h"
 #include "detail/server-impl.h"
+#include "epoch.h"
+#include "metric_registry.h"
 #include "resource.h"
 #include "resource_matcher.h"
 #include "response.h"
+#include "route_metrics.h"
 
 namespace topper {
 namespace {
@@ -148,5 +154,249 @@ TEST(ResourceMatcherTest, MultiParameterMatching) {
     validate("/foo/baz/short/bar", &res3, 2);
 }
 
+TEST(ResourceMatcherTest, RouteMetricsAreResolvedAtRegistration) {
+    MetricRegistry registry;
+    ResourceMatcher matcher;
+
+    OneStringParamResource res {"/users/{id}"};
+    matcher.addResource(&res, detail::bindMethods(&res), &registry);
+
+    auto match = matcher.match("/users/7");
+    ASSERT_TRUE(match);
+    RouteMetrics const& metrics = match.get().route->metrics;
+
+    // Counters are cached per status class
+    metrics.count(HttpCode::OK);
+    metrics.count(HttpCode::CREATED);
+    metrics.count(HttpCode::NOT_FOUND);
+    metrics.count(HttpCode::INTERNAL_ERROR);
+    auto responses = [&registry](std::string const& status) {
+        return registry.counter("topper.resource.responses",
+            {{"resource", "/users/{id}"}, {"status", status}})->count();
+    };
+    EXPECT_EQ(2, responses("2xx"));
+    EXPECT_EQ(1, responses("4xx"));
+    EXPECT_EQ(1, responses("5xx"));
+
+    // Only bound verbs are timed
+    metrics.time(HttpMethod::GET, std::chrono::milliseconds(1));
+    metrics.time(HttpMethod::POST, std::chrono::milliseconds(1));
+    EXPECT_EQ(1u, registry.timer("topper.resource.latency",
+        {{"resource", "/users/{id}"}, {"method", "GET"}})->snapshot().count);
+    EXPECT_EQ(0u, registry.timer("topper.resource.latency",
+        {{"resource", "/users/{id}"}, {"method", "POST"}})->snapshot().count);
+}
+
+TEST(ResourceMatcherTest, RemovedRoutesReleaseTheirMetrics) {
+    MetricRegistry registry;
+    auto metrics = [&registry]() {
+        size_t count = 0;
+        registry.forEachCounter([&count](Counter const&) { ++count; });
+        registry.forEachTimer([&count](Timer const&, TimerSnapshot const&) {
+                ++count;
+            });
+        return count;
+    };
+
+    OneStringParamResource res {"/users/{id}"};
+    {
+        ResourceMatcher matcher;
+        matcher.addResource(&res, detail::bindMethods(&res), &registry);
+        size_t registered = metrics();
+        EXPECT_LT(0u, registered);
+
+        // Registering again shares the metrics until the old route is freed
+        EXPECT_TRUE(matcher.removeResource(&res));
+        matcher.addResource(&res, detail::bindMethods(&res), &registry);
+        EXPECT_EQ(registered, metrics());
+        EXPECT_TRUE(matcher.removeResource(&res));
+    }
+    EXPECT_EQ(0u, metrics());
+}
+
+TEST(ResourceMatcherTest, CollectingFreesRoutesOnceReadersLeave) {
+    MetricRegistry registry;
+    auto counters = [&registry]() {
+        size_t count = 0;
+        registry.forEachCounter([&count](Counter const&) { ++count; });
+        return count;
+    };
+
+    ResourceMatcher matcher;
+    OneStringParamResource res {"/users/{id}"};
+    matcher.addResource(&res, detail::bindMethods(&res), &registry);
+
+    // A reader holds the route across its removal
+    Epoch::Pin pin;
+    pin.enter();
+    ASSERT_TRUE(matcher.match("/users/7"));
+    EXPECT_TRUE(matcher.removeResource(&res));
+    matcher.collect();
+    EXPECT_LT(0u, counters());
+
+    // It is freed once the reader has left, without a further change
+    pin.leave();
+    matcher.collect();
+    EXPECT_EQ(0u, counters());
+}
+
+TEST(ResourceMatcherTest, StatusClasses) {
+    EXPECT_EQ(1, RouteMetrics::statusClass(HttpCode::OK));
+    EXPECT_EQ(1, RouteMetrics::statusClass(HttpCode::CREATED));
+    EXPECT_EQ(3, RouteMetrics::statusClass(HttpCode::BAD_REQUEST));
+    EXPECT_EQ(3, RouteMetrics::statusClass(HttpCode::NOT_ALLOWED));
+    EXPECT_EQ(4, RouteMetrics::statusClass(HttpCode::INTERNAL_ERROR));
+    EXPECT_EQ(4, RouteMetrics::statusClass(HttpCode::VERSION_NOT_SUPPORTED));
+}
+
+TEST(ResourceMatcherTest, BulkheadBoundsConcurrency) {
+    Bulkhead bulkhead(2);
+    EXPECT_TRUE(bulkhead.acquire());
+    EXPECT_TRUE(bulkhead.acquire());
+    EXPECT_FALSE(bulkhead.acquire());
+    EXPECT_EQ(2u, bulkhead.inFlight());
+
+    bulkhead.release();
+    EXPECT_TRUE(bulkhead.acquire());
+    EXPECT_FALSE(bulkhead.acquire());
+}
+
+TEST(ResourceMatcherTest, BulkheadIsCreatedOnlyForLimitedRoutes) {
+    ResourceMatcher matcher;
+
+    OneStringParamResource limited {"/limited/{id}"};
+    RouteOptions options;
+    options.maxInFlight = 1;
+    matcher.addResource(&limited, detail::bindMethods(&limited), nullptr,
+        options);
+    OneStringParamResource open {"/open/{id}"};
+    matcher.addResource(&open, detail::bindMethods(&open));
+
+    auto match = matcher.match("/limited/1");
+    ASSERT_TRUE(match);
+    ASSERT_TRUE(match.get().route->bulkhead != nullptr);
+    EXPECT_TRUE(match.get().route->bulkhead->acquire());
+    EXPECT_FALSE(match.get().route->bulkhead->acquire());
+
+    match = matcher.match("/open/1");
+    ASSERT_TRUE(match);
+    EXPECT_TRUE(match.get().route->bulkhead == nullptr);
+}
+
+TEST(ResourceMatcherTest, RemovedResourcesStopMatching) {
+    ResourceMatcher matcher;
+
+    OneStringParamResource users {"/users/{id}"};
+    NoParamResource groups {"/groups"};
+    matcher.addResource(&users, detail::bindMethods(&users));
+    matcher.addResource(&groups, detail::bindMethods(&groups));
+    EXPECT_EQ(&users, matcher.match("/users/7").get().resource);
+
+    // Matches made before the removal keep their route while the caller
+    // is in a critical section
+    Epoch::Guard guard;
+    auto held = matcher.match("/users/7");
+    EXPECT_TRUE(matcher.removeResource(&users));
+    EXPECT_FALSE(matcher.removeResource(&users));
+    EXPECT_FALSE(matcher.match("/users/7"));
+    EXPECT_EQ(&groups, matcher.match("/groups").get().resource);
+    EXPECT_EQ(std::vector<Resource *>{&groups}, matcher.resources());
+
+    EXPECT_EQ("GET, HEAD, OPTIONS", held.get().route->methods.allow);
+
+    // The path may be registered again
+    matcher.addResource(&users, detail::bindMethods(&users));
+    EXPECT_EQ(&users, matcher.match("/users/7").get().resource);
+}
+
+TEST(ResourceMatcherTest, CollisionLeavesMatcherUnchanged) {
+    ResourceMatcher matcher;
+
+    NoParamResource first {"/foo"};
+    NoParamResource second {"/foo"};
+    matcher.addResource(&first, detail::bindMethods(&first));
+    EXPECT_THROW(matcher.addResource(&second, detail::bindMethods(&second)),
+        std::runtime_error);
+    EXPECT_EQ(&first, matcher.match("/foo").get().resource);
+    EXPECT_EQ(1u, matcher.resources().size());
+}
+
+TEST(ResourceMatcherTest, ChangesShareUntouchedRoutes) {
+    ResourceMatcher matcher;
+
+    NoParamResource groups {"/groups"};
+    OneStringParamResource users {"/users/{id}"};
+    NoParamResource admins {"/users/admins"};
+    matcher.addResource(&groups, detail::bindMethods(&groups));
+    auto before = matcher.match("/groups");
+
+    matcher.addResource(&users, detail::bindMethods(&users));
+    matcher.addResource(&admins, detail::bindMethods(&admins));
+    EXPECT_EQ(before.get().route, matcher.match("/groups").get().route);
+
+    // Removing a resource leaves its neighbours on the path in place
+    EXPECT_TRUE(matcher.removeResource(&admins));
+    EXPECT_EQ(&users, matcher.match("/users/admins").get().resource);
+    EXPECT_TRUE(matcher.removeResource(&users));
+    EXPECT_FALSE(matcher.match("/users/7"));
+    EXPECT_FALSE(matcher.removeResource(&users));
+    EXPECT_EQ(before.get().route, matcher.match("/groups").get().route);
+}
+
+TEST(ResourceMatcherTest, AddsSeveralAtOnce) {
+    ResourceMatcher matcher;
+
+    NoParamResource first {"/first"};
+    OneStringParamResource second {"/second/{id}"};
+    matcher.addResources({{&first, detail::bindMethods(&first), {}},
+        {&second, detail::bindMethods(&second), {}}});
+    EXPECT_EQ(&first, matcher.match("/first").get().resource);
+    EXPECT_EQ(&second, matcher.match("/second/7").get().resource);
+    EXPECT_EQ((std::vector<Resource *>{&first, &second}),
+        matcher.resources());
+
+    // A collision anywhere in the batch adds none of it
+    NoParamResource third {"/third"};
+    NoParamResource again {"/first"};
+    EXPECT_THROW(matcher.addResources({{&third, detail::Methods(), {}},
+        {&again, detail::Methods(), {}}}), std::runtime_error);
+    EXPECT_FALSE(matcher.match("/third"));
+    EXPECT_EQ(&first, matcher.match("/first").get().resource);
+    EXPECT_EQ(2u, matcher.resources().size());
+}
+
+TEST(ResourceMatcherTest, MatchesWhileResourcesChange) {
+    ResourceMatcher matcher;
+
+    NoParamResource stable {"/stable"};
+    matcher.addResource(&stable, detail::bindMethods(&stable));
+
+    std::atomic<bool> done(false);
+    std::atomic<int> misses(0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&]() {
+            while (!done) {
+                auto match = matcher.match("/stable");
+                if (!match || match.get().resource != &stable) {
+                    ++misses;
+                }
+                matcher.match("/flapping/7");
+            }
+        });
+    }
+
+    OneStringParamResource flapping {"/flapping/{id}"};
+    for (int i = 0; i < 1000; ++i) {
+        matcher.addResource(&flapping, detail::bindMethods(&flapping));
+        EXPECT_TRUE(matcher.removeResource(&flapping));
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(0, misses);
+}
+
 } // anonymous namespace
 } // topper namespace
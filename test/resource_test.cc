@@ -20,12 +20,16 @@
  * SOFTWARE.
  */
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 #include "detail/dispatcher.h"
+#include "detail/server-impl.h"
 #include "parameter_internal.h"
 #include "resource.h"
 #include "response.h"
@@ -40,8 +44,8 @@ public:
 };
 
 // Convenience helper
-template<typename R, typename... Args>
-Response run(Resource const& resource, Response (R::*method)(Args...) const,
+template<typename Ret, typename R, typename... Args>
+Response run(Resource const& resource, Ret (R::*method)(Args...) const,
         std::vector<std::string> const& params, UriInfo const& uriInfo) {
     return detail::ResourceDispatcher::dispatch(&resource, method, params,
         uriInfo);
@@ -52,7 +56,7 @@ UriInfo mkBlankUriInfo() {
     static PostParamsImpl postParams;
     static HeaderParamsImpl headerParams;
     static Entity entity;
-    return UriInfo { queryParams, postParams, headerParams, entity };
+    return UriInfo { queryParams, postParams, headerParams, entity, nullptr };
 }
 
 TEST(ResourceTest, DefaultResponseIsNotAllowed) {
@@ -65,6 +69,34 @@ TEST(ResourceTest, DefaultResponseIsNotAllowed) {
     EXPECT_EQ(HttpCode::NOT_ALLOWED, run(r, &DefaultResource::del, p, u).code());
 }
 
+TEST(ResourceTest, DefaultMethodsAreNotBound) {
+    DefaultResource r("/foo");
+    detail::Methods methods = detail::bindMethods(&r);
+    EXPECT_FALSE(methods.get);
+    EXPECT_FALSE(methods.put);
+    EXPECT_FALSE(methods.post);
+    EXPECT_FALSE(methods.del);
+}
+
+class GetResource : public Resource {
+public:
+    GetResource() : Resource("/foo") { }
+
+    Response get() const {
+        return Response(HttpCode::OK, MediaType::TEXT_PLAIN, "get");
+    }
+};
+
+TEST(ResourceTest, HeadIsBoundToGetByDefault) {
+    GetResource r;
+    detail::Methods methods = detail::bindMethods(&r);
+    ASSERT_TRUE(methods.head);
+    std::vector<std::string> p;
+    EXPECT_EQ(r.get().to_string(),
+        methods.head(p, mkBlankUriInfo()).to_string());
+    EXPECT_EQ("GET, HEAD, OPTIONS", methods.allow);
+}
+
 TEST(ResourceTest, ResourceExposesPath) {
     const std::string kPath {"/foo"};
     EXPECT_EQ(kPath, DefaultResource(kPath).path());
@@ -109,6 +141,14 @@ TEST(ResourceTest, ImplementedMethodsOverrideDefaults) {
     EXPECT_EQ(HttpCode::OK, run(r, &OkResource::head, p, u).code());
 }
 
+TEST(ResourceTest, AllowListsImplementedMethods) {
+    OkResource ok;
+    EXPECT_EQ("GET, HEAD, PUT, POST, DELETE, OPTIONS",
+        detail::bindMethods(&ok).allow);
+    DefaultResource def("/foo");
+    EXPECT_EQ("OPTIONS", detail::bindMethods(&def).allow);
+}
+
 // Resource with methods that use query parameters
 template<typename Func>
 class QueryParamResource : public Resource {
@@ -147,7 +187,7 @@ TEST(ResourceTest, QueryParamsArePassedToResource) {
     PostParamsImpl postParams;
     HeaderParamsImpl headerParams;
     Entity entity;
-    UriInfo u { queryParams, postParams, headerParams, entity };
+    UriInfo u { queryParams, postParams, headerParams, entity, nullptr };
     auto compare = [&u](QueryParams const& qp) -> void {
             ASSERT_EQ(u.queryParams, qp);
         };
@@ -180,7 +220,7 @@ TEST(ResourceTest, PostParamsArePassedToResourcePostMethod) {
         std::unordered_multimap<std::string, std::string>{
             { "post1", "1" }, { "post2", "2" } });
     Entity entity;
-    UriInfo u { queryParams, postParams, headerParams, entity };
+    UriInfo u { queryParams, postParams, headerParams, entity, nullptr };
     auto compare = [&u](PostParams const& pp) -> void {
             ASSERT_EQ(u.postParams, pp);
         };
@@ -210,7 +250,7 @@ TEST(ResourceTest, HeaderParamsArePassedToResource) {
             { "header1", "value1" }, { "header2", "value2" } });
     PostParamsImpl postParams;
     Entity entity;
-    UriInfo u { queryParams, postParams, headerParams, entity };
+    UriInfo u { queryParams, postParams, headerParams, entity, nullptr };
     auto compare = [&u](HeaderParams const& hp) -> void {
             ASSERT_EQ(u.headerParams, hp);
         };
@@ -218,5 +258,205 @@ TEST(ResourceTest, HeaderParamsArePassedToResource) {
     EXPECT_EQ(HttpCode::OK, run(r, &decltype(r)::post, p, u).code());
 }
 
+// Resource with interleaved path and uri info parameters
+template<typename Func>
+class MixedParamResource : public Resource {
+public:
+    MixedParamResource(Func f) : Resource("/{a}/{b}/{c}"), f_(f) { }
+
+    Response get(StringParam const& a, QueryParams const& qp,
+            IntParam<int> const& b, HeaderParams const& hp,
+            StringParam const& c) const {
+        f_(a, qp, b, hp, c);
+        return resp_;
+    }
+private:
+    Func f_;
+    Response resp_ {HttpCode::OK, MediaType::TEXT_PLAIN, ""};
+};
+
+TEST(ResourceTest, PathParamsAreExtractedInPlace) {
+    std::vector<std::string> p { "foo", "42", "bar" };
+    UriInfo u = mkBlankUriInfo();
+    auto compare = [&](StringParam const& a, QueryParams const& qp,
+            IntParam<int> const& b, HeaderParams const& hp,
+            StringParam const& c) -> void {
+            EXPECT_EQ("foo", a.value());
+            EXPECT_EQ(42, b.value());
+            EXPECT_EQ("bar", c.value());
+            // Path parameters are views of the matched parameters
+            EXPECT_EQ(&p[0], &a.value());
+            EXPECT_EQ(&p[2], &c.value());
+            // Uri info parameters are passed by reference
+            EXPECT_EQ(&u.queryParams, &qp);
+            EXPECT_EQ(&u.headerParams, &hp);
+        };
+    MixedParamResource<decltype(compare)> r(compare);
+    EXPECT_EQ(HttpCode::OK, run(r, &decltype(r)::get, p, u).code());
+}
+
+class IntParamResource : public Resource {
+public:
+    IntParamResource() : Resource("/{id}") { }
+
+    Response get(IntParam<int8_t> const& id) const {
+        ++invocations;
+        return Response(HttpCode::OK, MediaType::TEXT_PLAIN,
+            std::to_string(id.value()));
+    }
+
+    mutable int invocations = 0;
+};
+
+TEST(ResourceTest, MalformedPathParamsAreBadRequests) {
+    IntParamResource r;
+    UriInfo u = mkBlankUriInfo();
+    std::vector<std::string> valid { "12" };
+    EXPECT_EQ(HttpCode::OK, run(r, &IntParamResource::get, valid, u).code());
+    EXPECT_EQ(1, r.invocations);
+
+    for (const char *input : { "", "foo", "12foo", "1000" }) {
+        std::vector<std::string> p { input };
+        EXPECT_EQ(HttpCode::BAD_REQUEST,
+            run(r, &IntParamResource::get, p, u).code()) << input;
+    }
+    // The handler is never invoked with a malformed parameter
+    EXPECT_EQ(1, r.invocations);
+}
+
+// Records completions of asynchronous requests
+class TestResponder : public detail::Responder {
+public:
+    class State : public detail::AsyncState {
+    public:
+        explicit State(std::vector<Response> *completions)
+            : completions_(completions) { }
+        void complete(Response const& response) override {
+            completions_->push_back(response);
+        }
+    private:
+        std::vector<Response> *completions_;
+    };
+
+    Deadline deadline() override {
+        return Deadline(expires, cancelled);
+    }
+
+    AsyncResponse defer() override {
+        auto state = state_.lock();
+        if (!state) {
+            state = std::make_shared<State>(&completions);
+            state_ = state;
+        }
+        return AsyncResponse(state);
+    }
+
+    std::vector<Response> completions;
+    Deadline::Clock::time_point expires = Deadline::Clock::time_point::max();
+    std::shared_ptr<std::atomic<bool>> cancelled =
+        std::make_shared<std::atomic<bool>>(false);
+private:
+    std::weak_ptr<detail::AsyncState> state_;
+};
+
+class AsyncResource : public Resource {
+public:
+    AsyncResource() : Resource("/{id}") { }
+
+    void get(IntParam<int> const& id, AsyncResponse const& response) const {
+        saved.push_back(response);
+        (void) id;
+    }
+
+    mutable std::vector<AsyncResponse> saved;
+};
+
+TEST(ResourceTest, AsyncHandlersCompleteThroughHandle) {
+    AsyncResource r;
+    TestResponder responder;
+    QueryParamsImpl queryParams;
+    PostParamsImpl postParams;
+    HeaderParamsImpl headerParams;
+    Entity entity;
+    UriInfo u { queryParams, postParams, headerParams, entity, &responder };
+
+    std::vector<std::string> p { "1" };
+    EXPECT_TRUE(run(r, &AsyncResource::get, p, u).deferred());
+    ASSERT_EQ(1U, r.saved.size());
+    EXPECT_TRUE(responder.completions.empty());
+
+    // Completion may happen after dispatch returns
+    r.saved[0].complete(Response(HttpCode::CREATED));
+    ASSERT_EQ(1U, responder.completions.size());
+    EXPECT_EQ(HttpCode::CREATED, responder.completions[0].code());
+}
+
+TEST(ResourceTest, AsyncHandlersWithMalformedParamsAreBadRequests) {
+    AsyncResource r;
+    TestResponder responder;
+    QueryParamsImpl queryParams;
+    PostParamsImpl postParams;
+    HeaderParamsImpl headerParams;
+    Entity entity;
+    UriInfo u { queryParams, postParams, headerParams, entity, &responder };
+
+    std::vector<std::string> p { "foo" };
+    EXPECT_TRUE(run(r, &AsyncResource::get, p, u).deferred());
+    EXPECT_TRUE(r.saved.empty());
+    ASSERT_EQ(1U, responder.completions.size());
+    EXPECT_EQ(HttpCode::BAD_REQUEST, responder.completions[0].code());
+}
+
+TEST(ResourceTest, AsyncHandlersWithoutResponderAreBadRequests) {
+    AsyncResource r;
+    QueryParamsImpl queryParams;
+    PostParamsImpl postParams;
+    HeaderParamsImpl headerParams;
+    Entity entity;
+    UriInfo u { queryParams, postParams, headerParams, entity, nullptr };
+
+    std::vector<std::string> p { "1" };
+    EXPECT_EQ(HttpCode::BAD_REQUEST, run(r, &AsyncResource::get, p, u).code());
+    EXPECT_TRUE(r.saved.empty());
+
+    bool ok = true;
+    detail::GetParam<AsyncResponse>::get(p, 0, u, &ok);
+    EXPECT_FALSE(ok);
+}
+
+class DeadlineResource : public Resource {
+public:
+    DeadlineResource() : Resource("/{id}") { }
+
+    void get(IntParam<int> const&, Deadline const& deadline,
+            AsyncResponse const& response) const {
+        saved.push_back(deadline);
+        response.complete(Response(HttpCode::OK));
+    }
+
+    mutable std::vector<Deadline> saved;
+};
+
+TEST(ResourceTest, DeadlinesComeFromResponder) {
+    DeadlineResource r;
+    TestResponder responder;
+    responder.expires = Deadline::Clock::now() + std::chrono::seconds(10);
+    QueryParamsImpl queryParams;
+    PostParamsImpl postParams;
+    HeaderParamsImpl headerParams;
+    Entity entity;
+    UriInfo u { queryParams, postParams, headerParams, entity, &responder };
+
+    std::vector<std::string> p { "1" };
+    EXPECT_TRUE(run(r, &DeadlineResource::get, p, u).deferred());
+    ASSERT_EQ(1U, r.saved.size());
+    EXPECT_EQ(responder.expires, r.saved[0].when());
+    EXPECT_FALSE(r.saved[0].cancelled());
+
+    // The copy sees cancellation by the server
+    responder.cancelled->store(true);
+    EXPECT_TRUE(r.saved[0].cancelled());
+}
+
 } // anonymous namespace
 } // topper namespace
@@ -33,12 +33,55 @@ namespace {
 
 TEST(ResponseTest, HttpCodeExported) {
     auto mkResponse = [](HttpCode code) -> Response {
-            return Repsonse(code, MediaType::TEXT_PLAIN, "");
+            return Response(code, MediaType::TEXT_PLAIN, "");
         };
-    EXPECT_EQ(HttpCode::OK, mkResponse(HttpCode::OK));
-    EXPECT_EQ(HttpCode::CREATED, mkResponse(HttpCode::CREATED));
+    EXPECT_EQ(HttpCode::OK, mkResponse(HttpCode::OK).code());
+    EXPECT_EQ(HttpCode::CREATED, mkResponse(HttpCode::CREATED).code());
     // Covering any others is redundant
 }
 
+TEST(ResponseTest, HeadersAreSerialized) {
+    Response resp(HttpCode::OK, MediaType::TEXT_PLAIN, "body");
+    resp.header("Allow", "GET").header("X-Foo", "bar");
+    std::string str = resp.to_string();
+    EXPECT_NE(std::string::npos, str.find("\r\nAllow: GET\r\n"));
+    EXPECT_NE(std::string::npos, str.find("\r\nX-Foo: bar\r\n"));
+    EXPECT_EQ(str.size() - 8, str.find("\r\n\r\nbody"));
+}
+
+TEST(ResponseTest, BodyCanBeOmitted) {
+    Response resp(HttpCode::OK, MediaType::TEXT_PLAIN, "body");
+    std::string full = resp.to_string();
+    std::string head = resp.to_string(/*includeBody=*/ false);
+    EXPECT_EQ(full.substr(0, full.size() - 4), head);
+    EXPECT_NE(std::string::npos, head.find("Content-Length: 4\r\n"));
+}
+
+TEST(ResponseTest, PreformattedResponsesHaveNoBody) {
+    auto validate = [](HttpCode code, std::string const& status) {
+            std::string const& resp = Response::preformatted(code);
+            EXPECT_EQ(0U, resp.find("HTTP/1.1 " + status + "\r\n")) << resp;
+            EXPECT_NE(std::string::npos, resp.find("Content-Length: 0\r\n"));
+            EXPECT_EQ(resp.size() - 4, resp.find("\r\n\r\n"));
+            // Formatted once
+            EXPECT_EQ(&resp, &Response::preformatted(code));
+        };
+    validate(HttpCode::BAD_REQUEST, "400 Bad Request");
+    validate(HttpCode::NOT_FOUND, "404 Not Found");
+    validate(HttpCode::NOT_ALLOWED, "405 Method Not Allowed");
+    validate(HttpCode::REQUEST_TIMEOUT, "408 Request Timeout");
+    validate(HttpCode::NOT_IMPLEMENTED, "501 Not Implemented");
+    validate(HttpCode::VERSION_NOT_SUPPORTED,
+        "505 HTTP Version Not Supported");
+}
+
+TEST(ResponseTest, ServiceUnavailable) {
+    std::string resp = Response(HttpCode::SERVICE_UNAVAILABLE)
+        .header("Retry-After", "1").to_string(/*includeBody=*/ true,
+            /*keepAlive=*/ false);
+    EXPECT_EQ(0U, resp.find("HTTP/1.1 503 Service Unavailable\r\n")) << resp;
+    EXPECT_NE(std::string::npos, resp.find("Retry-After: 1\r\n"));
+}
+
 } // anonymous namespace
 } // topper namespace
@@ -20,8 +20,31 @@
  * SOFTWARE.
  */
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
+#include "async_response.h"
+#include "http_client.h"
+#include "listener.h"
 #include "server.h"
 #include "util.h"
 
@@ -34,6 +57,136 @@ protected:
 
 EphemeralPorts ServerTest::ports{};
 
+namespace {
+
+// A blocking client connection
+int connectTo(short port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    EXPECT_EQ(0, connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+        sizeof(addr)));
+    return fd;
+}
+
+// A blocking client connection to a Unix socket; a leading '@' names an
+// abstract socket
+int connectUnix(std::string const& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.data(), path.size());
+    socklen_t len = sizeof(addr);
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';
+        len = offsetof(struct sockaddr_un, sun_path) + path.size();
+    }
+    EXPECT_EQ(0, connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+        len));
+    return fd;
+}
+
+// A blocking client connection over IPv6 loopback
+int connectTo6(short port) {
+    int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    struct sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(port);
+    addr.sin6_addr = in6addr_loopback;
+    EXPECT_EQ(0, connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+        sizeof(addr)));
+    return fd;
+}
+
+// Everything the server sends until it closes the connection
+std::string readAll(int fd) {
+    std::string received;
+    char buf[512];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        received.append(buf, n);
+    }
+    return received;
+}
+
+// One response, which must carry a Content-Length, on a connection that
+// stays open
+std::string readResponse(int fd) {
+    std::string received;
+    char buf[512];
+    for (;;) {
+        size_t end = received.find("\r\n\r\n");
+        size_t length = received.find("Content-Length: ");
+        if (end != std::string::npos && length < end &&
+                received.size() >= end + 4 + std::stoul(
+                    received.substr(length + 16))) {
+            return received;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return received;
+        }
+        received.append(buf, n);
+    }
+}
+
+// Send a request and read the response, on a connection the server closes
+std::string exchange(int fd, std::string const& path,
+        std::string const& headers = "") {
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n"
+        "Connection: close\r\n" + headers + "\r\n";
+    EXPECT_EQ(static_cast<ssize_t>(request.size()),
+        write(fd, request.data(), request.size()));
+    std::string response = readAll(fd);
+    close(fd);
+    return response;
+}
+
+class HelloResource : public Resource {
+public:
+    HelloResource() : Resource("/hello") { }
+
+    Response get() const {
+        ++calls;
+        return Response(HttpCode::OK, MediaType::TEXT_PLAIN, "hello");
+    }
+
+    mutable std::atomic<int> calls{0};
+};
+
+// Holds asynchronous requests without completing them
+class StallResource : public Resource {
+public:
+    StallResource() : Resource("/stall") { }
+
+    void get(Deadline const& deadline, AsyncResponse const& response) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        deadlines.push_back(deadline);
+        held.push_back(response);
+    }
+
+    // Wait for a request to arrive
+    AsyncResponse next() const {
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!held.empty()) {
+                    return held.back();
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    mutable std::mutex mutex;
+    mutable std::vector<Deadline> deadlines;
+    mutable std::vector<AsyncResponse> held;
+};
+
+} // anonymous namespace
+
 TEST_F(ServerTest, MalformedAddressThrows) {
     ASSERT_THROW({Server server("1.2.3.4.5", ports.get());},
         std::invalid_argument);
@@ -54,9 +207,493 @@ TEST_F(ServerTest, StartThrowsIfAlreadyStarted) {
 
 TEST_F(ServerTest, StartAdminService) {
     Server server("127.0.0.1", ports.get());
-    server.startAdminServer("127.0.0.1", ports.get());
+    short adminPort = ports.get();
+    server.startAdminServer("127.0.0.1", adminPort);
+    server.start();
+
+    HttpClient client(&server);
+    std::promise<ClientResponse> promise;
+    client.get("127.0.0.1", adminPort, "/ping",
+        [&promise](ClientError error, ClientResponse const& response) {
+            EXPECT_EQ(ClientError::NONE, error);
+            promise.set_value(response);
+        });
+    ClientResponse response = promise.get_future().get();
+    EXPECT_EQ(200, response.status);
+    EXPECT_EQ("pong\n", response.body);
+}
+
+TEST_F(ServerTest, AdminServiceReportsConnectionMetrics) {
+    short port = ports.get();
+    Server server("127.0.0.1", port);
+    short adminPort = ports.get();
+    server.startAdminServer("127.0.0.1", adminPort);
+    server.start();
+
+    HttpClient client(&server);
+    auto get = [&client](short to, std::string const& path) {
+        std::promise<ClientResponse> promise;
+        client.get("127.0.0.1", to, path,
+            [&promise](ClientError error, ClientResponse const& response) {
+                EXPECT_EQ(ClientError::NONE, error);
+                promise.set_value(response);
+            });
+        return promise.get_future().get();
+    };
+    ASSERT_EQ(404, get(port, "/missing").status);
+
+    // Admin requests aren't counted with the application's
+    ASSERT_EQ(200, get(adminPort, "/ping").status);
+    std::string text = get(adminPort,
+        "/metrics/prometheus?prefix=topper_connections"
+        "&prefix=topper_request_phase").body;
+    EXPECT_NE(std::string::npos,
+        text.find("topper_connections_accepted_total 1\n"));
+    EXPECT_NE(std::string::npos,
+        text.find("# TYPE topper_connections_active gauge\n"));
+    EXPECT_NE(std::string::npos, text.find("topper_connections_bytes_read"));
+    EXPECT_NE(std::string::npos, text.find(
+        "topper_request_phase_seconds_count{phase=\"write\"} 1\n"));
+    EXPECT_EQ(std::string::npos, text.find("topper_resource"));
+}
+
+TEST_F(ServerTest, ConnectionsOverTheLimitAreRefused) {
+    HelloResource hello;
+    ServerOptions options;
+    options.maxConnections = 1;
+    options.retryAfter = std::chrono::seconds(2);
+    short port = ports.get();
+    Server server("127.0.0.1", port, options);
+    server.registerResource(&hello);
+    server.start();
+
+    // Hold the only connection open across a request
+    int held = connectTo(port);
+    std::string request = "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    ASSERT_EQ(static_cast<ssize_t>(request.size()),
+        write(held, request.data(), request.size()));
+    EXPECT_EQ(0u, readResponse(held).find("HTTP/1.1 200 OK\r\n"));
+
+    // The next is answered and closed without its request being handled
+    int refused = connectTo(port);
+    ssize_t ret = send(refused, request.data(), request.size(),
+        MSG_NOSIGNAL);
+    (void) ret;
+    std::string answer = readAll(refused);
+    close(refused);
+    EXPECT_EQ(0u, answer.find("HTTP/1.1 503 Service Unavailable\r\n"))
+        << answer;
+    EXPECT_NE(std::string::npos, answer.find("Retry-After: 2\r\n"));
+    EXPECT_NE(std::string::npos, answer.find("Connection: close\r\n"));
+    EXPECT_EQ(1, hello.calls);
+
+    // Connections are admitted again once there is room
+    close(held);
+    for (int i = 0; i < 100; ++i) {
+        answer = exchange(connectTo(port), "/hello");
+        if (answer.find("HTTP/1.1 200 OK\r\n") == 0) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(0u, answer.find("HTTP/1.1 200 OK\r\n")) << answer;
+    EXPECT_EQ(2, hello.calls);
+}
+
+TEST_F(ServerTest, RequestsOverTheLimitAreRefused) {
+    StallResource stall;
+    ServerOptions options;
+    options.maxInFlight = 1;
+    short port = ports.get();
+    Server server("127.0.0.1", port, options);
+    server.registerResource(&stall);
+    server.start();
+
+    std::string request = "GET /stall HTTP/1.1\r\nHost: localhost\r\n"
+        "Connection: close\r\n\r\n";
+    int busy = connectTo(port);
+    ASSERT_EQ(static_cast<ssize_t>(request.size()),
+        write(busy, request.data(), request.size()));
+    AsyncResponse response = stall.next();
+
+    // A second request is refused without reaching the handler
+    std::string answer = exchange(connectTo(port), "/stall");
+    EXPECT_EQ(0u, answer.find("HTTP/1.1 503 Service Unavailable\r\n"))
+        << answer;
+    EXPECT_NE(std::string::npos, answer.find("Retry-After: 1\r\n"));
+    {
+        std::lock_guard<std::mutex> lock(stall.mutex);
+        EXPECT_EQ(1u, stall.held.size());
+    }
+
+    response.complete(Response(HttpCode::OK));
+    EXPECT_EQ(0u, readAll(busy).find("HTTP/1.1 200 OK\r\n"));
+    close(busy);
+}
+
+TEST_F(ServerTest, ResourcesLimitTheirOwnRequests) {
+    StallResource stall;
+    HelloResource hello;
+    short port = ports.get();
+    Server server("127.0.0.1", port);
+    RouteOptions limited;
+    limited.maxInFlight = 1;
+    server.registerResource(&stall, limited);
+    server.registerResource(&hello);
+    server.start();
+
+    std::string request = "GET /stall HTTP/1.1\r\nHost: localhost\r\n"
+        "Connection: close\r\n\r\n";
+    int busy = connectTo(port);
+    ASSERT_EQ(static_cast<ssize_t>(request.size()),
+        write(busy, request.data(), request.size()));
+    AsyncResponse response = stall.next();
+
+    // The stalled resource refuses more work; others are unaffected
+    std::string answer = exchange(connectTo(port), "/stall");
+    EXPECT_EQ(0u, answer.find("HTTP/1.1 503 Service Unavailable\r\n"))
+        << answer;
+    EXPECT_NE(std::string::npos, answer.find("Retry-After: 1\r\n"));
+    EXPECT_EQ(0u, exchange(connectTo(port), "/hello").find(
+        "HTTP/1.1 200 OK\r\n"));
+    {
+        std::lock_guard<std::mutex> lock(stall.mutex);
+        EXPECT_EQ(1u, stall.held.size());
+    }
+
+    response.complete(Response(HttpCode::OK));
+    EXPECT_EQ(0u, readAll(busy).find("HTTP/1.1 200 OK\r\n"));
+    close(busy);
+}
+
+TEST_F(ServerTest, RateLimitsAnswerWithTooManyRequests) {
+    HelloResource hello;
+    StallResource stall;
+    ServerOptions options;
+    options.clientRateLimit.rate = 0.001;
+    options.clientRateLimit.burst = 1;
+    options.clientHeader = "X-Api-Key";
+    short port = ports.get();
+    Server server("127.0.0.1", port, options);
+    RouteOptions limited;
+    limited.rateLimit.rate = 0.001;
+    limited.rateLimit.burst = 1;
+    server.registerResource(&hello, limited);
+    server.registerResource(&stall);
+    short adminPort = ports.get();
+    server.startAdminServer("127.0.0.1", adminPort);
+    server.start();
+
+    auto status = [port](std::string const& path,
+            std::string const& headers) {
+        std::string answer = exchange(connectTo(port), path, headers);
+        return answer.substr(0, answer.find("\r\n"));
+    };
+    const std::string kOk = "HTTP/1.1 200 OK";
+    const std::string kLimited = "HTTP/1.1 429 Too Many Requests";
+
+    // The resource's bucket is shared by every client
+    EXPECT_EQ(kOk, status("/hello", "X-Api-Key: a\r\n"));
+    EXPECT_EQ(kLimited, status("/hello", "X-Api-Key: b\r\n"));
+    EXPECT_EQ(1, hello.calls);
+
+    // Each client has its own bucket, across resources
+    EXPECT_EQ(kLimited, status("/stall", "X-Api-Key: a\r\n"));
+    EXPECT_EQ(kLimited, status("/hello", "X-Api-Key: b\r\n"));
+    EXPECT_EQ(1, hello.calls);
+    {
+        std::lock_guard<std::mutex> lock(stall.mutex);
+        EXPECT_TRUE(stall.held.empty());
+    }
+
+    HttpClient client(&server);
+    std::promise<ClientResponse> promise;
+    client.get("127.0.0.1", adminPort,
+        "/metrics/prometheus?prefix=topper_ratelimit",
+        [&promise](ClientError error, ClientResponse const& response) {
+            EXPECT_EQ(ClientError::NONE, error);
+            promise.set_value(response);
+        });
+    std::string text = promise.get_future().get().body;
+    EXPECT_NE(std::string::npos, text.find(
+        "topper_ratelimit_limited_total{scope=\"client\"} 2\n")) << text;
+    EXPECT_NE(std::string::npos, text.find(
+        "topper_ratelimit_limited_total{scope=\"resource\"} 1\n")) << text;
+}
+
+TEST_F(ServerTest, SlowClientsTimeOut) {
+    ServerOptions options;
+    options.idleTimeout = std::chrono::milliseconds(50);
+    options.headerTimeout = std::chrono::milliseconds(50);
+    short port = ports.get();
+    Server server("127.0.0.1", port, options);
+    server.start();
+
+    // A connection that never sends anything is closed
+    int idle = connectTo(port);
+    EXPECT_EQ("", readAll(idle));
+    close(idle);
+
+    // One that stalls partway through its headers is told why
+    int trickle = connectTo(port);
+    std::string partial = "GET /ping HTTP/1.1\r\nHost: localhost\r\n";
+    ASSERT_EQ(static_cast<ssize_t>(partial.size()),
+        write(trickle, partial.data(), partial.size()));
+    EXPECT_EQ(0u, readAll(trickle).find("HTTP/1.1 408 Request Timeout\r\n"));
+    close(trickle);
+}
+
+TEST_F(ServerTest, SlowHandlersMissTheirDeadline) {
+    StallResource stall;
+    short port = ports.get();
+    Server server("127.0.0.1", port);
+    RouteOptions options;
+    options.deadline = std::chrono::seconds(60);
+    options.deadlineHeader = "X-Request-Timeout";
+    server.registerResource(&stall, options);
+    server.start();
+
+    // The request asks for less time than the route allows
+    int fd = connectTo(port);
+    std::string request = "GET /stall HTTP/1.1\r\nHost: localhost\r\n"
+        "X-Request-Timeout: 50\r\nConnection: close\r\n\r\n";
+    ASSERT_EQ(static_cast<ssize_t>(request.size()),
+        write(fd, request.data(), request.size()));
+    EXPECT_EQ(0u, readAll(fd).find("HTTP/1.1 504 Gateway Timeout\r\n"));
+    close(fd);
+
+    // The handler can tell that nobody is waiting any more
+    std::lock_guard<std::mutex> lock(stall.mutex);
+    ASSERT_EQ(1u, stall.deadlines.size());
+    EXPECT_TRUE(stall.deadlines[0].bounded());
+    EXPECT_TRUE(stall.deadlines[0].cancelled());
+}
+
+TEST_F(ServerTest, StoppingDrainsRequestsInFlight) {
+    StallResource stall;
+    short port = ports.get();
+    Server server("127.0.0.1", port);
+    server.registerResource(&stall);
+    server.start();
+
+    // A kept-alive connection between requests
+    int idle = connectTo(port);
+    std::string first = "GET /missing HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    ASSERT_EQ(static_cast<ssize_t>(first.size()),
+        write(idle, first.data(), first.size()));
+    EXPECT_EQ(0u, readResponse(idle).find("HTTP/1.1 404 Not Found\r\n"));
+
+    int busy = connectTo(port);
+    std::string request = "GET /stall HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    ASSERT_EQ(static_cast<ssize_t>(request.size()),
+        write(busy, request.data(), request.size()));
+    AsyncResponse response = stall.next();
+
+    std::thread stopper([&server]() { server.stopAndWait(); });
+
+    // Idle connections are closed straight away
+    EXPECT_EQ("", readAll(idle));
+    close(idle);
+
+    // The request in flight is answered, and its connection closed
+    response.complete(Response(HttpCode::OK, MediaType::TEXT_PLAIN, "done"));
+    std::string answer = readAll(busy);
+    EXPECT_EQ(0u, answer.find("HTTP/1.1 200 OK\r\n")) << answer;
+    EXPECT_NE(std::string::npos, answer.find("Connection: close\r\n"));
+    close(busy);
+    stopper.join();
+}
+
+TEST_F(ServerTest, StoppingAnswersRequestsAlreadySent) {
+    HelloResource hello;
+    short port = ports.get();
+    Server server("127.0.0.1", port);
+    server.registerResource(&hello);
+    server.start();
+
+    // Requests sent just before the drain starts may not have been read
+    // yet; they are answered all the same
+    std::vector<int> fds;
+    std::string request = "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    for (int i = 0; i < 16; ++i) {
+        fds.push_back(connectTo(port));
+        ASSERT_EQ(static_cast<ssize_t>(request.size()),
+            write(fds.back(), request.data(), request.size()));
+    }
+    std::thread stopper([&server]() { server.stopAndWait(); });
+
+    for (int fd : fds) {
+        std::string answer = readAll(fd);
+        EXPECT_EQ(0u, answer.find("HTTP/1.1 200 OK\r\n")) << answer;
+        close(fd);
+    }
+    stopper.join();
+}
+
+TEST_F(ServerTest, StoppingClosesRequestsPastTheDrainTimeout) {
+    StallResource stall;
+    short port = ports.get();
+    ServerOptions options;
+    options.drainTimeout = std::chrono::milliseconds(50);
+    Server server("127.0.0.1", port, options);
+    server.registerResource(&stall);
+    server.start();
+
+    int busy = connectTo(port);
+    std::string request = "GET /stall HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    ASSERT_EQ(static_cast<ssize_t>(request.size()),
+        write(busy, request.data(), request.size()));
+    AsyncResponse response = stall.next();
+
+    // The abandoned connection is closed, and its request cancelled
+    server.stopAndWait();
+    EXPECT_EQ("", readAll(busy));
+    close(busy);
+    {
+        std::lock_guard<std::mutex> lock(stall.mutex);
+        EXPECT_TRUE(stall.deadlines[0].cancelled());
+    }
+
+    // Completing it afterwards is harmless
+    response.complete(Response(HttpCode::OK));
+    stall.held.clear();
+}
+
+TEST_F(ServerTest, ResourcesComeAndGoWhileRunning) {
+    StallResource stall;
+    short port = ports.get();
+    Server server("127.0.0.1", port);
+    server.start();
+
+    std::string request = "GET /stall HTTP/1.1\r\nHost: localhost\r\n"
+        "Connection: close\r\n\r\n";
+    auto send = [&]() {
+        int fd = connectTo(port);
+        EXPECT_EQ(static_cast<ssize_t>(request.size()),
+            write(fd, request.data(), request.size()));
+        return fd;
+    };
+
+    int fd = send();
+    EXPECT_EQ(0u, readAll(fd).find("HTTP/1.1 404 Not Found\r\n"));
+    close(fd);
+
+    server.registerResource(&stall);
+    fd = send();
+    AsyncResponse response = stall.next();
+
+    // A request in flight outlives its resource's removal
+    EXPECT_TRUE(server.unregisterResource(&stall));
+    EXPECT_FALSE(server.unregisterResource(&stall));
+    response.complete(Response(HttpCode::OK, MediaType::TEXT_PLAIN, "done"));
+    EXPECT_EQ(0u, readAll(fd).find("HTTP/1.1 200 OK\r\n"));
+    close(fd);
+
+    fd = send();
+    EXPECT_EQ(0u, readAll(fd).find("HTTP/1.1 404 Not Found\r\n"));
+    close(fd);
+}
+
+TEST_F(ServerTest, ListensOnUnixAndIpv6Addresses) {
+    std::string id = std::to_string(getpid());
+    std::string path = "/tmp/topper-server-test." + id;
+    short port = ports.get();
+    ServerOptions options;
+    options.unixSocketMode = 0600;
+    Server server("unix:" + path, 0, options);
+    server.addListener("::", port);
+    server.startAdminServer("unix:@topper-admin." + id, 0);
+    server.start();
+
+    struct stat st;
+    ASSERT_EQ(0, stat(path.c_str(), &st));
+    EXPECT_EQ(0600u, st.st_mode & 0777);
+
+    const char notFound[] = "HTTP/1.1 404 Not Found\r\n";
+    EXPECT_EQ(0u, exchange(connectUnix(path), "/missing").find(notFound));
+    EXPECT_EQ(0u, exchange(connectTo6(port), "/missing").find(notFound));
+    // The IPv6 wildcard accepts IPv4 too
+    EXPECT_EQ(0u, exchange(connectTo(port), "/missing").find(notFound));
+
+    std::string pong = exchange(connectUnix("@topper-admin." + id), "/ping");
+    EXPECT_EQ(0u, pong.find("HTTP/1.1 200 OK\r\n"));
+
+    // Another server can't take the path over while this one listens
+    EXPECT_THROW(Listener::bind("unix:" + path, 0, ServerOptions()),
+        std::runtime_error);
+    EXPECT_EQ(0u, exchange(connectUnix(path), "/missing").find(notFound));
+
+    // Stopping cleanly removes the socket file
+    server.stopAndWait();
+    EXPECT_NE(0, stat(path.c_str(), &st));
+}
+
+TEST_F(ServerTest, AddListenerChecksAddresses) {
+    Server server("127.0.0.1", ports.get());
+    EXPECT_THROW(server.addListener("foo", 80), std::invalid_argument);
+    EXPECT_THROW(server.addListener("unix:", 0), std::invalid_argument);
+    server.start();
+    EXPECT_THROW(server.addListener("::1", ports.get()), std::logic_error);
+}
+
+TEST_F(ServerTest, TunedSocketsServeRequests) {
+    ServerOptions options;
+    options.backlog = 4096;
+    options.deferAccept = std::chrono::seconds(5);
+    options.fastOpenQueue = 256;
+    options.sendBuffer = 1 << 16;
+    options.receiveBuffer = 1 << 16;
+    options.tcpKeepAlive.idle = std::chrono::seconds(60);
+    options.tcpKeepAlive.probes = 3;
+
+    auto option = [](int fd, int level, int name) {
+        int value = -1;
+        socklen_t len = sizeof(value);
+        EXPECT_EQ(0, getsockopt(fd, level, name, &value, &len));
+        return value;
+    };
+
+    // The listening socket, and a connection accepted from it, carry the
+    // settings; the system doubles buffer sizes for bookkeeping, and
+    // rounds the deferral up to a retransmission
+    short bound = ports.get();
+    int listening = Listener::bind("127.0.0.1", bound, options);
+    EXPECT_GE(option(listening, IPPROTO_TCP, TCP_DEFER_ACCEPT), 5);
+    EXPECT_EQ(2 * options.receiveBuffer,
+        option(listening, SOL_SOCKET, SO_RCVBUF));
+
+    int client = connectTo(bound);
+    ASSERT_EQ(1, write(client, "x", 1));
+    struct pollfd polled = { listening, POLLIN, 0 };
+    ASSERT_EQ(1, poll(&polled, 1, 5000));
+    int accepted = accept4(listening, nullptr, nullptr, SOCK_CLOEXEC);
+    ASSERT_GE(accepted, 0);
+    EXPECT_EQ(1, option(accepted, IPPROTO_TCP, TCP_NODELAY));
+    EXPECT_EQ(1, option(accepted, SOL_SOCKET, SO_KEEPALIVE));
+    EXPECT_EQ(60, option(accepted, IPPROTO_TCP, TCP_KEEPIDLE));
+    EXPECT_EQ(3, option(accepted, IPPROTO_TCP, TCP_KEEPCNT));
+    EXPECT_EQ(2 * options.receiveBuffer,
+        option(accepted, SOL_SOCKET, SO_RCVBUF));
+    close(accepted);
+    close(client);
+    close(listening);
+
+    short port = ports.get();
+    Server server("127.0.0.1", port, options);
+    server.start();
+
+    // Deferred accepts wait for the request to arrive, and are then served
+    EXPECT_EQ(0u, exchange(connectTo(port), "/missing").find(
+        "HTTP/1.1 404 Not Found\r\n"));
+}
+
+TEST_F(ServerTest, StopOnSignal) {
+    Server server("127.0.0.1", ports.get());
+    server.stopOnSignal(SIGUSR1);
     server.start();
-    // XXX need an HTTP client for tests
+
+    raise(SIGUSR1);
+    server.wait();
 }
 
 } // topper namespace
@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "slow_log.h"
+
+namespace topper {
+namespace {
+
+class SlowLogTest : public ::testing::Test {
+protected:
+    SlowLogTest() {
+        char path[] = "/tmp/topper_slow_log_XXXXXX";
+        int fd = mkstemp(path);
+        close(fd);
+        options.path = path;
+    }
+
+    ~SlowLogTest() {
+        unlink(options.path.c_str());
+    }
+
+    std::vector<std::string> lines() const {
+        std::vector<std::string> lines;
+        std::ifstream in(options.path);
+        std::string line;
+        while (std::getline(in, line)) {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    static SlowRequest request() {
+        SlowRequest request;
+        Trace& trace = request.trace;
+        trace = Trace();
+        snprintf(trace.path, sizeof(trace.path), "/users/7?verbose=1");
+        snprintf(trace.resource, sizeof(trace.resource), "/users/{id}");
+        trace.method = HttpMethod::POST;
+        trace.status = HttpCode::CREATED;
+        trace.base = 2;
+        trace.timestamp = 1445000000123456LL;
+        trace.phases[Trace::PARSE] = 1000;
+        trace.phases[Trace::DISPATCH] = 1500000000;
+        trace.phases[Trace::WRITE] = 2000;
+        request.headerBytes = 120;
+        request.bodyBytes = 17;
+        return request;
+    }
+
+    SlowLogOptions options;
+    MetricRegistry metrics;
+};
+
+TEST_F(SlowLogTest, Format) {
+    std::string line;
+    SlowLog::format(request(), &line);
+    EXPECT_EQ(0u, line.find("2015-10-16T12:53:20.123456Z POST "
+        "/users/7?verbose=1 status=201 resource=/users/{id} base=2 thread="));
+    EXPECT_NE(std::string::npos, line.find(
+        " headers=120 body=17 latency=1.500003 accept=0.000000 "
+        "read=0.000000 parse=0.000001 match=0.000000 dispatch=1.500000 "
+        "serialize=0.000000 write=0.000002"));
+}
+
+TEST_F(SlowLogTest, ThresholdDefaultsToTheLog) {
+    options.threshold = std::chrono::milliseconds(250);
+    SlowLog log(options, &metrics);
+    RouteOptions route;
+    EXPECT_EQ(std::chrono::milliseconds(250), log.threshold(route));
+    route.slowThreshold = std::chrono::milliseconds(10);
+    EXPECT_EQ(std::chrono::milliseconds(10), log.threshold(route));
+}
+
+TEST_F(SlowLogTest, WritesAreRateLimited) {
+    options.maxPerSecond = 3;
+    {
+        SlowLog log(options, &metrics);
+        for (int i = 0; i < 10; ++i) {
+            log.log(request());
+        }
+        // Flushed when the log is destroyed
+    }
+
+    std::vector<std::string> written = lines();
+    ASSERT_EQ(4u, written.size());
+    EXPECT_EQ(3, metrics.counter("topper.slowlog.logged")->count());
+    EXPECT_EQ(7, metrics.counter("topper.slowlog.suppressed")->count());
+    int entries = 0;
+    for (auto const& line : written) {
+        if (line.find("suppressed 7 slow requests") == 0) {
+            continue;
+        }
+        EXPECT_NE(std::string::npos, line.find(" POST /users/7"));
+        ++entries;
+    }
+    EXPECT_EQ(3, entries);
+}
+
+TEST_F(SlowLogTest, UnwritableFileThrows) {
+    options.path = "/nonexistent/slow.log";
+    EXPECT_THROW(SlowLog(options, &metrics), std::runtime_error);
+}
+
+} // anonymous namespace
+} // topper namespace
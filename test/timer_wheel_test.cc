@@ -0,0 +1,166 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "timer_wheel.h"
+
+namespace topper {
+namespace {
+
+typedef TimerWheel::Clock Clock;
+
+class Recorder : public TimerWheel::Entry {
+public:
+    explicit Recorder(std::vector<int> *fired, int id = 0)
+        : fired_(fired), id_(id) { }
+
+    void expired() override {
+        fired_->push_back(id_);
+        if (then) {
+            then();
+        }
+    }
+
+    std::function<void()> then;
+private:
+    std::vector<int> *fired_;
+    int id_;
+};
+
+class TimerWheelTest : public ::testing::Test {
+protected:
+    TimerWheelTest()
+        : start(Clock::now()),
+          wheel(std::chrono::milliseconds(10), start) { }
+
+    Clock::time_point at(int ms) const {
+        return start + std::chrono::milliseconds(ms);
+    }
+
+    Clock::time_point start;
+    TimerWheel wheel;
+    std::vector<int> fired;
+};
+
+TEST_F(TimerWheelTest, EntriesExpireInOrderAndNeverEarly) {
+    Recorder a(&fired, 1);
+    Recorder b(&fired, 2);
+    Recorder c(&fired, 3);
+    wheel.schedule(&c, at(25));
+    wheel.schedule(&a, at(5));
+    wheel.schedule(&b, at(20));
+    EXPECT_EQ(3u, wheel.size());
+
+    wheel.advance(at(4));
+    EXPECT_TRUE(fired.empty());
+    wheel.advance(at(10));
+    EXPECT_EQ(std::vector<int>({1}), fired);
+    wheel.advance(at(29));
+    EXPECT_EQ(std::vector<int>({1, 2}), fired);
+    wheel.advance(at(30));
+    EXPECT_EQ(std::vector<int>({1, 2, 3}), fired);
+    EXPECT_EQ(0u, wheel.size());
+    EXPECT_FALSE(a.scheduled());
+}
+
+TEST_F(TimerWheelTest, DistantEntriesCascade) {
+    // One per level, and one beyond the wheel's range
+    std::vector<std::unique_ptr<Recorder>> entries;
+    std::vector<int> deadlines = {300, 30 * 1000, 50 * 60 * 1000,
+        10 * 3600 * 1000, 60 * 3600 * 1000};
+    for (size_t i = 0; i < deadlines.size(); ++i) {
+        entries.emplace_back(new Recorder(&fired, i));
+        wheel.schedule(entries.back().get(), at(deadlines[i]));
+    }
+
+    for (size_t i = 0; i < deadlines.size(); ++i) {
+        wheel.advance(at(deadlines[i] - 10));
+        EXPECT_EQ(i, fired.size());
+        wheel.advance(at(deadlines[i]));
+        ASSERT_EQ(i + 1, fired.size());
+        EXPECT_EQ(static_cast<int>(i), fired.back());
+    }
+}
+
+TEST_F(TimerWheelTest, CancelAndReschedule) {
+    Recorder a(&fired, 1);
+    Recorder b(&fired, 2);
+    wheel.schedule(&a, at(100));
+    wheel.schedule(&b, at(100));
+    TimerWheel::cancel(&a);
+    EXPECT_FALSE(a.scheduled());
+    TimerWheel::cancel(&a);
+
+    // Rescheduling replaces the earlier deadline
+    wheel.schedule(&b, at(1000));
+    EXPECT_EQ(1u, wheel.size());
+    wheel.advance(at(500));
+    EXPECT_TRUE(fired.empty());
+    wheel.advance(at(1000));
+    EXPECT_EQ(std::vector<int>({2}), fired);
+
+    // Destroying a scheduled entry removes it
+    {
+        Recorder c(&fired, 3);
+        wheel.schedule(&c, at(2000));
+        EXPECT_EQ(1u, wheel.size());
+    }
+    EXPECT_EQ(0u, wheel.size());
+}
+
+TEST_F(TimerWheelTest, ExpiryMayCancelOrReschedule) {
+    Recorder a(&fired, 1);
+    Recorder b(&fired, 2);
+    wheel.schedule(&a, at(50));
+    wheel.schedule(&b, at(50));
+
+    // Whichever fires first cancels the other and reschedules itself
+    a.then = [&]() {
+        TimerWheel::cancel(&b);
+        wheel.schedule(&a, at(0));
+        a.then = nullptr;
+    };
+    b.then = [&]() {
+        TimerWheel::cancel(&a);
+        wheel.schedule(&b, at(0));
+        b.then = nullptr;
+    };
+
+    wheel.advance(at(50));
+    ASSERT_EQ(1u, fired.size());
+    EXPECT_EQ(1u, wheel.size());
+
+    // Deadlines in the past go to the next tick
+    wheel.advance(at(60));
+    ASSERT_EQ(2u, fired.size());
+    EXPECT_EQ(fired[0], fired[1]);
+    EXPECT_EQ(0u, wheel.size());
+}
+
+} // anonymous namespace
+} // topper namespace
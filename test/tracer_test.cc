@@ -0,0 +1,166 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "parameter_internal.h"
+#include "trace_resource.h"
+#include "tracer.h"
+
+namespace topper {
+namespace {
+
+Trace makeTrace(std::string const& resource, int64_t latency) {
+    Trace trace = Trace();
+    snprintf(trace.path, sizeof(trace.path), "%s", resource.c_str());
+    snprintf(trace.resource, sizeof(trace.resource), "%s", resource.c_str());
+    trace.method = HttpMethod::GET;
+    trace.status = HttpCode::OK;
+    trace.phases[Trace::DISPATCH] = latency;
+    return trace;
+}
+
+QueryParamsImpl query(std::string const& name, std::string const& value) {
+    std::unordered_multimap<std::string, std::string> params;
+    params.emplace(name, value);
+    return QueryParamsImpl(std::move(params));
+}
+
+std::string body(Response const& response) {
+    std::string full = response.to_string();
+    return full.substr(full.find("\r\n\r\n") + 4);
+}
+
+TEST(TracerTest, SamplesOneInPeriod) {
+    Tracer tracer(1);
+    tracer.setPeriod(10);
+    TraceRing *ring = tracer.ring(0);
+    int sampled = 0;
+    for (int i = 0; i < 1000; ++i) {
+        sampled += tracer.sample(ring);
+    }
+    EXPECT_EQ(100, sampled);
+}
+
+TEST(TracerTest, DisabledTracerSamplesNothing) {
+    Tracer tracer(1);
+    tracer.setPeriod(0);
+    int sampled = 0;
+    for (int i = 0; i < 100000; ++i) {
+        sampled += tracer.sample(tracer.ring(0));
+    }
+    EXPECT_EQ(0, sampled);
+
+    // Re-enabling takes effect within the recheck interval
+    tracer.setPeriod(1);
+    for (int i = 0; i < Tracer::kRecheck; ++i) {
+        sampled += tracer.sample(tracer.ring(0));
+    }
+    EXPECT_LT(0, sampled);
+}
+
+TEST(TracerTest, RingKeepsMostRecent) {
+    TraceRing ring(4);
+    std::vector<Trace> traces;
+    ring.collect(&traces);
+    EXPECT_TRUE(traces.empty());
+
+    for (int i = 0; i < 10; ++i) {
+        ring.push(makeTrace("/r", i));
+    }
+    ring.collect(&traces);
+    ASSERT_EQ(4u, traces.size());
+    int64_t sum = 0;
+    for (auto const& trace : traces) {
+        sum += trace.latency();
+    }
+    EXPECT_EQ(6 + 7 + 8 + 9, sum);
+}
+
+TEST(TracerTest, ConcurrentReadsAreConsistent) {
+    TraceRing ring(16);
+    std::atomic<bool> done{false};
+    std::thread writer([&ring, &done]() {
+            for (int i = 0; i < 200000; ++i) {
+                // Every field derives from the same value
+                Trace trace = makeTrace(std::to_string(i), i);
+                trace.base = i;
+                ring.push(trace);
+            }
+            done = true;
+        });
+
+    while (!done) {
+        std::vector<Trace> traces;
+        ring.collect(&traces);
+        for (auto const& trace : traces) {
+            ASSERT_EQ(std::to_string(trace.base), trace.path);
+            ASSERT_EQ(static_cast<int64_t>(trace.base), trace.latency());
+        }
+    }
+    writer.join();
+}
+
+TEST(TracerTest, ResourceListsSlowestPerRoute) {
+    Tracer tracer(2);
+    for (int i = 1; i <= 10; ++i) {
+        tracer.ring(i % 2)->push(makeTrace("/a", i * 1000));
+    }
+    tracer.ring(0)->push(makeTrace("/b", 5));
+
+    TraceResource resource(&tracer);
+    std::string json = body(resource.get(query("n", "2")));
+    EXPECT_EQ(0u, json.find("{\"period\":1000,\"routes\":{\"/a\":["));
+
+    // Slowest first, limited to n
+    size_t first = json.find("\"latency\":1e-05");
+    size_t second = json.find("\"latency\":9e-06");
+    EXPECT_NE(std::string::npos, first);
+    EXPECT_NE(std::string::npos, second);
+    EXPECT_LT(first, second);
+    EXPECT_EQ(std::string::npos, json.find("\"latency\":8e-06"));
+    EXPECT_NE(std::string::npos, json.find("\"/b\":[{\"method\":\"GET\""));
+
+    EXPECT_EQ(HttpCode::BAD_REQUEST, resource.get(query("n", "x")).code());
+}
+
+TEST(TracerTest, ResourceSetsPeriod) {
+    Tracer tracer(1);
+    TraceResource resource(&tracer);
+    EXPECT_EQ(HttpCode::OK, resource.put(query("period", "50")).code());
+    EXPECT_EQ(50u, tracer.period());
+    EXPECT_EQ(HttpCode::OK, resource.put(query("period", "0")).code());
+    EXPECT_EQ(0u, tracer.period());
+    EXPECT_EQ(HttpCode::BAD_REQUEST,
+        resource.put(query("period", "-1")).code());
+    EXPECT_EQ(HttpCode::BAD_REQUEST,
+        resource.put(query("rate", "1")).code());
+}
+
+} // anonymous namespace
+} // topper namespace
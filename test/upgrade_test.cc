@@ -0,0 +1,176 @@
+/*
+ * Copyright © 2015 Nathan Rosenblum <flander@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "upgrade.h"
+
+namespace topper {
+namespace {
+
+TEST(UpgradeTest, ActivationNeedsMatchingPid) {
+    ListenerFds fds = activatedListeners("100", "1", nullptr, 101);
+    EXPECT_TRUE(fds.application.empty());
+    EXPECT_TRUE(fds.admin.empty());
+
+    fds = activatedListeners(nullptr, "1", nullptr, 100);
+    EXPECT_TRUE(fds.application.empty());
+}
+
+TEST(UpgradeTest, ActivationAssignsSocketsInOrder) {
+    ListenerFds fds = activatedListeners("100", "1", nullptr, 100);
+    EXPECT_EQ(std::vector<int>{3}, fds.application);
+    EXPECT_TRUE(fds.admin.empty());
+
+    fds = activatedListeners("100", "2", nullptr, 100);
+    EXPECT_EQ(std::vector<int>{3}, fds.application);
+    EXPECT_EQ(std::vector<int>{4}, fds.admin);
+}
+
+TEST(UpgradeTest, ActivationHonorsNames) {
+    ListenerFds fds = activatedListeners("100", "3", "admin:http:http6", 100);
+    EXPECT_EQ((std::vector<int>{4, 5}), fds.application);
+    EXPECT_EQ(std::vector<int>{3}, fds.admin);
+}
+
+std::string socketPath() {
+    return "/tmp/topper-upgrade-test." + std::to_string(getpid());
+}
+
+bool sameSocket(int a, int b) {
+    struct stat sa, sb;
+    return fstat(a, &sa) == 0 && fstat(b, &sb) == 0 &&
+        sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+TEST(UpgradeTest, NothingToReceiveWithoutServer) {
+    ListenerFds fds = receiveListeners(socketPath());
+    EXPECT_TRUE(fds.application.empty());
+    EXPECT_TRUE(fds.admin.empty());
+}
+
+TEST(UpgradeTest, HandsOffListeners) {
+    int application = socket(AF_INET, SOCK_STREAM, 0);
+    int admin = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(application, 0);
+    ASSERT_GE(admin, 0);
+
+    std::atomic<bool> handedOff(false);
+    ListenerFds fds;
+    {
+        UpgradeServer server(socketPath(), [=]() {
+                ListenerFds fds;
+                fds.application.push_back(dup(application));
+                fds.admin.push_back(dup(admin));
+                return fds;
+            }, [&handedOff]() { handedOff = true; });
+
+        fds = receiveListeners(socketPath());
+        ASSERT_GE(fds.sender, 0);
+        acknowledgeListeners(fds.sender);
+        for (int i = 0; i < 100 && !handedOff; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    EXPECT_TRUE(handedOff);
+
+    ASSERT_EQ(1u, fds.application.size());
+    ASSERT_EQ(1u, fds.admin.size());
+    EXPECT_TRUE(sameSocket(application, fds.application[0]));
+    EXPECT_TRUE(sameSocket(admin, fds.admin[0]));
+
+    close(fds.application[0]);
+    close(fds.admin[0]);
+    close(application);
+    close(admin);
+    unlink(socketPath().c_str());
+}
+
+TEST(UpgradeTest, KeepsServingUntilAcknowledged) {
+    int application = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(application, 0);
+
+    std::atomic<bool> handedOff(false);
+    {
+        UpgradeServer server(socketPath(), [=]() {
+                ListenerFds fds;
+                fds.application.push_back(dup(application));
+                return fds;
+            }, [&handedOff]() { handedOff = true; },
+            std::chrono::milliseconds(50));
+
+        // A new process that fails to start
+        ListenerFds fds = receiveListeners(socketPath());
+        ASSERT_EQ(1u, fds.application.size());
+        close(fds.application[0]);
+        close(fds.sender);
+
+        // One that takes too long to start
+        fds = receiveListeners(socketPath());
+        ASSERT_EQ(1u, fds.application.size());
+        close(fds.application[0]);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        acknowledgeListeners(fds.sender);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        EXPECT_FALSE(handedOff);
+
+        // The sockets are still on offer
+        fds = receiveListeners(socketPath());
+        ASSERT_EQ(1u, fds.application.size());
+        EXPECT_TRUE(sameSocket(application, fds.application[0]));
+        close(fds.application[0]);
+        close(fds.sender);
+    }
+    EXPECT_FALSE(handedOff);
+
+    close(application);
+    unlink(socketPath().c_str());
+}
+
+TEST(UpgradeTest, StoppedServerHandsOffNothing) {
+    std::atomic<bool> handedOff(false);
+    ListenerFds fds;
+    {
+        UpgradeServer server(socketPath(), []() { return ListenerFds(); },
+            [&handedOff]() { handedOff = true; });
+        fds = receiveListeners(socketPath());
+    }
+    EXPECT_FALSE(handedOff);
+    EXPECT_TRUE(fds.application.empty());
+    EXPECT_TRUE(fds.admin.empty());
+    EXPECT_EQ(-1, fds.sender);
+    unlink(socketPath().c_str());
+}
+
+} // anonymous namespace
+} // topper namespace